@@ -0,0 +1,271 @@
+/* credis-rdb.c -- reports memory usage per key prefix, type and the largest
+ * keys of a Redis snapshot (RDB) file, using credis
+ *
+ * Copyright (c) 2009-2010, Jonas Romfelt <jonas at romfelt dot se>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Credis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "credis.h"
+
+#define TYPES 9
+#define PREFIX_TABLE_SIZE 1024
+
+typedef struct _stat {
+  char *name;
+  long long keys;
+  long long bytes;
+  long long elements;
+} stat_t;
+
+typedef struct _report {
+  const char *delimiters;
+  stat_t types[TYPES];
+  stat_t *prefixes;
+  int prefix_size;
+  int prefix_len;
+  stat_t *largest;
+  int largest_size;
+  int largest_len;
+  long long keys;
+  long long bytes;
+} report_t;
+
+static const char *type_names[TYPES] =
+  {"unknown", "none", "string", "list", "set", "zset", "hash", "stream", "module"};
+
+unsigned int hash(const char *str, int len)
+{
+  unsigned int h = 5381;
+
+  while (len-- > 0)
+    h = h * 33 + (unsigned char) *str++;
+
+  return h;
+}
+
+/* returns slot of prefix `name' (of `len' bytes) in hash table, which is 
+ * either the slot it is stored in or the empty slot to store it in */
+stat_t *prefix_slot(report_t *r, const char *name, int len)
+{
+  stat_t *s;
+  int i = hash(name, len) & (r->prefix_size - 1);
+
+  for (s = &r->prefixes[i]; s->name != NULL; s = &r->prefixes[i]) {
+    if (!strncmp(s->name, name, len) && s->name[len] == '\0')
+      break;
+    i = (i + 1) & (r->prefix_size - 1);
+  }
+
+  return s;
+}
+
+/* returns statistics of prefix `name' (of `len' bytes), added if not found */
+stat_t *prefix_lookup(report_t *r, const char *name, int len)
+{
+  stat_t *s, *old;
+  int i, old_size;
+
+  /* keep hash table at most half full */
+  if (r->prefix_len * 2 >= r->prefix_size) {
+    old = r->prefixes;
+    old_size = r->prefix_size;
+
+    r->prefix_size = old_size ? old_size * 2 : PREFIX_TABLE_SIZE;
+    if ((r->prefixes = calloc(r->prefix_size, sizeof(stat_t))) == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    for (i = 0; i < old_size; i++)
+      if (old[i].name != NULL)
+        *prefix_slot(r, old[i].name, strlen(old[i].name)) = old[i];
+    free(old);
+  }
+
+  if ((s = prefix_slot(r, name, len))->name != NULL)
+    return s;
+
+  if ((s->name = malloc(len + 1)) == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  memcpy(s->name, name, len);
+  s->name[len] = '\0';
+  r->prefix_len++;
+
+  return s;
+}
+
+/* keeps the `largest_size' largest keys, sorted on size */
+void largest_add(report_t *r, const REDIS_RDB_RECORD *rec, long long bytes)
+{
+  stat_t *s;
+  int i;
+
+  if (r->largest_len == r->largest_size) {
+    if (bytes <= r->largest[r->largest_len - 1].bytes)
+      return;
+    free(r->largest[--r->largest_len].name);
+  }
+
+  for (i = r->largest_len; i > 0 && r->largest[i - 1].bytes < bytes; i--)
+    r->largest[i] = r->largest[i - 1];
+
+  s = &r->largest[i];
+  s->name = malloc(rec->keylen + 1);
+  memcpy(s->name, rec->key, rec->keylen);
+  s->name[rec->keylen] = '\0';
+  s->keys = rec->type;
+  s->bytes = bytes;
+  s->elements = rec->elements;
+  r->largest_len++;
+}
+
+int record(const REDIS_RDB_RECORD *rec, void *arg)
+{
+  report_t *r = arg;
+  long long bytes = rec->keylen + rec->size;
+  stat_t *s;
+  int len;
+
+  s = &r->types[(rec->type > 0 && rec->type < TYPES) ? rec->type : 0];
+  s->keys++;
+  s->bytes += bytes;
+  s->elements += rec->elements;
+
+  for (len = 0; len < rec->keylen && !strchr(r->delimiters, rec->key[len]); len++)
+    ;
+  s = prefix_lookup(r, rec->key, len);
+  s->keys++;
+  s->bytes += bytes;
+  s->elements += rec->elements;
+
+  largest_add(r, rec, bytes);
+
+  r->keys++;
+  r->bytes += bytes;
+
+  return 0;
+}
+
+int compare_bytes(const void *a, const void *b)
+{
+  const stat_t *sa = a, *sb = b;
+
+  if (sa->bytes == sb->bytes)
+    return 0;
+  return sa->bytes < sb->bytes ? 1 : -1;
+}
+
+void usage(const char *name)
+{
+  printf("Usage: %s [-d <delimiters>] [-n <num>] <dump.rdb>\n\n"\
+         "  -d  characters that end a key prefix (default \":\")\n"\
+         "  -n  number of prefixes and keys to list (default 20)\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  report_t r;
+  struct timeval start, stop;
+  long long rc;
+  double secs;
+  int opt, num = 20, i, j;
+
+  memset(&r, 0, sizeof(r));
+  r.delimiters = ":";
+
+  while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+    switch (opt) {
+    case 'd':
+      r.delimiters = optarg;
+      break;
+    case 'n':
+      if ((num = atoi(optarg)) <= 0)
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1)
+    usage(argv[0]);
+
+  r.largest_size = num;
+  r.largest = calloc(num, sizeof(stat_t));
+
+  gettimeofday(&start, NULL);
+  rc = credis_rdb_file(argv[optind], record, NULL, &r);
+  gettimeofday(&stop, NULL);
+
+  if (rc < 0) {
+    printf("Error parsing %s: %lld\n", argv[optind], rc);
+    exit(1);
+  }
+
+  secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+  printf("Parsed %lld bytes, %lld keys in %.3f seconds (%.1f MB/second)\n",
+         rc, r.keys, secs, secs > 0 ? rc / secs / (1024 * 1024) : 0);
+
+  printf("\n\n************* types **************************************** \n");
+  printf("%-10s %12s %16s %8s %14s\n", "type", "keys", "bytes", "%", "elements");
+  for (i = 1; i < TYPES + 1; i++) {
+    stat_t *s = &r.types[i % TYPES];
+    if (s->keys == 0)
+      continue;
+    printf("%-10s %12lld %16lld %7.2f%% %14lld\n", type_names[i % TYPES], s->keys,
+           s->bytes, r.bytes ? 100.0 * s->bytes / r.bytes : 0, s->elements);
+  }
+
+  /* compact hash table and sort on size */
+  for (i = 0, j = 0; i < r.prefix_size; i++)
+    if (r.prefixes[i].name != NULL)
+      r.prefixes[j++] = r.prefixes[i];
+  qsort(r.prefixes, j, sizeof(stat_t), compare_bytes);
+
+  printf("\n\n************* prefixes (%d of %d) ************************** \n",
+         j < num ? j : num, j);
+  printf("%-32s %12s %16s %8s %14s\n", "prefix", "keys", "bytes", "%", "elements");
+  for (i = 0; i < j && i < num; i++)
+    printf("%-32s %12lld %16lld %7.2f%% %14lld\n", r.prefixes[i].name, r.prefixes[i].keys,
+           r.prefixes[i].bytes, r.bytes ? 100.0 * r.prefixes[i].bytes / r.bytes : 0,
+           r.prefixes[i].elements);
+
+  printf("\n\n************* largest keys ********************************* \n");
+  printf("%-32s %-10s %16s %14s\n", "key", "type", "bytes", "elements");
+  for (i = 0; i < r.largest_len; i++)
+    printf("%-32s %-10s %16lld %14lld\n", r.largest[i].name,
+           type_names[r.largest[i].keys < TYPES ? r.largest[i].keys : 0],
+           r.largest[i].bytes, r.largest[i].elements);
+
+  return 0;
+}
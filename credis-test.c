@@ -56,11 +56,92 @@ long timer(int reset)
   return 0;
 }
 
+/* returns wall clock in microseconds */
+long utimer(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return ((long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+int compare_long(const void *a, const void *b)
+{
+  long la = *(const long *)a, lb = *(const long *)b;
+
+  return la < lb ? -1 : la > lb;
+}
+
 unsigned long getrandom(unsigned long max)
 {
   return (1 + (unsigned long) ( ((double)max) * (rand() / (RAND_MAX + 1.0))));
 }
 
+/* counts stream entries delivered */
+int count_entry(const REDIS_STREAM_ENTRY *entry, void *arg)
+{
+  (void) entry;
+  (*(int *)arg)++;
+
+  return 0;
+}
+
+/* computes value of a cache key, counting computations */
+int compute_value(const char *key, char **val, void *arg)
+{
+  (void) key;
+  (*(int *)arg)++;
+  *val = "computed";
+
+  return 0;
+}
+
+/* checks the start of the snapshot master transfers and stops replication */
+int check_snapshot(const char *data, int len, void *arg)
+{
+  *(int *)arg = len >= 5 && !strncmp(data, "REDIS", 5);
+
+  return 1;
+}
+
+/* prints a key-value pair of a snapshot */
+int print_record(const REDIS_RDB_RECORD *rec, void *arg)
+{
+  (*(int *)arg)++;
+  printf("  db %d type %d key %.*s elements %lld\n", 
+         rec->db, rec->type, rec->keylen, rec->key, rec->elements);
+
+  return 0;
+}
+
+/* prints keyspace events delivered */
+int print_events(const REDIS_EVENT *eventv, int eventc, void *arg)
+{
+  int i;
+
+  (void) arg;
+  for (i = 0; i < eventc; i++)
+    printf("  db %d key %.*s event %.*s\n", eventv[i].db, eventv[i].keylen, 
+           eventv[i].key, eventv[i].eventlen, eventv[i].event);
+
+  return 0;
+}
+
+/* prints a command read from an append-only file */
+int print_command(int argc, char **argv, int *argl, void *arg)
+{
+  int i;
+
+  (void) arg;
+  printf(" ");
+  for (i = 0; i < argc; i++)
+    printf(" %.*s", argl[i], argv[i]);
+  printf("\n");
+
+  return 0;
+}
+
 void randomize()
 {
   struct timeval tv;
@@ -71,6 +152,19 @@ void randomize()
 #define DUMMY_DATA "some dummy data string"
 #define LONG_DATA 50000
 
+/* snapshot with keys in database 0 and 1 */
+#define RDB_DATA \
+  "REDIS0009" \
+  "\xfe\x00" "\x00\x02" "k0" "\x02" "v0" \
+  "\xfe\x01" "\x00\x06" "strkey" "\x0b" "hello world" \
+  "\x02\x05" "myset" "\x02" "\x05" "alpha" "\x04" "beta" \
+  "\xff" "\x00\x00\x00\x00\x00\x00\x00\x00"
+
+/* snapshot preamble followed by a command */
+static const char AOF_DATA[] = 
+  RDB_DATA
+  "*3\r\n$3\r\nSET\r\n$5\r\nafter\r\n$3\r\nyes\r\n";
+
 int main(int argc, char **argv) {
   REDIS redis;
   REDIS_INFO info;
@@ -85,24 +179,46 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
-  if (argc == 2) {
+  if (argc == 2 || argc == 3) {
     int i;
-    long t;
+    long t, *latv;
     int num = atoi(argv[1]);
+    const double percentiles[] = {50, 90, 99, 99.9, 99.99, 100};
+    if (num <= 0) {
+      printf("Number of commands must be positive\n");
+      exit(1);
+    }
+    if (argc == 3) {
+      rc = credis_setbusypoll(redis, atoi(argv[2]));
+      printf("Busy-polling for %s microseconds%s\n", argv[2], 
+             rc ? " (socket busy polling not permitted)" : "");
+    }
+    if ((latv = malloc(num * sizeof(long))) == NULL) {
+      printf("Out of memory\n");
+      exit(1);
+    }
     printf("Sending %d 'set' commands ...\n", num);
     timer(1);
     for (i=0; i<num; i++) {
+      latv[i] = utimer();
       if (credis_set(redis, "kalle", "qwerty") != 0)
         printf("get returned error\n");
+      latv[i] = utimer() - latv[i];
     }
     t = timer(0);
     printf("done! Took %.3f seconds, that is %ld commands/second\n", ((float)t)/1000, (num*1000)/t);
+    qsort(latv, num, sizeof(long), compare_long);
+    printf("latency percentiles in microseconds:\n");
+    for (i=0; i<(int)(sizeof(percentiles)/sizeof(percentiles[0])); i++)
+      printf("%8.2f%% %8ld\n", percentiles[i], latv[(int)(percentiles[i] / 100 * (num - 1))]);
+    free(latv);
     exit(0);
   }
 
   printf("Testing a number of credis functions. To perform a simplistic set-command\n"\
-         "benchmark, run: `%s <num>' where <num> is the number\n"\
-         "of set-commands to send.\n\n", argv[0]);
+         "benchmark, run: `%s <num> [<usecs>]' where <num> is the number\n"\
+         "of set-commands to send and <usecs> microseconds to busy-poll for\n"\
+         "replies.\n\n", argv[0]);
 
   printf("\n\n************* misc info ************************************ \n");
 
@@ -330,7 +446,571 @@ int main(int argc, char **argv) {
   printf("zrevrank returned: %d\n", rc);
   if (rc < 0)
     printf("Error message: %s\n", credis_errorreply(redis));
+
+
+  printf("\n\n************* incremental deletion ************************* \n");
+
+  {
+    REDIS_DELETE_OPTIONS delopts;
+    long long deleted;
+    char delkey[16];
+
+    memset(&delopts, 0, sizeof(delopts));
+    delopts.batch = 50;
+    rc = credis_del_incremental(redis, "mylist", &delopts, &deleted);
+    printf("del_incremental returned: %d, deleted %lld (expected 0, 200)\n", rc, deleted);
+    rc = credis_llen(redis, "mylist");
+    printf("length of list: %d (expected 0)\n", rc);
+    rc = credis_del_incremental(redis, "mylist", &delopts, &deleted);
+    printf("del_incremental returned: %d (expected -1)\n", rc);
+
+    for (i = 0; i < 120; i++) {
+      sprintf(delkey, "delkey%d", i);
+      credis_set(redis, delkey, "value");
+    }
+    rc = credis_del_pattern(redis, "delkey*", &delopts, &deleted);
+    printf("del_pattern returned: %d, deleted %lld (expected 0, 120)\n", rc, deleted);
+  }
+
+
+  printf("\n\n************* numeric replies ****************************** \n");
+
+  {
+    const char *numelemv[] = {"1", "2", "3", "-4", "5.5"};
+    long long numv[5];
+    double dblv[5];
+
+    credis_del(redis, "numlist");
+    credis_del(redis, "numset");
+    for (i = 0; i < 5; i++) {
+      credis_rpush(redis, "numlist", numelemv[i]);
+      credis_sadd(redis, "numset", numelemv[i]);
+    }
+
+    rc = credis_lrange_int64(redis, "numlist", 0, 3, numv, 5);
+    printf("lrange_int64 returned: %d, %lld %lld %lld %lld (expected 4, 1 2 3 -4)\n", 
+           rc, numv[0], numv[1], numv[2], numv[3]);
+    rc = credis_lrange_int64(redis, "numlist", 0, -1, numv, 5);
+    printf("lrange_int64 of non-integer returned: %d (expected %d)\n", rc, CREDIS_ERR);
+    rc = credis_lrange_double(redis, "numlist", 0, -1, dblv, 2);
+    printf("lrange_double returned: %d, %g %g (expected 5, 1 2)\n", rc, dblv[0], dblv[1]);
+    rc = credis_smembers_double(redis, "numset", dblv, 5);
+    printf("smembers_double returned: %d (expected 5)\n", rc);
+
+    credis_del(redis, "numlist");
+    credis_del(redis, "numset");
+  }
+
+
+  printf("\n\n************* variadic commands **************************** \n");
+
+  {
+    const char *elemv[] = {"a", "b", "c", "d", "e"};
+
+    credis_del(redis, "varlist");
+    rc = credis_rpushv(redis, "varlist", 5, elemv);
+    printf("rpushv returned: %d (expected 5)\n", rc);
+    rc = credis_llen(redis, "varlist");
+    printf("length of list: %d (expected 5)\n", rc);
+
+    credis_del(redis, "varset");
+    rc = credis_saddv(redis, "varset", 3, elemv);
+    printf("saddv returned: %d (expected 3)\n", rc);
+    rc = credis_saddv(redis, "varset", 5, elemv);
+    printf("saddv returned: %d (expected 2)\n", rc);
+
+    credis_del(redis, "varlist");
+    credis_del(redis, "varset");
+  }
+
+
+  printf("\n\n************* batches ************************************** \n");
+
+  {
+    const char *bkeyv[] = {"batch1", "batch2", "batch3"};
+    const char *bvalv[] = {"one", "two", "three"};
+    const int bttlv[] = {0, 100, 0};
+    char *bgotv[3];
+    int statusv[3];
+
+    rc = credis_batch_set_ex(redis, 3, bkeyv, bvalv, bttlv, statusv);
+    printf("batch_set_ex returned: %d, statuses %d %d %d (expected 3, 0 0 0)\n", 
+           rc, statusv[0], statusv[1], statusv[2]);
+    printf("ttl of batch2=%d (expected 100)\n", credis_ttl(redis, "batch2"));
+
+    credis_del(redis, "batch3");
+    rc = credis_batch_get(redis, 3, bkeyv, bgotv, statusv);
+    printf("batch_get returned: %d, statuses %d %d %d (expected 2, 0 0 -1), values %s %s\n", 
+           rc, statusv[0], statusv[1], statusv[2], bgotv[0], bgotv[1]);
+
+    rc = credis_batch_exists(redis, 3, bkeyv, statusv);
+    printf("batch_exists returned: %d, statuses %d %d %d (expected 2, 0 0 -1)\n", 
+           rc, statusv[0], statusv[1], statusv[2]);
+
+    rc = credis_batch_del(redis, 3, bkeyv, statusv);
+    printf("batch_del returned: %d, statuses %d %d %d (expected 2, 0 0 -1)\n", 
+           rc, statusv[0], statusv[1], statusv[2]);
+  }
+
+
+  printf("\n\n************* expiring keys and cache ********************** \n");
+
+  rc = credis_setex(redis, "exkey", 100, "value");
+  printf("setex returned: %d, ttl=%d (expected 100)\n", rc, credis_ttl(redis, "exkey"));
+
+  rc = credis_psetex(redis, "exkey", 5000, "value");
+  printf("psetex returned: %d, ttl=%d (expected 5)\n", rc, credis_ttl(redis, "exkey"));
+
+  {
+    REDIS_CACHE_OPTIONS cacheopts;
+    int computed = 0;
+
+    memset(&cacheopts, 0, sizeof(cacheopts));
+    cacheopts.ttl = 60000;
+    credis_del(redis, "cachekey");
+    rc = credis_cache_get(redis, "cachekey", &cacheopts, compute_value, &computed, &val);
+    printf("cache_get on miss returned: %d, %s, computed %d times (expected 0, computed, 1)\n", 
+           rc, rc == 0 ? val : "(none)", computed);
+    rc = credis_cache_get(redis, "cachekey", &cacheopts, compute_value, &computed, &val);
+    printf("cache_get on hit returned: %d, %s, computed %d times (expected 0, computed, 1)\n", 
+           rc, rc == 0 ? val : "(none)", computed);
+    rc = credis_get(redis, "cachekey", &val);
+    printf("stored value: %s (expected <delta>:computed)\n", rc == 0 ? val : "(none)");
+
+    rc = credis_cache_set(redis, "cachekey", "stored", 60000, 5);
+    rc = credis_cache_get(redis, "cachekey", NULL, NULL, NULL, &val);
+    printf("cache_get after cache_set returned: %d, %s (expected 0, stored)\n", 
+           rc, rc == 0 ? val : "(none)");
+    credis_del(redis, "cachekey");
+    rc = credis_cache_get(redis, "cachekey", NULL, NULL, NULL, &val);
+    printf("cache_get of missing key without compute returned: %d (expected -1)\n", rc);
+  }
+
+
+  printf("\n\n************* chunked values ******************************* \n");
+
+  {
+    long long len;
+    char *chunked;
+
+    rc = credis_chunked_set(&redis, 1, "chunked", lstr, strlen(lstr), 4096);
+    printf("chunked_set returned: %d\n", rc);
+    rc = credis_chunked_get(&redis, 1, "chunked", &chunked, &len);
+    printf("chunked_get returned: %d, len %lld, strcmp() returned %d (expected 0, %d, 0)\n", 
+           rc, rc == 0 ? len : 0, rc == 0 ? strcmp(chunked, lstr) : -1, (int) strlen(lstr));
+    if (rc == 0)
+      free(chunked);
+    rc = credis_chunked_del(&redis, 1, "chunked");
+    printf("chunked_del returned: %d\n", rc);
+    rc = credis_chunked_get(&redis, 1, "chunked", &chunked, &len);
+    printf("chunked_get after delete returned: %d (expected -1)\n", rc);
+  }
+
+
+  printf("\n\n************* streams ************************************** \n");
+
+  {
+    REDIS_STREAM stream;
+    const int fieldcv[] = {1, 1, 1};
+    const char *fieldv[] = {"n", "1", "n", "2", "n", "3"};
+    char *idv[3];
+    int entries = 0;
+
+    credis_del(redis, "mystream");
+    rc = credis_xgroup_create(redis, "mystream", "readers", "0", 1);
+    printf("xgroup_create returned: %d\n", rc);
+
+    rc = credis_xaddv(redis, "mystream", 0, 3, fieldcv, fieldv, idv);
+    printf("xaddv returned: %d (expected 3)\n", rc);
+
+    if ((stream = credis_stream_open(redis, "mystream", "readers", "test")) != NULL) {
+      rc = credis_stream_read(stream, 0, 0, count_entry, &entries);
+      printf("stream_read returned: %d, entries %d (expected 3, 3)\n", rc, entries);
+      rc = credis_stream_ack(stream);
+      printf("stream_ack returned: %d\n", rc);
+      credis_stream_close(stream);
+    }
+    else
+      printf("stream_open failed, streams require Redis >= 5.0\n");
+  }
+
+
+  printf("\n\n************* L2 cache ************************************ \n");
+
+  {
+    REDIS reader;
+    REDIS_L2_STATS stats;
+    long long deleted;
+
+    remove("credis-test.l2");
+    rc = credis_l2_attach(redis, "credis-test.l2", 1 << 20, 60000, 0);
+    printf("l2_attach returned: %d\n", rc);
+    rc = credis_set(redis, "l2key", "cached");
+    rc = credis_get(redis, "l2key", &val);
+    rc = credis_get(redis, "l2key", &val);
+    credis_l2_stats(redis, &stats);
+    printf("get l2key returned: %s, hits=%lld (expected 2)\n", val, stats.hits);
+
+    rc = credis_del_pattern(redis, "l2ke?", NULL, &deleted);
+    rc = credis_get(redis, "l2key", &val);
+    printf("get l2key after del_pattern returned: %d (expected -1)\n", rc);
+
+    reader = credis_connect(NULL, 0, 10000);
+    rc = credis_set(redis, "l2key", "cached");
+    rc = credis_get(redis, "l2key", &val);
+    rc = credis_l2_attach(reader, "credis-test.l2", 0, 60000, 1);
+    printf("l2_attach read-only returned: %d\n", rc);
+    rc = credis_set(reader, "l2key", "written");
+    rc = credis_get(reader, "l2key", &val);
+    printf("read-only get l2key returned: %s (expected written)\n", val);
+    credis_close(reader);
+
+    credis_l2_detach(redis);
+    remove("credis-test.l2");
+  }
  
+
+
+  printf("\n\n************* replication ********************************** \n");
+
+  {
+    REDIS replica;
+    int snapshot = 0;
+
+    if ((replica = credis_connect(NULL, 0, 10000)) != NULL) {
+      rc = credis_sync(replica, check_snapshot, NULL, &snapshot);
+      printf("sync returned: %d, snapshot received %d (expected 0, 1)\n", rc, snapshot);
+      credis_close(replica);
+    }
+  }
+
+
+  printf("\n\n************* snapshot parsing ***************************** \n");
+
+  {
+    long long n;
+    int records = 0;
+
+    printf("rdb_parse records (expected k0 and strkey of type %d, myset of type %d\n"
+           "with 2 elements):\n", CREDIS_TYPE_STRING, CREDIS_TYPE_SET);
+    n = credis_rdb_parse(RDB_DATA, sizeof(RDB_DATA) - 1, print_record, NULL, &records);
+    printf("rdb_parse returned: %lld, records %d (expected %d, 3)\n", 
+           n, records, (int) sizeof(RDB_DATA) - 1);
+    n = credis_rdb_parse(RDB_DATA, sizeof(RDB_DATA) - 11, NULL, NULL, NULL);
+    printf("rdb_parse of truncated snapshot returned: %lld (expected <0)\n", n);
+  }
+
+
+  printf("\n\n************* append-only files **************************** \n");
+
+  {
+    REDIS_AOF_STATS aofstats;
+    FILE *f;
+    long long n;
+
+    if ((f = fopen("credis-test.aof", "wb")) != NULL) {
+      fwrite(AOF_DATA, 1, sizeof(AOF_DATA) - 1, f);
+      fclose(f);
+    }
+    printf("aof_file commands (expected SET k0 v0, SELECT 1, SET strkey hello world,\n"
+           "SADD myset alpha, SADD myset beta, SET after yes):\n");
+    n = credis_aof_file("credis-test.aof", print_command, NULL);
+    printf("aof_file returned: %lld (expected 6)\n", n);
+
+    rc = credis_aof_replay(redis, "credis-test.aof", NULL, &aofstats);
+    printf("aof_replay returned: %d, sent %lld, errors %lld (expected 0, 6, 0)\n", 
+           rc, aofstats.sent, aofstats.errors);
+    credis_select(redis, 1);
+    rc = credis_get(redis, "strkey", &val);
+    printf("get strkey in database 1 returned: %s (expected hello world)\n", 
+           rc == 0 ? val : "(none)");
+    credis_del(redis, "strkey");
+    credis_del(redis, "myset");
+    credis_del(redis, "after");
+    credis_select(redis, 0);
+    credis_del(redis, "k0");
+    remove("credis-test.aof");
+  }
+
+
+  printf("\n\n************* keyspace analysis **************************** \n");
+
+  {
+    REDIS_ANALYZE_OPTIONS anaopts;
+    REDIS_ANALYZE_REPORT report;
+    char anakey[16];
+
+    for (i = 0; i < 10; i++) {
+      sprintf(anakey, "ana:%d", i);
+      credis_set(redis, anakey, "value");
+    }
+    credis_del(redis, "ana:list");
+    for (i = 0; i < 100; i++)
+      credis_rpush(redis, "ana:list", DUMMY_DATA);
+
+    memset(&anaopts, 0, sizeof(anaopts));
+    anaopts.pattern = "ana:*";
+    rc = credis_analyze(&redis, 1, &anaopts, &report);
+    printf("analyze returned: %d, keys %lld, strings %lld, lists %lld (expected 0, 11, 10, 1)\n", 
+           rc, report.total.keys, report.types[CREDIS_TYPE_STRING].sampled, 
+           report.types[CREDIS_TYPE_LIST].sampled);
+    if (rc == 0) {
+      printf("first prefix %s with %lld keys, biggest key %s with %lld elements "
+             "(expected ana, 11, ana:list, 100)\n", 
+             report.prefixc > 0 ? report.prefixes[0].name : "(none)", 
+             report.prefixc > 0 ? report.prefixes[0].keys : 0,
+             report.biggestc > 0 ? report.biggest[0].name : "(none)", 
+             report.biggestc > 0 ? report.biggest[0].elements : 0);
+      credis_analyze_free(&report);
+    }
+
+    for (i = 0; i < 10; i++) {
+      sprintf(anakey, "ana:%d", i);
+      credis_del(redis, anakey);
+    }
+    credis_del(redis, "ana:list");
+  }
+
+
+  printf("\n\n************* hot keys ************************************* \n");
+
+  {
+    const char *hkeyv[] = {"hotkey", "hotkey", "coldkey"};
+    char *hgotv[3];
+    int statusv[3];
+    REDIS_HOTKEY hot[4];
+
+    rc = credis_hotkeys_enable(1, 4, NULL, NULL);
+    printf("hotkeys_enable returned: %d\n", rc);
+    for (i = 0; i < 10; i++)
+      credis_batch_get(redis, 3, hkeyv, hgotv, statusv);
+    rc = credis_hotkeys(hot, 4);
+    printf("hotkeys returned: %d, first %s count %lld (expected 2, hotkey 20)\n", 
+           rc, rc > 0 ? hot[0].key : "(none)", rc > 0 ? hot[0].count : 0);
+    credis_hotkeys_disable();
+  }
+
+
+  printf("\n\n************* striped counters and replicated keys ********* \n");
+
+  {
+    long long count;
+
+    credis_counter_del(&redis, 1, "counter", 4);
+    for (i = 0; i < 3; i++)
+      credis_counter_incr(&redis, 1, "counter", 4, 5);
+    rc = credis_counter_get(&redis, 1, "counter", 4, &count);
+    printf("counter_get returned: %d, value %lld (expected 0, 15)\n", rc, count);
+    rc = credis_counter_del(&redis, 1, "counter", 4);
+    rc = credis_counter_get(&redis, 1, "counter", 4, &count);
+    printf("counter_get after delete returned: %d, value %lld (expected 0, 0)\n", rc, count);
+
+    rc = credis_replicated_set(&redis, 1, "replicated", 3, "copy");
+    printf("replicated_set returned: %d\n", rc);
+    rc = credis_replicated_get(&redis, 1, "replicated", 3, &val);
+    printf("replicated_get returned: %d, %s (expected 0, copy)\n", rc, rc == 0 ? val : "(none)");
+    rc = credis_replicated_del(&redis, 1, "replicated", 3);
+    rc = credis_replicated_get(&redis, 1, "replicated", 3, &val);
+    printf("replicated_get after delete returned: %d (expected -1)\n", rc);
+  }
+
+
+  printf("\n\n************* negative lookup filter *********************** \n");
+
+  {
+    REDIS_FILTER_STATS fstats;
+
+    rc = credis_filter_enable(redis, 10000, 0.01);
+    printf("filter_enable returned: %d\n", rc);
+    rc = credis_filter_rebuild(redis);
+    credis_filter_stats(redis, &fstats);
+    printf("filter_rebuild returned: %d, valid %d (expected 0, 1)\n", rc, fstats.valid);
+
+    credis_set(redis, "filtered", "value");
+    rc = credis_get(redis, "filtered", &val);
+    printf("get of key set after rebuild returned: %d, %s (expected 0, value)\n", 
+           rc, rc == 0 ? val : "(none)");
+    rc = credis_exists(redis, "filtermissing");
+    rc = credis_get(redis, "filtermissing", &val);
+    credis_filter_stats(redis, &fstats);
+    printf("get of missing key returned: %d, lookups %lld, of missing keys %lld "
+           "(expected -1, 3, 2)\n", 
+           rc, fstats.lookups, fstats.negatives + fstats.false_positives);
+
+    credis_filter_disable(redis);
+    rc = credis_filter_stats(redis, &fstats);
+    printf("filter_stats after disable returned: %d (expected %d)\n", rc, CREDIS_ERR);
+    credis_del(redis, "filtered");
+  }
+
+
+  printf("\n\n************* client-side set operations ******************* \n");
+
+  {
+    REDIS setv[2];
+    const char *setkeyv[] = {"seta", "setb"};
+    const char *setav[] = {"a", "b", "c", "d"};
+    const char *setbv[] = {"c", "d", "e"};
+
+    setv[0] = redis;
+    if ((setv[1] = credis_connect(NULL, 0, 10000)) != NULL) {
+      credis_del(redis, "seta");
+      credis_del(redis, "setb");
+      credis_saddv(redis, "seta", 4, setav);
+      credis_saddv(redis, "setb", 3, setbv);
+
+      rc = credis_sinter_local(setv, 2, 2, setkeyv, &valv);
+      printf("sinter_local returned: %d, first %s (expected 2, c)\n", 
+             rc, rc > 0 ? valv[0] : "(none)");
+      rc = credis_sunion_local(setv, 2, 2, setkeyv, &valv);
+      printf("sunion_local returned: %d, first %s (expected 5, a)\n", 
+             rc, rc > 0 ? valv[0] : "(none)");
+      rc = credis_sdiff_local(setv, 2, 2, setkeyv, &valv);
+      printf("sdiff_local returned: %d, last %s (expected 2, b)\n", 
+             rc, rc > 0 ? valv[rc - 1] : "(none)");
+      rc = credis_sdiffstore_local(setv, 2, "setdiff", 2, setkeyv);
+      printf("sdiffstore_local returned: %d, scard %d (expected 2, 2)\n", 
+             rc, credis_scard(redis, "setdiff"));
+
+      credis_del(redis, "seta");
+      credis_del(redis, "setb");
+      credis_del(redis, "setdiff");
+      credis_close(setv[1]);
+    }
+  }
+
+
+  printf("\n\n************* sorted set views ***************************** \n");
+
+  {
+    REDIS_ZVIEW view;
+    double zscore;
+    long start;
+
+    credis_del(redis, "zview");
+    credis_zadd(redis, "zview", 1.0, "one");
+    credis_zadd(redis, "zview", 2.0, "two");
+    credis_zadd(redis, "zview", 3.0, "three");
+
+    if ((view = credis_zview_open(redis, "zview")) != NULL) {
+      rc = credis_zview_zcard(view);
+      printf("zview_zcard returned: %d (expected 3)\n", rc);
+      rc = credis_zview_zrevrank(view, "three");
+      printf("zview_zrevrank returned: %d (expected 0)\n", rc);
+      rc = credis_zview_zrange(view, 0, -1, &valv);
+      printf("zview_zrange returned: %d, first %s (expected 3, one)\n", 
+             rc, rc > 0 ? valv[0] : "(none)");
+
+      /* view is updated once the notification of the change is received */
+      credis_zadd(redis, "zview", 0.5, "half");
+      for (start = utimer(); credis_zview_zcard(view) != 4 && utimer() - start < 1000000; )
+        ;
+      rc = credis_zview_zscore(view, "half", &zscore);
+      printf("zview_zscore after zadd returned: %d, score %g (expected 0, 0.5)\n", rc, zscore);
+      rc = credis_zview_zrank(view, "half");
+      printf("zview_zrank after zadd returned: %d (expected 0)\n", rc);
+      credis_zview_close(view);
+    }
+    else
+      printf("zview_open failed, keyspace notifications could not be subscribed\n");
+    credis_del(redis, "zview");
+  }
+
+
+  printf("\n\n************* keyspace notifications *********************** \n");
+
+  {
+    REDIS_NOTIFY notify;
+
+    if ((notify = credis_notify_open(redis, "Eg$", 0, NULL)) != NULL) {
+      rc = credis_notify_filter(notify, "notify:*", "set");
+      printf("notify_filter returned: %d\n", rc);
+      credis_set(redis, "notify:a", "value");
+      credis_set(redis, "unnotified", "value");
+      credis_del(redis, "notify:a");
+      credis_del(redis, "unnotified");
+      printf("notify_poll events (expected key notify:a event set):\n");
+      rc = credis_notify_poll(notify, 1000, 0, print_events, NULL);
+      printf("notify_poll returned: %d (expected 1)\n", rc);
+      rc = credis_notify_poll(notify, 100, 0, print_events, NULL);
+      printf("notify_poll returned: %d (expected 0)\n", rc);
+      credis_notify_close(notify);
+    }
+    else
+      printf("notify_open failed, keyspace notifications could not be subscribed\n");
+  }
+
+
+  printf("\n\n************* parallel MGET ******************************** \n");
+
+  {
+    REDIS mgetv[2];
+    static char mkeys[1000][16];
+    const char *mkeyv[1000];
+    int missing = 0, wrong = 0;
+
+    mgetv[0] = redis;
+    if ((mgetv[1] = credis_connect(NULL, 0, 10000)) != NULL) {
+      for (i = 0; i < 1000; i++) {
+        sprintf(mkeys[i], "mget%d", i);
+        mkeyv[i] = mkeys[i];
+        if (i % 10 != 0)
+          credis_set(redis, mkeys[i], mkeys[i]);
+      }
+      rc = credis_mget_parallel(mgetv, 2, 1000, mkeyv, &valv);
+      for (i = 0; rc == 1000 && i < 1000; i++) {
+        if (valv[i] == NULL)
+          missing++;
+        else if (strcmp(valv[i], mkeys[i]) != 0)
+          wrong++;
+      }
+      printf("mget_parallel returned: %d, missing %d, wrong values %d (expected 1000, 100, 0)\n", 
+             rc, missing, wrong);
+      for (i = 0; i < 1000; i++)
+        credis_del(redis, mkeys[i]);
+      credis_close(mgetv[1]);
+    }
+  }
+
+
+  printf("\n\n************* error classification ************************* \n");
+
+  credis_set(redis, "errkey", "string");
+  rc = credis_sadd(redis, "errkey", "member");
+  printf("sadd to string returned: %d, errortype %d, retry %d, reroute %d (expected <0, %d, 0, 0)\n", 
+         rc, credis_errortype(redis), CREDIS_ERRTYPE_RETRY(credis_errortype(redis)), 
+         CREDIS_ERRTYPE_REROUTE(credis_errortype(redis)), CREDIS_ERRTYPE_WRONGTYPE);
+  rc = credis_get(redis, "errkey", &val);
+  printf("get returned: %d, errortype %d (expected 0, %d)\n", 
+         rc, credis_errortype(redis), CREDIS_ERRTYPE_NONE);
+  credis_del(redis, "errkey");
+
+
+  printf("\n\n************* durable writes ******************************* \n");
+
+  {
+    REDIS_DURABLE group;
+    const char *set1[] = {"SET", "durable1", "one"};
+    const char *sadd1[] = {"SADD", "durable1", "member"};
+    const char *set2[] = {"SET", "durable2", "two"};
+    int statusv[3];
+
+    if ((group = credis_durable_open(redis)) != NULL) {
+      credis_durable_write(group, 3, set1);
+      credis_durable_write(group, 3, sadd1);
+      rc = credis_durable_write(group, 3, set2);
+      printf("durable_write returned: %d (expected 2)\n", rc);
+      rc = credis_durable_commit(group, 0, 100, statusv);
+      printf("durable_commit returned: %d, statuses %d %d %d (expected >=0, 0 %d 0)\n", 
+             rc, statusv[0], statusv[1], statusv[2], CREDIS_ERR);
+      rc = credis_get(redis, "durable2", &val);
+      printf("get durable2 returned: %d, %s (expected 0, two)\n", rc, rc == 0 ? val : "(none)");
+      credis_durable_close(group);
+    }
+    credis_del(redis, "durable1");
+    credis_del(redis, "durable2");
+  }
+
   credis_close(redis);
 
   return 0;
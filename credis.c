@@ -28,6 +28,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #ifdef WIN32
 #define _CRT_SECURE_NO_WARNINGS
 #define _CRT_SECURE_NO_DEPRECATE
@@ -35,25 +39,45 @@
 #include <winsock2.h>
 #else 
 #include <arpa/inet.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #endif
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
+#ifdef WITH_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
 #include "credis.h"
 
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define CR_PROBE(name, ...) DTRACE_PROBE3(credis, name, __VA_ARGS__)
+#else
+#define CR_PROBE(name, ...)
+#endif
+
 #ifdef WIN32
 void close(int fd) {
   closesocket(fd);
@@ -65,10 +89,21 @@ void close(int fd) {
 #define CR_BULK '$'
 #define CR_MULTIBULK '*'
 #define CR_INT ':'
+#define CR_ANY '\0'
 
 #define CR_BUFFER_SIZE 4096
 #define CR_BUFFER_WATERMARK ((CR_BUFFER_SIZE)/10+1)
 #define CR_MULTIBULK_SIZE 256
+#define CR_SYNC_EOFMARK_SIZE 40
+#define CR_CHUNK_SIZE 65536
+
+/* version of server connected to, comparable with CREDIS_VERSION_ENCODE() */
+#define CR_SERVER_VERSION(rhnd) \
+  CREDIS_VERSION_ENCODE((rhnd)->version.major, (rhnd)->version.minor, (rhnd)->version.patch)
+
+/* capabilities assumed if version of server is unknown */
+#define CR_CAPS_UNKNOWN \
+  (CREDIS_CAP_MULTIBULK | CREDIS_CAP_KEYSMULTIBULK | CREDIS_CAP_VARIADIC)
 
 #define _STRINGIF(arg) #arg
 #define STRINGIFY(arg) _STRINGIF(arg)
@@ -94,6 +129,22 @@ void close(int fd) {
 #define __attribute__(x)
 #endif
 
+/* atomic operations are GNU C specific too, without them hot key tracking 
+ * is not thread-safe */
+#if __GNUC__
+#define CR_ATOMIC_INC(ptr) __sync_add_and_fetch(ptr, 1)
+#define CR_TRYLOCK(ptr) (__sync_lock_test_and_set(ptr, 1) == 0)
+#define CR_CAS(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
+#define CR_UNLOCK(ptr) __sync_lock_release(ptr)
+#define CR_BARRIER() __sync_synchronize()
+#else
+#define CR_ATOMIC_INC(ptr) (++(*(ptr)))
+#define CR_TRYLOCK(ptr) ((*(ptr))++ == 0)
+#define CR_CAS(ptr, old, new) (*(ptr) == (old) ? (*(ptr) = (new), 1) : 0)
+#define CR_UNLOCK(ptr) (*(ptr) = 0)
+#define CR_BARRIER()
+#endif
+
 typedef struct _cr_buffer {
   char *data;
   int idx;
@@ -104,17 +155,82 @@ typedef struct _cr_buffer {
 typedef struct _cr_multibulk { 
   char **bulks; 
   int *idxs;
+  int *lens;
+  char *types;
   int size;
   int len; 
 } cr_multibulk;
 
 typedef struct _cr_reply {
+  char type;
+  int errortype;    /* of error reply, refer to CREDIS_ERRTYPE_* defines */
   int integer;
   char *line;
   char *bulk;
   cr_multibulk multibulk;
 } cr_reply;
 
+typedef struct _cr_filter {
+  unsigned char *bits;
+  unsigned long long m;    /* size in bits */
+  int k;                   /* number of hash functions */
+  int valid;               /* cleared if keyspace is not reflected */
+  REDIS_FILTER_STATS stats;
+} cr_filter;
+
+/* memory-mapped cache file starts with a header, followed by an index of
+ * slots and a log of records that slots point to */
+typedef struct _cr_l2header {
+  char magic[8];
+  unsigned long long size;              /* of file */
+  unsigned long long buckets;           /* number of slots, a power of 2 */
+  unsigned long long data;              /* offset of log */
+  volatile unsigned long long tail;     /* offset of next record */
+  volatile unsigned long long entries;  /* slots in use */
+  volatile long long resets;
+  volatile unsigned long long seq;      /* odd while written */
+  volatile int lock;                    /* pid of writer holding it, or 0 */
+  volatile int stale;                   /* set if a write was not reflected */
+  char server[64];                      /* host:port of server cached */
+} cr_l2header;
+
+typedef struct _cr_l2slot {
+  unsigned long long hash;
+  unsigned long long off;               /* of record, 0 if empty */
+} cr_l2slot;
+
+/* followed by key and value */
+typedef struct _cr_l2record {
+  unsigned int keylen;
+  unsigned int vallen;
+  long long expires;                    /* milliseconds since the epoch */
+} cr_l2record;
+
+#define CR_L2_WRITTEN_BITS 65536
+
+typedef struct _cr_l2 {
+  char *map;
+  unsigned long long size;
+  int fd;
+  int readonly;
+  int active;                           /* cleared if other database selected */
+  int failed;                           /* set if a write could not be 
+                                         * reflected, until attached again */
+  long long ttl;
+  cr_buffer value;                      /* of last hit */
+  REDIS_L2_STATS stats;
+  /* bitmap of hashes of keys written by a read-only handle */
+  unsigned char written[CR_L2_WRITTEN_BITS / 8];
+} cr_l2;
+
+#ifdef WITH_OPENSSL
+typedef struct _cr_tls {
+  SSL_CTX *ctx;        /* shared by connections made like this one */
+  SSL *ssl;
+  char *name;          /* of server, for SNI, verification and sessions */
+} cr_tls;
+#endif
+
 typedef struct _cr_redis {
   struct {
     int major;
@@ -125,7 +241,24 @@ typedef struct _cr_redis {
   char *ip;
   int port;
   int timeout;
+  int busypoll;     /* microseconds to spin receiving before waiting */
+  REDIS_SOCKET_OPTIONS sockopts;
+  int caps;
+  int db;           /* selected database */
+#ifdef WITH_OPENSSL
+  cr_tls *tls;      /* NULL for plaintext */
+#endif
   cr_buffer buf;
+  cr_buffer values; /* values of last batch command or set operation */
+  char **members;   /* result of last set operation or parallel MGET */
+  int memberssize;
+  struct {
+    double bytes;   /* average reply bytes per key */
+    double rtt;     /* average microseconds until first reply */
+    double rate;    /* average reply bytes per microsecond */
+  } mget;
+  cr_filter *filter;
+  cr_l2 *l2;
   cr_reply reply;
   int error;
 } cr_redis;
@@ -142,6 +275,19 @@ static char * cr_findnl(char *buf, int len) {
   return NULL;
 }
 
+/* 64 bit FNV-1a hash of `len' bytes of `str' */
+static unsigned long long cr_hash(const char *str, int len)
+{
+  unsigned long long h = 14695981039346656037ULL;
+
+  while (len-- > 0) {
+    h ^= (unsigned char) *str++;
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
 /* Allocate at least `size' bytes more buffer memory, keeping content of
  * previously allocated memory untouched.
  * Returns:
@@ -152,7 +298,10 @@ static int cr_moremem(cr_buffer *buf, int size)
   char *ptr;
   int total, n;
 
+  /* at least doubled so that a large reply is not copied over and over */
   n = size / CR_BUFFER_SIZE + 1;
+  if (n < buf->size / CR_BUFFER_SIZE)
+    n = buf->size / CR_BUFFER_SIZE;
   total = buf->size + n * CR_BUFFER_SIZE;
 
   DEBUG("allocate %d x CR_BUFFER_SIZE, total %d bytes", n, total);
@@ -174,22 +323,34 @@ static int cr_moremem(cr_buffer *buf, int size)
 static int cr_morebulk(cr_multibulk *mb, int size) 
 {
   char **cptr;
-  int *iptr;
+  int *iptr, *lptr;
+  char *tptr;
   int total, n;
 
+  /* at least doubled, like buffer memory */
   n = (size / CR_MULTIBULK_SIZE + 1) * CR_MULTIBULK_SIZE;
+  if (n < mb->size)
+    n = mb->size;
   total = mb->size + n;
 
   DEBUG("allocate %d x CR_MULTIBULK_SIZE, total %d (%lu bytes)", 
-        n, total, total * ((sizeof(char *)+sizeof(int))));
+        n, total, total * ((sizeof(char *)+2*sizeof(int)+1)));
   cptr = realloc(mb->bulks, total * sizeof(char *));
+  if (cptr != NULL)
+    mb->bulks = cptr;
   iptr = realloc(mb->idxs, total * sizeof(int));
-
-  if (cptr == NULL || iptr == NULL)
+  if (iptr != NULL)
+    mb->idxs = iptr;
+  lptr = realloc(mb->lens, total * sizeof(int));
+  if (lptr != NULL)
+    mb->lens = lptr;
+  tptr = realloc(mb->types, total);
+  if (tptr != NULL)
+    mb->types = tptr;
+
+  if (cptr == NULL || iptr == NULL || lptr == NULL || tptr == NULL)
     return CREDIS_ERR_NOMEM;
 
-  mb->bulks = cptr;
-  mb->idxs = iptr;
   mb->size = total;
   return 0;
 }
@@ -216,6 +377,10 @@ static int cr_splitstrtromultibulk(REDIS rhnd, char *str, const char token)
     }
   }
   rhnd->reply.multibulk.len = i;  
+  while (--i >= 0) {
+    rhnd->reply.multibulk.lens[i] = strlen(rhnd->reply.multibulk.bulks[i]);
+    rhnd->reply.multibulk.types[i] = CR_BULK;
+  }
   return 0;
 }
 
@@ -308,6 +473,48 @@ static int cr_appendstrarray(cr_buffer *buf, int strc, const char **strv, int ne
   return 0;
 }
 
+/* Appends a command to the end of buffer `buf' encoded with the unified
+ * request protocol, i.e. as a multi-bulk of `argc' arguments. `argl' is 
+ * optional, if not NULL it holds the length of each argument in `argv', 
+ * which makes it possible to send binary data.
+ * Returns:
+ *   0  on success
+ *  <0  on error, i.e. more memory not available */
+static int cr_appendcmdv(cr_buffer *buf, int argc, const char **argv, const int *argl)
+{
+  int rc, i, len;
+
+  if ((rc = cr_appendstrf(buf, "*%d\r\n", argc)) != 0)
+    return rc;
+
+  for (i = 0; i < argc; i++) {
+    len = argl ? argl[i] : (int) strlen(argv[i]);
+    if ((rc = cr_appendstrf(buf, "$%d\r\n", len)) != 0)
+      return rc;
+    if (buf->size - buf->len < len + 3)
+      if (cr_moremem(buf, len + 3))
+        return CREDIS_ERR_NOMEM;
+    memcpy(buf->data + buf->len, argv[i], len);
+    buf->len += len;
+    buf->data[buf->len++] = '\r';
+    buf->data[buf->len++] = '\n';
+  }
+
+  return 0;
+}
+
+/* Discards data of buffer `buf' that has already been consumed, i.e. 
+ * everything before `idx', by moving what remains to the beginning of 
+ * the buffer. Pointers into the buffer are invalid after this call. */
+static void cr_compactbuffer(cr_buffer *buf)
+{
+  if (buf->idx > 0) {
+    buf->len -= buf->idx;
+    memmove(buf->data, buf->data + buf->idx, buf->len);
+    buf->idx = 0;
+  }
+}
+
 /* Helper function for select that waits for `timeout' milliseconds 
  * for `fd' to become readable (`readable' == 1) or writable.
  * Returns:
@@ -333,41 +540,166 @@ int cr_select(int fd, int timeout, int readable)
 #define cr_selectreadable(fd, timeout) cr_select(fd, timeout, 1)
 #define cr_selectwritable(fd, timeout) cr_select(fd, timeout, 0)
 
-/* Receives at most `size' bytes from socket `fd' to `buf'. Times out after 
- * `msecs' milliseconds if no data has yet arrived.
+/* Returns microseconds since `start' */
+static long long cr_usecs(const struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_usec - start->tv_usec);
+}
+
+#ifdef WITH_OPENSSL
+/* Waits at most `msecs' milliseconds for socket of TLS connection to become
+ * ready for what `ssl' failed with `rc' on.
+ * Returns:
+ *  >0  ready
+ *   0  timeout
+ *  -1  on error, or if connection failed */
+static int cr_tlswait(REDIS rhnd, int rc, unsigned int msecs)
+{
+  switch (SSL_get_error(rhnd->tls->ssl, rc)) {
+  case SSL_ERROR_WANT_READ:
+    return cr_selectreadable(rhnd->fd, msecs);
+  case SSL_ERROR_WANT_WRITE:
+    return cr_selectwritable(rhnd->fd, msecs);
+  default:
+    return -1;
+  }
+}
+
+/* Same as cr_receivedata() for a TLS connection. Data already decrypted is
+ * returned without waiting. */
+static int cr_tlsreceive(REDIS rhnd, char *buf, int size)
+{
+  int rc;
+
+  if (SSL_pending(rhnd->tls->ssl) == 0 && (rc = cr_selectreadable(rhnd->fd, rhnd->timeout)) <= 0)
+    return rc == 0 ? -2 : -1;
+
+  while ((rc = SSL_read(rhnd->tls->ssl, buf, size)) <= 0) {
+    if (SSL_get_error(rhnd->tls->ssl, rc) == SSL_ERROR_ZERO_RETURN)
+      return 0;
+    if ((rc = cr_tlswait(rhnd, rc, rhnd->timeout)) <= 0)
+      return rc == 0 ? -2 : -1;
+  }
+
+  return rc;
+}
+
+/* Same as cr_senddata() for a TLS connection */
+static int cr_tlssend(REDIS rhnd, char *buf, int size)
+{
+  int rc, sent = 0;
+
+  while (sent < size) {
+    if ((rc = SSL_write(rhnd->tls->ssl, buf + sent, size - sent)) > 0)
+      sent += rc;
+    else if ((rc = cr_tlswait(rhnd, rc, rhnd->timeout)) == 0)
+      break;
+    else if (rc < 0)
+      return -1;
+  }
+
+  return sent;
+}
+#endif
+
+/* Sets integer socket option `name' to `value' unless it is 0, or to 0 if
+ * it is CREDIS_SOCKOPT_OFF, returns 1 if it failed */
+static int cr_setsockopt(int fd, int level, int name, int value)
+{
+  if (value == 0)
+    return 0;
+  if (value == CREDIS_SOCKOPT_OFF)
+    value = 0;
+
+  return setsockopt(fd, level, name, (void *)&value, sizeof(value)) != 0;
+}
+
+/* Same as recv(), re-arms quick acknowledgements if asked for since kernel
+ * turns them off again after a while */
+static int cr_recv(REDIS rhnd, char *buf, int size)
+{
+  int rc = recv(rhnd->fd, buf, size, 0);
+
+#ifdef TCP_QUICKACK
+  if (rc > 0 && rhnd->sockopts.quickack > 0)
+    cr_setsockopt(rhnd->fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+
+  return rc;
+}
+
+/* Receives at most `size' bytes from connection of `rhnd' to `buf'. Times 
+ * out if no data has arrived within timeout of handle.
  * Returns:
  *  >0  number of read bytes on success
  *   0  server closed connection
  *  -1  on error
  *  -2  on timeout */
-static int cr_receivedata(int fd, unsigned int msecs, char *buf, int size)
+static int cr_receivedata(REDIS rhnd, char *buf, int size)
 {
-  int rc = cr_selectreadable(fd, msecs);
+  struct timeval start;
+  int rc;
+
+#ifdef WITH_OPENSSL
+  if (rhnd->tls != NULL)
+    return cr_tlsreceive(rhnd, buf, size);
+#endif
 
+  /* socket is non-blocking, spin on it for a while before sleeping in 
+   * select() to save the wakeup when reply arrives soon */
+  if (rhnd->busypoll > 0) {
+    gettimeofday(&start, NULL);
+    do {
+      if ((rc = cr_recv(rhnd, buf, size)) >= 0)
+        return rc;
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return -1;
+    } while (cr_usecs(&start) < rhnd->busypoll);
+  }
+
+  rc = cr_selectreadable(rhnd->fd, rhnd->timeout);
   if (rc > 0)
-    return recv(fd, buf, size, 0);
+    return cr_recv(rhnd, buf, size);
   else if (rc == 0)
     return -2;
   else
     return -1;  
 }
 
-/* Sends `size' bytes from `buf' to socket `fd' and times out after `msecs' 
- * milliseconds if not all data has been sent. 
+/* Sends `size' bytes from `buf' to connection of `rhnd' and times out if 
+ * not all data has been sent within timeout of handle. If `more' is set 
+ * more data is sent directly after, which data is then held back for 
+ * (MSG_MORE) if handle is to cork, so that segments are sent full.
  * Returns:
  *  >0  number of bytes sent; if less than `size' it means that timeout occurred
  *  -1  on error */
-static int cr_senddata(int fd, unsigned int msecs, char *buf, int size)
+static int cr_sendpart(REDIS rhnd, char *buf, int size, int more)
 {
   fd_set fds;
   struct timeval tv;
-  int rc, sent=0;
+  int rc, sent=0, fd = rhnd->fd, flags = 0;
+  unsigned int msecs = rhnd->timeout;
+
+#ifdef WITH_OPENSSL
+  if (rhnd->tls != NULL)
+    return cr_tlssend(rhnd, buf, size);
+#endif
   
   /* NOTE: On Linux, select() modifies timeout to reflect the amount 
    * of time not slept, on other systems it is likely not the same */
   tv.tv_sec = msecs/1000;
   tv.tv_usec = (msecs%1000)*1000;
 
+#ifdef MSG_MORE
+  if (more && rhnd->sockopts.cork > 0)
+    flags = MSG_MORE;
+#else
+  (void) more;
+#endif
+
   while (sent < size) {
     FD_ZERO(&fds);
     FD_SET(fd, &fds);
@@ -375,7 +707,7 @@ static int cr_senddata(int fd, unsigned int msecs, char *buf, int size)
     rc = select(fd+1, NULL, &fds, NULL, &tv);
 
     if (rc > 0) {
-      rc = send(fd, buf+sent, size-sent, 0);
+      rc = send(fd, buf+sent, size-sent, flags);
       if (rc < 0)
         return -1;
       sent += rc;
@@ -389,6 +721,174 @@ static int cr_senddata(int fd, unsigned int msecs, char *buf, int size)
   return sent;
 }
 
+#define cr_senddata(rhnd, buf, size) cr_sendpart(rhnd, buf, size, 0)
+
+/* Waits at most `timeout' milliseconds for data to receive from connection
+ * of `rhnd', returns >0 if there is, 0 on timeout or -1 on error */
+static int cr_readable(REDIS rhnd, int timeout)
+{
+#ifdef WITH_OPENSSL
+  if (rhnd->tls != NULL && SSL_pending(rhnd->tls->ssl) > 0)
+    return 1;
+#endif
+
+  return cr_selectreadable(rhnd->fd, timeout);
+}
+
+#ifdef WITH_OPENSSL
+/*
+ * TLS
+ */
+
+#define CR_TLS_SESSIONS 64
+#define CR_TLS_NAME_SIZE 128
+
+/* sessions of servers for resumption, by name and port, shared by all 
+ * handles since a reconnect is made with a new handle */
+static struct {
+  char name[CR_TLS_NAME_SIZE];
+  SSL_SESSION *session;
+} cr_tlssessions[CR_TLS_SESSIONS];
+static int cr_tlslock;
+
+/* Returns slot of session cache for server of `rhnd' and its name there */
+static int cr_tlsslot(REDIS rhnd, char *name)
+{
+  snprintf(name, CR_TLS_NAME_SIZE, "%s:%d", rhnd->tls->name, rhnd->port);
+  return (int) (cr_hash(name, strlen(name)) % CR_TLS_SESSIONS);
+}
+
+/* Called by OpenSSL with a session to resume, which for TLS 1.3 arrives 
+ * after handshake. Returns 1 since cache keeps reference of session. */
+static int cr_tlsnewsession(SSL *ssl, SSL_SESSION *session)
+{
+  char name[CR_TLS_NAME_SIZE];
+  int i = cr_tlsslot(SSL_get_app_data(ssl), name);
+
+  while (!CR_TRYLOCK(&cr_tlslock))
+    ;
+  if (cr_tlssessions[i].session != NULL)
+    SSL_SESSION_free(cr_tlssessions[i].session);
+  strcpy(cr_tlssessions[i].name, name);
+  cr_tlssessions[i].session = session;
+  CR_UNLOCK(&cr_tlslock);
+
+  return 1;
+}
+
+/* Makes connection of `rhnd' a TLS connection of context `ctx' to server 
+ * `name', resuming last session with server if there is one */
+static int cr_tlsstart(REDIS rhnd, SSL_CTX *ctx, const char *name)
+{
+  char session[CR_TLS_NAME_SIZE];
+  struct in_addr addr;
+  cr_tls *tls;
+  int i, rc, ip = inet_aton(name, &addr) != 0;
+
+  if ((tls = calloc(1, sizeof(cr_tls))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  rhnd->tls = tls;
+  SSL_CTX_up_ref(ctx);
+  tls->ctx = ctx;
+  if ((tls->name = strdup(name)) == NULL || (tls->ssl = SSL_new(ctx)) == NULL ||
+      SSL_set_fd(tls->ssl, rhnd->fd) != 1)
+    return CREDIS_ERR;
+  SSL_set_app_data(tls->ssl, rhnd);
+
+  /* server names, not addresses, are sent for SNI */
+  if (!ip)
+    SSL_set_tlsext_host_name(tls->ssl, name);
+  if (SSL_CTX_get_verify_mode(ctx) & SSL_VERIFY_PEER) {
+    if (ip)
+      rc = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(tls->ssl), name);
+    else
+      rc = SSL_set1_host(tls->ssl, name);
+    if (rc != 1)
+      return CREDIS_ERR;
+  }
+
+  i = cr_tlsslot(rhnd, session);
+  while (!CR_TRYLOCK(&cr_tlslock))
+    ;
+  if (cr_tlssessions[i].session != NULL && !strcmp(cr_tlssessions[i].name, session) &&
+      SSL_SESSION_is_resumable(cr_tlssessions[i].session))
+    SSL_set_session(tls->ssl, cr_tlssessions[i].session);
+  CR_UNLOCK(&cr_tlslock);
+
+  while ((rc = SSL_connect(tls->ssl)) != 1) {
+    if (cr_tlswait(rhnd, rc, rhnd->timeout) <= 0) {
+      DEBUG("TLS handshake failed: %s", ERR_error_string(ERR_get_error(), NULL));
+      return CREDIS_ERR;
+    }
+  }
+
+  return 0;
+}
+
+/* Returns context for connections with `options', NULL for defaults */
+static SSL_CTX *cr_tlscontext(const REDIS_TLS_OPTIONS *options)
+{
+  static const REDIS_TLS_OPTIONS defaults;
+  SSL_CTX *ctx;
+
+  if (options == NULL)
+    options = &defaults;
+  if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+    return NULL;
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, cr_tlsnewsession);
+#ifdef SSL_OP_ENABLE_KTLS
+  if (options->ktls)
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+  if (!options->insecure) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    if (options->ca_file != NULL || options->ca_path != NULL) {
+      if (SSL_CTX_load_verify_locations(ctx, options->ca_file, options->ca_path) != 1)
+        goto error;
+    }
+    else if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+      goto error;
+  }
+
+  if (options->cert_file != NULL &&
+      (SSL_CTX_use_certificate_chain_file(ctx, options->cert_file) != 1 ||
+       SSL_CTX_use_PrivateKey_file(ctx, options->key_file ? options->key_file : options->cert_file, 
+                                   SSL_FILETYPE_PEM) != 1))
+    goto error;
+
+  return ctx;
+
+error:
+  DEBUG("TLS context failed: %s", ERR_error_string(ERR_get_error(), NULL));
+  SSL_CTX_free(ctx);
+  return NULL;
+}
+
+/* Tells server that TLS connection is closing */
+static void cr_tlsclose(REDIS rhnd)
+{
+  if (rhnd->tls != NULL && rhnd->tls->ssl != NULL && SSL_is_init_finished(rhnd->tls->ssl))
+    SSL_shutdown(rhnd->tls->ssl);
+}
+
+static void cr_tlsfree(REDIS rhnd)
+{
+  if (rhnd->tls == NULL)
+    return;
+  if (rhnd->tls->ssl != NULL)
+    SSL_free(rhnd->tls->ssl);
+  SSL_CTX_free(rhnd->tls->ctx);
+  free(rhnd->tls->name);
+  free(rhnd->tls);
+  rhnd->tls = NULL;
+}
+#endif
+
 /* Buffered read line, returns pointer to zero-terminated string 
  * and length of that string. `start' specifies from which byte
  * to start looking for "\r\n".
@@ -419,7 +919,7 @@ static int cr_readln(REDIS rhnd, int start, char **line, int *idx)
       avail = buf->size - buf->len;
     }
 
-    rc = cr_receivedata(rhnd->fd, rhnd->timeout, buf->data + buf->len, avail);
+    rc = cr_receivedata(rhnd, buf->data + buf->len, avail);
     if (rc > 0) {
       DEBUG("received %d bytes: %s", rc, buf->data + buf->len);
       buf->len += rc;
@@ -448,9 +948,61 @@ static int cr_readln(REDIS rhnd, int start, char **line, int *idx)
   return len;
 }
 
+/* Receives `bnum' elements of a multi-bulk reply and stores them from 
+ * position `*i' and on. An element that is a multi-bulk itself is stored as
+ * an entry of type CR_MULTIBULK, with its number of elements as length, 
+ * directly followed by its elements. Integers, inline replies and errors 
+ * are stored as their text. */
+static int cr_receivemultibulkitems(REDIS rhnd, int bnum, int *i)
+{
+  cr_multibulk *mb = &(rhnd->reply.multibulk);
+  char *line;
+  int blen, rc, idx;
+
+  for (; bnum > 0; bnum--) {
+    if (*i >= mb->size && cr_morebulk(mb, bnum))
+      return CREDIS_ERR_NOMEM;
+
+    if ((rc = cr_readln(rhnd, 0, &line, &idx)) <= 0)
+      return CREDIS_ERR_PROTOCOL;
+
+    mb->types[*i] = *line;
+    switch (*(line++)) {
+    case CR_BULK:
+      blen = atoi(line);
+      mb->lens[*i] = blen;
+      if (blen == -1)
+        mb->idxs[(*i)++] = -1;
+      else {
+        if ((rc = cr_readln(rhnd, blen, &line, &idx)) != blen)
+          return CREDIS_ERR_PROTOCOL;
+        mb->idxs[(*i)++] = idx;
+      }
+      break;
+    case CR_MULTIBULK:
+      blen = atoi(line);
+      mb->lens[*i] = blen;
+      mb->idxs[(*i)++] = -1;
+      if (blen > 0 && (rc = cr_receivemultibulkitems(rhnd, blen, i)) != 0)
+        return rc;
+      break;
+    case CR_INT:
+    case CR_INLINE:
+    case CR_ERROR:
+      mb->lens[*i] = rc - 1;
+      mb->idxs[(*i)++] = idx + 1;
+      break;
+    default:
+      return CREDIS_ERR_PROTOCOL;
+    }
+  }
+
+  return 0;
+}
+
 static int cr_receivemultibulk(REDIS rhnd, char *line) 
 {
-  int bnum, blen, i, rc=0, idx;
+  int bnum, i=0, rc;
 
   bnum = atoi(line);
 
@@ -464,24 +1016,9 @@ static int cr_receivemultibulk(REDIS rhnd, char *line)
       return CREDIS_ERR_NOMEM;
   }
 
-  for (i = 0; bnum > 0 && (rc = cr_readln(rhnd, 0, &line, NULL)) > 0; i++, bnum--) {
-    if (*(line++) != CR_BULK)
-      return CREDIS_ERR_PROTOCOL;
-    
-    blen = atoi(line);
-    if (blen == -1)
-      rhnd->reply.multibulk.idxs[i] = -1;
-    else {
-      if ((rc = cr_readln(rhnd, blen, &line, &idx)) != blen)
-        return CREDIS_ERR_PROTOCOL;
-
-      rhnd->reply.multibulk.idxs[i] = idx;
-    }
-  }
-  
-  if (bnum != 0) {
-    DEBUG("bnum != 0, bnum=%d, rc=%d", bnum, rc);
-    return CREDIS_ERR_PROTOCOL;
+  if ((rc = cr_receivemultibulkitems(rhnd, bnum, &i)) != 0) {
+    DEBUG("failed to receive %d items, rc=%d", bnum, rc);
+    return rc;
   }
 
   rhnd->reply.multibulk.len = i;
@@ -520,28 +1057,209 @@ static int cr_receiveinline(REDIS rhnd, char *line)
 
 static int cr_receiveint(REDIS rhnd, char *line) 
 {
+  /* text is kept for integers that do not fit in an int */
+  rhnd->reply.line = line;
   rhnd->reply.integer = atoi(line);
   return 0;
 }
 
+/* Returns class of error message `line' by its first word */
+static int cr_errortype(const char *line)
+{
+  static const struct {
+    const char *prefix;
+    int type;
+  } types[] = {
+    {"WRONGTYPE", CREDIS_ERRTYPE_WRONGTYPE},
+    {"OOM", CREDIS_ERRTYPE_OOM},
+    {"NOSCRIPT", CREDIS_ERRTYPE_NOSCRIPT},
+    {"NOAUTH", CREDIS_ERRTYPE_NOAUTH},
+    {"WRONGPASS", CREDIS_ERRTYPE_NOAUTH},
+    {"NOPERM", CREDIS_ERRTYPE_NOPERM},
+    {"EXECABORT", CREDIS_ERRTYPE_EXECABORT},
+    {"NOREPLICAS", CREDIS_ERRTYPE_NOREPLICAS},
+    {"LOADING", CREDIS_ERRTYPE_LOADING},
+    {"BUSY", CREDIS_ERRTYPE_BUSY},
+    {"TRYAGAIN", CREDIS_ERRTYPE_TRYAGAIN},
+    {"MASTERDOWN", CREDIS_ERRTYPE_MASTERDOWN},
+    {"CLUSTERDOWN", CREDIS_ERRTYPE_CLUSTERDOWN},
+    {"READONLY", CREDIS_ERRTYPE_READONLY},
+    {"MOVED", CREDIS_ERRTYPE_MOVED},
+    {"ASK", CREDIS_ERRTYPE_ASK},
+  };
+  size_t i, len = strcspn(line, " ");
+
+  if (len == 3 && !strncmp(line, "ERR", 3))
+    return strncmp(line, "ERR unknown command", 19) ? 
+      CREDIS_ERRTYPE_OTHER : CREDIS_ERRTYPE_UNKNOWNCOMMAND;
+
+  /* whole word is compared, e.g. BUSYKEY is not BUSY */
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    if (!strncmp(line, types[i].prefix, len) && types[i].prefix[len] == '\0')
+      return types[i].type;
+
+  return CREDIS_ERRTYPE_OTHER;
+}
+
 static int cr_receiveerror(REDIS rhnd, char *line) 
 {
   rhnd->reply.line = line;
+  rhnd->reply.errortype = cr_errortype(line);
   return CREDIS_ERR_PROTOCOL;
 }
 
-static int cr_receivereply(REDIS rhnd, char recvtype) 
+/* Parses 8 digits loaded as little-endian word `v' at once, i.e. 
+ * "12345678" to 12345678, or returns -1 if any of them is not a digit */
+static long long cr_parse8digits(unsigned long long v)
 {
-  char *line, prefix=0;
+  v -= 0x3030303030303030ULL;
+  /* each byte has to be 0-9 */
+  if ((v & 0xF0F0F0F0F0F0F0F0ULL) || ((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL))
+    return -1;
+  v = v * 10 + (v >> 8);
+  v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) + 
+       (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return (long long) v;
+}
 
-  /* reset common send/receive buffer */
-  rhnd->buf.len = 0;
-  rhnd->buf.idx = 0;
+/* Parses decimal integer of `len' bytes at `p', 8 digits at a time where 
+ * possible. Up to 8 bytes can be read beyond the number, but not beyond 
+ * `end'.
+ * Returns:
+ *   0  on success, number is stored in `val'
+ *  -1  if not a number of at most 18 digits */
+static int cr_parseint(const char *p, int len, const char *end, long long *val)
+{
+  unsigned long long v;
+  long long n, d;
+  int neg = 0;
+
+  if (len > 0 && *p == '-') {
+    neg = 1;
+    p++;
+    len--;
+  }
+  if (len <= 0 || len > 18)
+    return -1;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  n = 0;
+  while (len >= 8) {
+    memcpy(&v, p, 8);
+    if ((d = cr_parse8digits(v)) < 0)
+      return -1;
+    n = n * 100000000 + d;
+    p += 8;
+    len -= 8;
+  }
+  /* the last short run of digits is shifted to the end of a word that is 
+   * padded with leading zeros */
+  if (len > 0) {
+    if (p + 8 <= end) {
+      memcpy(&v, p, 8);
+      v = (v << (8 * (8 - len))) | (0x3030303030303030ULL >> (8 * len));
+      if ((d = cr_parse8digits(v)) < 0)
+        return -1;
+      for (; len > 0; len--)
+        n *= 10;
+      n += d;
+    }
+    else {
+      for (; len > 0; len--, p++) {
+        if (*p < '0' || *p > '9')
+          return -1;
+        n = n * 10 + (*p - '0');
+      }
+    }
+  }
+#else
+  (void) end;
+  (void) v;
+  (void) d;
+  for (n = 0; len > 0; len--, p++) {
+    if (*p < '0' || *p > '9')
+      return -1;
+    n = n * 10 + (*p - '0');
+  }
+#endif
+
+  *val = neg ? -n : n;
+  return 0;
+}
+
+/* Receives a multi-bulk reply of numbers, which are parsed straight from 
+ * the receive buffer to `longv', or `doublev' if `longv' is NULL, without 
+ * being stored in multi-bulk storage. At most `size' numbers are stored.
+ * Returns:
+ *  >=0  number of elements of reply
+ *  <0   on error, CREDIS_ERR if an element is not a number */
+static int cr_receivenumbers(REDIS rhnd, long long *longv, double *doublev, int size)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  char *line, *end;
+  long long n;
+  int bnum, blen, i, rc = 0;
+
+  buf->len = 0;
+  buf->idx = 0;
+  rhnd->reply.type = CR_ANY;
+
+  if (cr_readln(rhnd, 0, &line, NULL) <= 0)
+    return CREDIS_ERR_RECV;
+  rhnd->reply.type = *line;
+  if (*line == CR_ERROR)
+    return cr_receiveerror(rhnd, line + 1);
+  if (*line != CR_MULTIBULK)
+    return CREDIS_ERR_PROTOCOL;
+
+  if ((bnum = atoi(line + 1)) < 0)
+    return 0;
+
+  for (i = 0; i < bnum; i++) {
+    /* keep buffer from growing with the size of the reply */
+    if (buf->idx > buf->size / 2)
+      cr_compactbuffer(buf);
+
+    if (cr_readln(rhnd, 0, &line, NULL) <= 0 || *line != CR_BULK ||
+        (blen = atoi(line + 1)) < 0 ||
+        cr_readln(rhnd, blen, &line, NULL) != blen)
+      return CREDIS_ERR_PROTOCOL;
 
+    /* the whole reply is read also when an element is not a number */
+    if (i >= size || rc != 0)
+      continue;
+    end = buf->data + buf->size;
+    if (longv != NULL) {
+      if (cr_parseint(line, blen, end, &longv[i]) != 0)
+        rc = CREDIS_ERR;
+    }
+    else if (cr_parseint(line, blen, end, &n) == 0)
+      doublev[i] = (double) n;
+    else {
+      doublev[i] = strtod(line, &end);
+      if (end != line + blen)
+        rc = CREDIS_ERR;
+    }
+  }
+
+  return rc != 0 ? rc : bnum;
+}
+
+/* Reads and parses the next reply from the common send/receive buffer, 
+ * starting at the current buffer index. Data that has already been 
+ * received but not yet parsed, e.g. when consuming a stream of replies, is 
+ * thus kept. */
+static int cr_readreply(REDIS rhnd, char recvtype) 
+{
+  char *line, prefix=0;
+
+  rhnd->reply.type = CR_ANY;
+  rhnd->reply.errortype = CREDIS_ERRTYPE_NONE;
   if (cr_readln(rhnd, 0, &line, NULL) > 0) {
     prefix = *(line++);
+    rhnd->reply.type = prefix;
  
-    if (prefix != recvtype && prefix != CR_ERROR)
+    if (prefix != recvtype && prefix != CR_ERROR && recvtype != CR_ANY)
       return CREDIS_ERR_PROTOCOL;
 
     switch(prefix) {
@@ -561,14 +1279,44 @@ static int cr_receivereply(REDIS rhnd, char recvtype)
   return CREDIS_ERR_RECV;
 }
 
+static int cr_receivereply(REDIS rhnd, char recvtype) 
+{
+  /* reset common send/receive buffer */
+  rhnd->buf.len = 0;
+  rhnd->buf.idx = 0;
+
+  return cr_readreply(rhnd, recvtype);
+}
+
 static void cr_delete(REDIS rhnd) 
 {
   if (rhnd->reply.multibulk.bulks != NULL)
     free(rhnd->reply.multibulk.bulks);
   if (rhnd->reply.multibulk.idxs != NULL)
     free(rhnd->reply.multibulk.idxs);
+  if (rhnd->reply.multibulk.lens != NULL)
+    free(rhnd->reply.multibulk.lens);
+  if (rhnd->reply.multibulk.types != NULL)
+    free(rhnd->reply.multibulk.types);
   if (rhnd->buf.data != NULL)
     free(rhnd->buf.data);
+  if (rhnd->values.data != NULL)
+    free(rhnd->values.data);
+  if (rhnd->members != NULL)
+    free(rhnd->members);
+#ifdef WITH_OPENSSL
+  cr_tlsfree(rhnd);
+#endif
+  if (rhnd->filter != NULL) {
+    free(rhnd->filter->bits);
+    free(rhnd->filter);
+  }
+  if (rhnd->l2 != NULL) {
+    munmap(rhnd->l2->map, rhnd->l2->size);
+    close(rhnd->l2->fd);
+    free(rhnd->l2->value.data);
+    free(rhnd->l2);
+  }
   if (rhnd->ip != NULL)
     free(rhnd->ip);
   if (rhnd != NULL)
@@ -583,7 +1331,9 @@ REDIS cr_new(void)
       (rhnd->ip = malloc(32)) == NULL ||
       (rhnd->buf.data = malloc(CR_BUFFER_SIZE)) == NULL ||
       (rhnd->reply.multibulk.bulks = malloc(sizeof(char *)*CR_MULTIBULK_SIZE)) == NULL ||
-      (rhnd->reply.multibulk.idxs = malloc(sizeof(int)*CR_MULTIBULK_SIZE)) == NULL) {
+      (rhnd->reply.multibulk.idxs = malloc(sizeof(int)*CR_MULTIBULK_SIZE)) == NULL ||
+      (rhnd->reply.multibulk.lens = malloc(sizeof(int)*CR_MULTIBULK_SIZE)) == NULL ||
+      (rhnd->reply.multibulk.types = malloc(CR_MULTIBULK_SIZE)) == NULL) {
     cr_delete(rhnd);
     return NULL;   
   }
@@ -594,15 +1344,286 @@ REDIS cr_new(void)
   return rhnd;
 }
 
-/* Send message that has been prepared in message buffer prior to the call
- * to this function. Wait and receive reply. */
-static int cr_sendandreceive(REDIS rhnd, char recvtype)
+/*
+ * Hot key tracking
+ */
+
+#define CR_HOTKEY_DEPTH 4
+#define CR_HOTKEY_WIDTH 1024
+#define CR_HOTKEY_WINDOW 65536 /* samples after which counts are halved */
+
+typedef struct _cr_hotkey {
+  REDIS_HOTKEY key;
+  unsigned long long hash;
+  unsigned int est;
+} cr_hotkey;
+
+/* Count-min sketch of sampled keys, updated without locking, and the `k'
+ * keys estimated to be most frequent, updated by whoever gets the lock */
+typedef struct _cr_hotkeys {
+  volatile int enabled;
+  volatile int lock;
+  int sample;
+  int k;
+  REDIS_HOTKEY_CALLBACK cb;
+  void *arg;
+  volatile unsigned int tick;
+  volatile unsigned int total;
+  volatile unsigned int counts[CR_HOTKEY_DEPTH][CR_HOTKEY_WIDTH];
+  cr_hotkey top[CREDIS_HOTKEYS_MAX];
+  int len;
+} cr_hotkeys;
+
+static cr_hotkeys cr_hot;
+
+/* commands whose first argument is not a key */
+static const char *cr_keylesscommands[] = {
+  "AUTH", "BGREWRITEAOF", "BGSAVE", "CLIENT", "CLUSTER", "COMMAND", "CONFIG", 
+  "DBSIZE", "DISCARD", "ECHO", "EVAL", "EVALSHA", "EXEC", "FCALL", "FLUSHALL", 
+  "FLUSHDB", "FUNCTION", "INFO", "KEYS", "LASTSAVE", "MEMORY", "MONITOR", "MULTI", 
+  "OBJECT", "PING", "PSUBSCRIBE", "PSYNC", "PUBLISH", "PUNSUBSCRIBE", "RANDOMKEY", 
+  "REPLCONF", "REPLICAOF", "SAVE", "SCAN", "SCRIPT", "SELECT", "SHUTDOWN", "SLAVEOF", 
+  "SUBSCRIBE", "SYNC", "UNSUBSCRIBE", "WAIT", "XGROUP", "XREAD", "XREADGROUP", NULL};
+
+/* Parses the number that starts at `p' of a line that ends at `nl'. 
+ * Returns the number or -1 if there is none */
+static int cr_linenumber(const char *p, const char *nl)
 {
-  int rc;
+  int n = 0;
 
-  DEBUG("Sending message: len=%d, data=%s", rhnd->buf.len, rhnd->buf.data);
+  if (p >= nl || *p < '0' || *p > '9')
+    return -1;
+  while (p < nl && *p >= '0' && *p <= '9' && n < INT_MAX / 10)
+    n = n * 10 + *p++ - '0';
 
-  rc = cr_senddata(rhnd->fd, rhnd->timeout, rhnd->buf.data, rhnd->buf.len);
+  return n;
+}
+
+/* Finds the key of the first command of `len' bytes in `buf', encoded 
+ * either with the unified request protocol or inline, and sets `next' to
+ * where the following command starts. 
+ * Returns:
+ *  >=0  length of key, pointed to by `key'
+ *   -1  if command has no key
+ *   -2  if command is incomplete or malformed */
+static int cr_commandkey(const char *buf, int len, const char **key, const char **next)
+{
+  const char *p = buf, *q, *end = buf + len, *argv[2];
+  int argl[2] = {0, 0}, argc, i, l;
+
+  if (p < end && *p == '*') {
+    if ((q = memchr(p, '\n', end - p)) == NULL)
+      return -2;
+    argc = cr_linenumber(p + 1, q);
+    for (i = 0, p = q; i < argc; i++) {
+      if (++p >= end || *p != '$' || (q = memchr(p, '\n', end - p)) == NULL)
+        return -2;
+      l = cr_linenumber(p + 1, q);
+      p = q;
+      if (l < 0 || end - p <= l + 2)
+        return -2;
+      if (i < 2) {
+        argv[i] = p + 1;
+        argl[i] = l;
+      }
+      p += l + 2;
+    }
+    *next = p + 1;
+    if (argc < 2)
+      return -1;
+  }
+  else {
+    if ((*next = memchr(p, '\n', end - p)) == NULL)
+      return -2;
+    end = (*next)++;
+    for (i = 0; i < 2; i++) {
+      while (p < end && *p == ' ')
+        p++;
+      argv[i] = p;
+      while (p < end && *p != ' ' && *p != '\r')
+        p++;
+      if ((argl[i] = p - argv[i]) == 0)
+        return -1;
+    }
+  }
+
+  for (i = 0; cr_keylesscommands[i] != NULL; i++)
+    if ((int) strlen(cr_keylesscommands[i]) == argl[0] && 
+        !strncasecmp(cr_keylesscommands[i], argv[0], argl[0]))
+      return -1;
+
+  *key = argv[1];
+  return argl[1];
+}
+
+/* Adds `n' to the count of key of hash `h', 0 to only look it up.
+ * Returns estimated count */
+static unsigned int cr_hotkeysadd(unsigned long long h, int n)
+{
+  unsigned int h1 = (unsigned int) h, h2 = (unsigned int) (h >> 32) | 1;
+  unsigned int c, est = UINT_MAX;
+  volatile unsigned int *cp;
+  int i;
+
+  for (i = 0; i < CR_HOTKEY_DEPTH; i++) {
+    cp = &(cr_hot.counts[i][(h1 + i * h2) & (CR_HOTKEY_WIDTH - 1)]);
+    c = n ? CR_ATOMIC_INC(cp) : *cp;
+    if (c < est)
+      est = c;
+  }
+
+  return est;
+}
+
+/* Counts sampled `key' of `keylen' bytes and updates hot keys */
+static void cr_hotkeyssample(const char *key, int keylen)
+{
+  REDIS_HOTKEY hot;
+  unsigned long long h;
+  unsigned int est, total;
+  int i, j, added = 0;
+
+  h = cr_hash(key, keylen);
+  est = cr_hotkeysadd(h, 1);
+  total = CR_ATOMIC_INC(&cr_hot.total);
+  CR_PROBE(sample, key, keylen, est);
+
+  /* skip updating hot keys if someone else is doing it */
+  if (!CR_TRYLOCK(&cr_hot.lock))
+    return;
+
+  /* age counts so that keys that are no longer hot are forgotten */
+  if (total >= CR_HOTKEY_WINDOW) {
+    for (i = 0; i < CR_HOTKEY_DEPTH; i++)
+      for (j = 0; j < CR_HOTKEY_WIDTH; j++)
+        cr_hot.counts[i][j] /= 2;
+    cr_hot.total /= 2;
+    for (i = 0; i < cr_hot.len; i++)
+      cr_hot.top[i].est /= 2;
+    est /= 2;
+  }
+
+  for (i = 0, j = 0; i < cr_hot.len; i++) {
+    if (cr_hot.top[i].hash == h) 
+      break;
+    if (cr_hot.top[i].est < cr_hot.top[j].est)
+      j = i;
+  }
+
+  if (i < cr_hot.len)
+    cr_hot.top[i].est = est;
+  else if (cr_hot.len < cr_hot.k || est > cr_hot.top[j].est) {
+    i = cr_hot.len < cr_hot.k ? cr_hot.len++ : j;
+    cr_hot.top[i].hash = h;
+    cr_hot.top[i].est = est;
+    cr_hot.top[i].key.keylen = keylen;
+    if (keylen >= CREDIS_HOTKEY_SIZE)
+      keylen = CREDIS_HOTKEY_SIZE - 1;
+    memcpy(cr_hot.top[i].key.key, key, keylen);
+    cr_hot.top[i].key.key[keylen] = '\0';
+    hot = cr_hot.top[i].key;
+    hot.count = (long long) est * (cr_hot.sample > 1 ? cr_hot.sample : 1);
+    added = 1;
+  }
+
+  CR_UNLOCK(&cr_hot.lock);
+
+  if (added) {
+    CR_PROBE(hotkey, hot.key, keylen, hot.count);
+    if (cr_hot.cb != NULL)
+      cr_hot.cb(&hot, cr_hot.arg);
+  }
+}
+
+/* Samples commands of `len' bytes in `buf' and updates hot keys. Has to be 
+ * fast since it is called for every command sent when enabled. */
+static void cr_hotkeystrack(const char *buf, int len)
+{
+  const char *key, *end = buf + len;
+  int keylen;
+
+  if (!cr_hot.enabled)
+    return;
+
+  while (buf < end) {
+    if ((keylen = cr_commandkey(buf, end - buf, &key, &buf)) == -2)
+      return;
+    if (keylen >= 0 && 
+        (cr_hot.sample <= 1 || CR_ATOMIC_INC(&cr_hot.tick) % cr_hot.sample == 0))
+      cr_hotkeyssample(key, keylen);
+  }
+}
+
+int credis_hotkeys_enable(int sample, int k, REDIS_HOTKEY_CALLBACK cb, void *arg)
+{
+  if (k <= 0 || k > CREDIS_HOTKEYS_MAX)
+    return -EINVAL;
+
+  while (!CR_TRYLOCK(&cr_hot.lock))
+    ;
+  cr_hot.enabled = 0;
+  memset((void *) cr_hot.counts, 0, sizeof(cr_hot.counts));
+  cr_hot.tick = 0;
+  cr_hot.total = 0;
+  cr_hot.len = 0;
+  cr_hot.sample = sample;
+  cr_hot.k = k;
+  cr_hot.cb = cb;
+  cr_hot.arg = arg;
+  cr_hot.enabled = 1;
+  CR_UNLOCK(&cr_hot.lock);
+
+  return 0;
+}
+
+void credis_hotkeys_disable(void)
+{
+  cr_hot.enabled = 0;
+}
+
+static int cr_comparehotkey(const void *a, const void *b)
+{
+  const cr_hotkey *ha = a, *hb = b;
+
+  if (ha->est == hb->est)
+    return 0;
+  return ha->est < hb->est ? 1 : -1;
+}
+
+int credis_hotkeys(REDIS_HOTKEY *keyv, int size)
+{
+  int i, n, scale = cr_hot.sample > 1 ? cr_hot.sample : 1;
+
+  while (!CR_TRYLOCK(&cr_hot.lock))
+    ;
+
+  for (i = 0; i < cr_hot.len; i++)
+    cr_hot.top[i].est = cr_hotkeysadd(cr_hot.top[i].hash, 0);
+  qsort(cr_hot.top, cr_hot.len, sizeof(cr_hotkey), cr_comparehotkey);
+
+  n = cr_hot.len < size ? cr_hot.len : size;
+  for (i = 0; i < n; i++) {
+    keyv[i] = cr_hot.top[i].key;
+    keyv[i].count = (long long) cr_hot.top[i].est * scale;
+    keyv[i].share = cr_hot.total ? (double) cr_hot.top[i].est / cr_hot.total : 0;
+  }
+
+  CR_UNLOCK(&cr_hot.lock);
+
+  return n;
+}
+
+/* Send message that has been prepared in message buffer prior to the call
+ * to this function. */
+static int cr_send(REDIS rhnd)
+{
+  int rc;
+
+  DEBUG("Sending message: len=%d, data=%s", rhnd->buf.len, rhnd->buf.data);
+
+  cr_hotkeystrack(rhnd->buf.data, rhnd->buf.len);
+
+  rc = cr_senddata(rhnd, rhnd->buf.data, rhnd->buf.len);
 
   if (rc != rhnd->buf.len) {
     if (rc < 0)
@@ -610,6 +1631,18 @@ static int cr_sendandreceive(REDIS rhnd, char recvtype)
     return CREDIS_ERR_TIMEOUT;
   }
 
+  return 0;
+}
+
+/* Send message that has been prepared in message buffer prior to the call
+ * to this function. Wait and receive reply. */
+static int cr_sendandreceive(REDIS rhnd, char recvtype)
+{
+  int rc;
+
+  if ((rc = cr_send(rhnd)) != 0)
+    return rc;
+
   return cr_receivereply(rhnd, recvtype);
 }
 
@@ -648,902 +1681,6821 @@ static int cr_sendfandreceive(REDIS rhnd, char recvtype, const char *format, ...
   return cr_sendandreceive(rhnd, recvtype);
 }
 
-char * credis_errorreply(REDIS rhnd)
+/* Returns 1 if server replied that the command is unknown, e.g. since it is
+ * renamed or disabled, in which case capabilities `caps' are cleared so 
+ * that older command forms are used from now on. Otherwise 0. */
+static int cr_unknowncommand(REDIS rhnd, int caps)
 {
-  return rhnd->reply.line;
+  if (rhnd->reply.type != CR_ERROR || rhnd->reply.errortype != CREDIS_ERRTYPE_UNKNOWNCOMMAND)
+    return 0;
+
+  rhnd->caps &= ~caps;
+
+  return 1;
 }
 
-void credis_close(REDIS rhnd)
+/* Sends command of `argc' arguments in `argv' and waits for reply. Command
+ * is encoded with the unified request protocol if server supports it, 
+ * otherwise as an inline command with the last argument sent as bulk data. */
+static int cr_sendcmd(REDIS rhnd, char recvtype, int argc, const char **argv)
 {
-  if (rhnd) {
-    if (rhnd->fd > 0)
-      close(rhnd->fd);
-#ifdef WIN32
-    WSACleanup();
-#endif
-    cr_delete(rhnd);
-  }
+  cr_buffer *buf = &(rhnd->buf);
+  int rc;
+
+  buf->len = 0;
+  if (rhnd->caps & CREDIS_CAP_MULTIBULK)
+    rc = cr_appendcmdv(buf, argc, argv, NULL);
+  else if ((rc = cr_appendstr(buf, argv[0], 0)) == 0 &&
+           (rc = cr_appendstrarray(buf, argc - 2, argv + 1, 0)) == 0)
+    rc = cr_appendstrf(buf, " %zu\r\n%s\r\n", strlen(argv[argc - 1]), argv[argc - 1]);
+  if (rc != 0)
+    return rc;
+
+  return cr_sendandreceive(rhnd, recvtype);
 }
 
-REDIS credis_connect(const char *host, int port, int timeout)
+/* Resets buffers of `rhndc' handles in `rhndv' for appending commands to
+ * pipeline */
+static void cr_pipelinereset(REDIS *rhndv, int rhndc)
 {
-  int fd, rc, flags, yes = 1, use_he = 0;
-  struct sockaddr_in sa;  
-  struct hostent *he;
-  REDIS rhnd;
+  int i;
 
-#ifdef WIN32
-  unsigned long addr;
-  WSADATA data;
-  
-  if (WSAStartup(MAKEWORD(2,2), &data) != 0) {
-    DEBUG("Failed to init Windows Sockets DLL\n");
-    return NULL;
+  for (i = 0; i < rhndc; i++) {
+    rhndv[i]->buf.len = 0;
+    rhndv[i]->buf.idx = 0;
   }
-#endif
+}
 
-  if ((rhnd = cr_new()) == NULL)
-    return NULL;
+/* Sends commands appended to buffers of `rhndc' handles in `rhndv'. All 
+ * servers get their commands before any replies are read, so they work on
+ * them in parallel. */
+static int cr_pipelinesend(REDIS *rhndv, int rhndc)
+{
+  cr_buffer *buf;
+  int i, rc;
+
+  for (i = 0; i < rhndc; i++) {
+    buf = &(rhndv[i]->buf);
+    if (buf->len == 0)
+      continue;
+    cr_hotkeystrack(buf->data, buf->len);
+    rc = cr_senddata(rhndv[i], buf->data, buf->len);
+    if (rc != buf->len)
+      return rc < 0 ? CREDIS_ERR_SEND : CREDIS_ERR_TIMEOUT;
+    buf->len = 0;
+    buf->idx = 0;
+  }
 
-  if (host == NULL)
-    host = "127.0.0.1";
-  if (port == 0)
-    port = 6379;
+  return 0;
+}
 
-#ifdef WIN32
-  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
-      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (const char *)&yes, sizeof(yes)) == -1 ||
-      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&yes, sizeof(yes)) == -1)
-    goto error;
-#else
-  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
-      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&yes, sizeof(yes)) == -1 ||
-      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&yes, sizeof(yes)) == -1)
-    goto error;
-#endif
+/* Reads next reply of a pipeline, the previous reply is discarded */
+static int cr_pipelinereply(REDIS rhnd, char recvtype)
+{
+  cr_compactbuffer(&(rhnd->buf));
+  return cr_readreply(rhnd, recvtype);
+}
 
-  sa.sin_family = AF_INET;
-  sa.sin_port = htons(port);
+/* Appends command `cmd' `key' with `n' elements of `elemv' as arguments, 
+ * each preceded by its score in `scorev' unless NULL */
+static int cr_appendvariadic(cr_buffer *buf, const char *cmd, const char *key, int n, 
+                             const double *scorev, const char **elemv)
+{
+  char score[32];
+  int i, rc;
 
-#ifdef WIN32
-  /* TODO use getaddrinfo() instead! */
-  addr = inet_addr(host);
-  if (addr == INADDR_NONE) {
-    he = gethostbyname(host);
-    use_he = 1;
-  }
-  else {
-    he = gethostbyaddr((char *)&addr, sizeof(addr), AF_INET);
-    use_he = 1;
-  }
-#else
-  if (inet_aton(host, &sa.sin_addr) == 0) {
-    he = gethostbyname(host);
-    use_he = 1;
-  }
-#endif
+  if ((rc = cr_appendstrf(buf, "*%d\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n", 
+                          2 + (scorev ? 2 : 1) * n, strlen(cmd), cmd, strlen(key), key)) != 0)
+    return rc;
 
-  if (use_he) {
-    if (he == NULL)
-      goto error;
-    memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
-  } 
+  for (i = 0; i < n; i++) {
+    if (scorev != NULL) {
+      snprintf(score, sizeof(score), "%.17g", scorev[i]);
+      if ((rc = cr_appendstrf(buf, "$%zu\r\n%s\r\n", strlen(score), score)) != 0)
+        return rc;
+    }
+    if ((rc = cr_appendstrf(buf, "$%zu\r\n%s\r\n", strlen(elemv[i]), elemv[i])) != 0)
+      return rc;
+  }
 
-  /* connect with user specified timeout */
+  return 0;
+}
 
-  flags = fcntl(fd, F_GETFL);
-  if ((rc = fcntl(fd, F_SETFL, flags | O_NONBLOCK)) < 0) {
-    DEBUG("Setting socket non-blocking failed with: %d\n", rc);
-  }
+/* Sends `cmd' `key' for `n' elements, and scores unless `scorev' is NULL. 
+ * Servers that support variadic commands (Redis >= 2.4) get as many 
+ * elements per command as fit in CR_CHUNK_SIZE bytes, older servers get a
+ * command per element. Commands are pipelined, sent whenever CR_CHUNK_SIZE 
+ * bytes have been appended.
+ * Returns:
+ *  >=0  sum of integer replies if `sum' is set, otherwise the last one
+ *  <0   on error, the first error replied by server is returned after all
+ *       replies have been read */
+static int cr_variadic(REDIS rhnd, const char *cmd, const char *key, int n, 
+                       const double *scorev, const char **elemv, int sum)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  int i, j, rc, bytes, variadic, pending = 0, result = 0, err = 0;
 
-  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
-    if (errno != EINPROGRESS)
-      goto error;
+  variadic = rhnd->caps & CREDIS_CAP_VARIADIC;
 
-    if (cr_selectwritable(fd, timeout) > 0) {
-      int err;
-      unsigned int len = sizeof(err);
-      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
-        goto error;
+  buf->len = 0;
+  buf->idx = 0;
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1, bytes = strlen(elemv[i]); variadic && j < n && bytes < CR_CHUNK_SIZE; j++)
+      bytes += strlen(elemv[j]) + 16;
+    if ((rc = cr_appendvariadic(buf, cmd, key, j - i, scorev ? scorev + i : NULL, elemv + i)) != 0)
+      return rc;
+    pending++;
+    if (buf->len >= CR_CHUNK_SIZE || j == n) {
+      cr_hotkeystrack(buf->data, buf->len);
+      if ((rc = cr_sendpart(rhnd, buf->data, buf->len, j < n)) != buf->len)
+        return rc < 0 ? CREDIS_ERR_SEND : CREDIS_ERR_TIMEOUT;
+      buf->len = 0;
     }
-    else /* timeout or select error */
-      goto error;
   }
-  /* else connect completed immediately */
-
-  strcpy(rhnd->ip, inet_ntoa(sa.sin_addr));
-  rhnd->port = port;
-  rhnd->fd = fd;
-  rhnd->timeout = timeout;
 
-  /* We can receive 2 version formats: x.yz and x.y.z, where x.yz was only used prior 
-   * first 1.1.0 release(?), e.g. stable releases 1.02 and 1.2.6 */
-  if (cr_sendfandreceive(rhnd, CR_BULK, "INFO\r\n") == 0) {
-    int items = sscanf(rhnd->reply.bulk,
-                       "redis_version:%d.%d.%d\r\n",
-                       &(rhnd->version.major),
-                       &(rhnd->version.minor),
-                       &(rhnd->version.patch));
-    if (items < 2)
-      goto error;
-    if (items == 2) {
-      rhnd->version.patch = rhnd->version.minor;
-      rhnd->version.minor = 0;
+  while (pending-- > 0) {
+    if ((rc = cr_pipelinereply(rhnd, CR_ANY)) != 0) {
+      if (rhnd->reply.type != CR_ERROR)
+        return rc;
+      if (err == 0)
+        err = rc;
     }
-    DEBUG("Connected to Redis version: %d.%d.%d\n", 
-          rhnd->version.major, rhnd->version.minor, rhnd->version.patch);
+    else if (rhnd->reply.type == CR_INT)
+      result = sum ? result + rhnd->reply.integer : rhnd->reply.integer;
   }
 
-  return rhnd;
-
-error:
-  if (fd > 0)
-    close(fd);
-  cr_delete(rhnd);
+  return err != 0 ? err : result;
+}
 
-  return NULL;
+char * credis_errorreply(REDIS rhnd)
+{
+  return rhnd->reply.line;
 }
 
-void credis_settimeout(REDIS rhnd, int timeout)
+int credis_errortype(REDIS rhnd)
 {
-  rhnd->timeout = timeout;
+  return rhnd->reply.errortype;
 }
 
-int credis_set(REDIS rhnd, const char *key, const char *val)
+void credis_close(REDIS rhnd)
 {
-  return cr_sendfandreceive(rhnd, CR_INLINE, "SET %s %zu\r\n%s\r\n", 
-                            key, strlen(val), val);
+  if (rhnd) {
+#ifdef WITH_OPENSSL
+    cr_tlsclose(rhnd);
+#endif
+    if (rhnd->fd > 0)
+      close(rhnd->fd);
+#ifdef WIN32
+    WSACleanup();
+#endif
+    cr_delete(rhnd);
+  }
 }
 
-int credis_get(REDIS rhnd, const char *key, char **val)
+/*
+ * Negative lookup filter
+ */
+
+#define CR_FILTER_SCAN_COUNT "1000"
+
+/* Returns bit `i' of the `k' bits of `key' in a filter of `m' bits, by 
+ * double hashing with the two halves of a 64 bit hash */
+#define CR_FILTER_BIT(h, i, m) \
+  (((h) + (i) * (((h) >> 32) | 1)) % (m))
+
+static void cr_filterset(unsigned char *bits, unsigned long long m, int k, 
+                         const char *key, int len)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "GET %s\r\n", key);
+  unsigned long long h = cr_hash(key, len), bit;
+  int i;
 
-  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL)
-    return -1;
+  for (i = 0; i < k; i++) {
+    bit = CR_FILTER_BIT(h, (unsigned long long) i, m);
+    bits[bit >> 3] |= 1 << (bit & 7);
+  }
+}
 
-  return rc;
+/* Adds `key', written by this process, to filter of `rhnd' if any */
+static void cr_filteradd(REDIS rhnd, const char *key)
+{
+  cr_filter *f = rhnd->filter;
+
+  if (f == NULL)
+    return;
+  cr_filterset(f->bits, f->m, f->k, key, strlen(key));
+  f->stats.added++;
 }
 
-int credis_getset(REDIS rhnd, const char *key, const char *set_val, char **get_val)
+/* Returns 0 if `key' is definitely missing, i.e. lookup can be answered 
+ * without asking server, otherwise 1 */
+static int cr_filtercheck(REDIS rhnd, const char *key)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "GETSET %s %zu\r\n%s\r\n", 
-                              key, strlen(set_val), set_val);
+  cr_filter *f = rhnd->filter;
+  unsigned long long h, bit;
+  int i;
+
+  if (f == NULL || !f->valid)
+    return 1;
+
+  f->stats.lookups++;
+  h = cr_hash(key, strlen(key));
+  for (i = 0; i < f->k; i++) {
+    bit = CR_FILTER_BIT(h, (unsigned long long) i, f->m);
+    if (!(f->bits[bit >> 3] & (1 << (bit & 7)))) {
+      f->stats.negatives++;
+      return 0;
+    }
+  }
 
-  if (rc == 0 && (*get_val = rhnd->reply.bulk) == NULL)
-    return -1;
+  return 1;
+}
 
-  return rc;
+/* Counts lookup that passed filter but found `key' missing */
+static void cr_filtermiss(REDIS rhnd)
+{
+  if (rhnd->filter != NULL && rhnd->filter->valid)
+    rhnd->filter->stats.false_positives++;
 }
 
-int credis_ping(REDIS rhnd) 
+/* Empties filter, since keyspace was flushed */
+static void cr_filterclear(REDIS rhnd)
 {
-  return cr_sendfandreceive(rhnd, CR_INLINE, "PING\r\n");
+  if (rhnd->filter != NULL)
+    memset(rhnd->filter->bits, 0, rhnd->filter->m / 8);
 }
 
-int credis_auth(REDIS rhnd, const char *password)
+/* Marks filter as no longer reflecting keyspace of `rhnd' until rebuilt, 
+ * e.g. since another database is selected */
+static void cr_filterinvalidate(REDIS rhnd)
 {
-  return cr_sendfandreceive(rhnd, CR_INLINE, "AUTH %s\r\n", password);
+  if (rhnd->filter != NULL)
+    rhnd->filter->valid = 0;
 }
 
-static int cr_multikeybulkcommand(REDIS rhnd, const char *cmd, int keyc, 
-                                  const char **keyv, char ***valv)
+int credis_filter_enable(REDIS rhnd, long long capacity, double fpr)
 {
-  cr_buffer *buf = &(rhnd->buf);
-  int rc;
+  cr_filter *f;
+  double m;
 
-  buf->len = 0;
+  if (capacity <= 0 || fpr <= 0 || fpr >= 1)
+    return -EINVAL;
+
+  /* optimal size and number of hash functions for `capacity' keys */
+  m = ceil(-capacity * log(fpr) / ((log(2.0) * log(2.0))));
+  if (m < 64)
+    m = 64;
+
+  credis_filter_disable(rhnd);
+  if ((f = calloc(1, sizeof(cr_filter))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  f->m = ((unsigned long long) m + 7) & ~7ULL;
+  f->k = (int) (f->m * log(2.0) / capacity + 0.5);
+  if (f->k < 1)
+    f->k = 1;
+  if ((f->bits = calloc(f->m / 8, 1)) == NULL) {
+    free(f);
+    return CREDIS_ERR_NOMEM;
+  }
+  rhnd->filter = f;
+
+  return 0;
+}
+
+void credis_filter_disable(REDIS rhnd)
+{
+  if (rhnd->filter != NULL) {
+    free(rhnd->filter->bits);
+    free(rhnd->filter);
+    rhnd->filter = NULL;
+  }
+}
+
+int credis_filter_rebuild(REDIS rhnd)
+{
+  cr_filter *f = rhnd->filter;
+  cr_buffer *buf = &(rhnd->buf);
+  cr_multibulk *mb = &(rhnd->reply.multibulk);
+  struct timeval start, stop;
+  unsigned char *bits;
+  char cursor[32];
+  const char *argv[4];
+  long long keys = 0, commands = 0;
+  int i, rc, scan = rhnd->caps & CREDIS_CAP_SCAN;
+
+  if (f == NULL)
+    return CREDIS_ERR;
+  if (!scan && !(rhnd->caps & CREDIS_CAP_KEYSMULTIBULK))
+    return CREDIS_ERR; /* neither SCAN nor KEYS replying multi-bulk */
+  if ((bits = calloc(f->m / 8, 1)) == NULL)
+    return CREDIS_ERR_NOMEM;
+
+  gettimeofday(&start, NULL);
+  strcpy(cursor, "0");
+  do {
+    buf->len = 0;
+    if (scan) {
+      argv[0] = "SCAN";
+      argv[1] = cursor;
+      argv[2] = "COUNT";
+      argv[3] = CR_FILTER_SCAN_COUNT;
+      rc = cr_appendcmdv(buf, 4, argv, NULL);
+    }
+    else {
+      argv[0] = "KEYS";
+      argv[1] = "*";
+      rc = cr_appendcmdv(buf, 2, argv, NULL);
+    }
+    if (rc != 0 || (rc = cr_sendandreceive(rhnd, CR_MULTIBULK)) != 0) {
+      free(bits);
+      return rc;
+    }
+    commands++;
+
+    if (scan) {
+      if (mb->len < 2 || mb->types[1] != CR_MULTIBULK || mb->lens[0] >= (int) sizeof(cursor)) {
+        free(bits);
+        return CREDIS_ERR_PROTOCOL;
+      }
+      memcpy(cursor, mb->bulks[0], mb->lens[0] + 1);
+    }
+    for (i = scan ? 2 : 0; i < mb->len; i++)
+      cr_filterset(bits, f->m, f->k, mb->bulks[i], mb->lens[i]);
+    keys += mb->len - (scan ? 2 : 0);
+  } while (scan && strcmp(cursor, "0") != 0);
+  gettimeofday(&stop, NULL);
+
+  free(f->bits);
+  f->bits = bits;
+  f->valid = 1;
+  f->stats.added += keys;
+  f->stats.rebuilds++;
+  f->stats.rebuild_keys = keys;
+  f->stats.rebuild_commands = commands;
+  f->stats.rebuild_usecs = (stop.tv_sec - start.tv_sec) * 1000000LL + 
+    (stop.tv_usec - start.tv_usec);
+
+  return 0;
+}
+
+int credis_filter_stats(REDIS rhnd, REDIS_FILTER_STATS *stats)
+{
+  cr_filter *f = rhnd->filter;
+  unsigned long long set = 0, i;
+  unsigned char byte;
+
+  if (f == NULL)
+    return CREDIS_ERR;
+
+  for (i = 0; i < f->m / 8; i++)
+    for (byte = f->bits[i]; byte; byte &= byte - 1)
+      set++;
+
+  *stats = f->stats;
+  stats->bits = f->m;
+  stats->hashes = f->k;
+  stats->valid = f->valid;
+  stats->fill = (double) set / f->m;
+  stats->fpr = pow(stats->fill, f->k);
+
+  return 0;
+}
+
+/*
+ * Memory-mapped L2 cache
+ */
+
+#define CR_L2_MAGIC "CREDL2v2"
+#define CR_L2_MINSIZE (64 * 1024)
+#define CR_L2_LOCK_SPINS 100000
+#define CR_L2_READ_RETRIES 100
+#define CR_L2_ALIGN(n) (((n) + 7) & ~7ULL)
+
+/* Returns current time in milliseconds since the epoch, which is the same 
+ * for all processes of a host */
+static long long cr_l2now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+/* Empties cache, caller holds lock */
+static void cr_l2reset(cr_l2header *h)
+{
+  h->seq++;
+  CR_BARRIER();
+  memset((char *) h + sizeof(cr_l2header), 0, h->buckets * sizeof(cr_l2slot));
+  h->tail = h->data;
+  h->entries = 0;
+  h->resets++;
+  CR_BARRIER();
+  h->seq++;
+}
+
+/* Takes lock of cache, which holds pid of writer. A lock held by a process
+ * that no longer exists, i.e. that died while holding it, is taken over. 
+ * Cache is emptied if it may be inconsistent or stale.
+ * Returns:
+ *   0  on success
+ *  -1  if another writer holds lock for long */
+static int cr_l2lock(cr_l2 *l2)
+{
+  cr_l2header *h = (cr_l2header *) l2->map;
+  int spins, owner, pid = (int) getpid();
+
+  for (spins = 0; spins < CR_L2_LOCK_SPINS; spins++)
+    if (CR_CAS(&(h->lock), 0, pid))
+      break;
+
+  if (spins == CR_L2_LOCK_SPINS) {
+    owner = h->lock;
+    if (owner == 0 || owner == pid || kill(owner, 0) == 0 || errno != ESRCH ||
+        !CR_CAS(&(h->lock), owner, pid))
+      return -1;
+    /* writer died, possibly while writing */
+    if (h->seq & 1)
+      h->seq++;
+    h->stale = 1;
+  }
+
+  if (h->stale) {
+    cr_l2reset(h);
+    h->stale = 0;
+  }
+
+  return 0;
+}
+
+/* Takes lock of cache for a write. If lock can not be taken, the write is 
+ * not reflected, so cache is marked stale, which makes readers miss until
+ * next writer empties it, and handle stops using cache.
+ * Returns 0 on success, otherwise -1. */
+static int cr_l2writelock(cr_l2 *l2)
+{
+  if (cr_l2lock(l2) == 0)
+    return 0;
+
+  DEBUG("cache lock not available, cache is no longer used by handle");
+  ((cr_l2header *) l2->map)->stale = 1;
+  CR_BARRIER();
+  l2->failed = 1;
+
+  return -1;
+}
+
+/* Copies record of `key' stored at `off' to `rec' and returns its value, 
+ * or NULL if it is not `key' or out of bounds, which a reader can see while
+ * cache is being written. Only the copy is used, since a writer may reuse 
+ * the record meanwhile. */
+static const char *cr_l2record_at(cr_l2 *l2, unsigned long long off, 
+                                  const char *key, int keylen, cr_l2record *rec)
+{
+  cr_l2header *h = (cr_l2header *) l2->map;
+
+  if (off < h->data || off + sizeof(cr_l2record) > l2->size)
+    return NULL;
+  memcpy(rec, l2->map + off, sizeof(cr_l2record));
+  if (rec->keylen != (unsigned int) keylen || 
+      off + sizeof(cr_l2record) + rec->keylen + rec->vallen > l2->size ||
+      memcmp(l2->map + off + sizeof(cr_l2record), key, keylen) != 0)
+    return NULL;
+
+  return l2->map + off + sizeof(cr_l2record) + keylen;
+}
+
+/* Returns slot of `key' with hash `hash', or the empty slot to store it 
+ * in, or NULL if neither is found */
+static cr_l2slot *cr_l2slot_of(cr_l2 *l2, unsigned long long hash, const char *key, 
+                               int keylen)
+{
+  cr_l2header *h = (cr_l2header *) l2->map;
+  cr_l2slot *slots = (cr_l2slot *) (l2->map + sizeof(cr_l2header));
+  cr_l2record rec;
+  unsigned long long i, n, mask = h->buckets - 1;
+
+  for (i = hash & mask, n = 0; n < h->buckets; i = (i + 1) & mask, n++) {
+    if (slots[i].off == 0)
+      return &slots[i];
+    if (slots[i].hash == hash && 
+        cr_l2record_at(l2, slots[i].off, key, keylen, &rec) != NULL)
+      return &slots[i];
+  }
+
+  return NULL;
+}
+
+/* Looks up `key' and copies its value to buffer of cache. Readers do not 
+ * lock, they retry if the sequence number shows that cache was written 
+ * meanwhile.
+ * Returns:
+ *   0  on hit, value is stored in buffer of cache
+ *  -1  on miss */
+static int cr_l2get(REDIS rhnd, const char *key, char **val)
+{
+  cr_l2 *l2 = rhnd->l2;
+  cr_l2header *h;
+  cr_l2slot *slot;
+  cr_l2record rec;
+  const char *data;
+  unsigned long long hash, seq, off;
+  int keylen, tries, found;
+
+  if (l2 == NULL || !l2->active || l2->failed)
+    return -1;
+
+  h = (cr_l2header *) l2->map;
+  keylen = strlen(key);
+  hash = cr_hash(key, keylen);
+
+  /* a read-only handle can not invalidate keys it writes, it asks server */
+  if (l2->readonly && 
+      (l2->written[(hash % CR_L2_WRITTEN_BITS) / 8] & (1 << (hash % 8)))) {
+    l2->stats.misses++;
+    return -1;
+  }
+
+  for (tries = 0; tries < CR_L2_READ_RETRIES; tries++) {
+    if ((seq = h->seq) & 1)
+      continue;
+    CR_BARRIER();
+    found = 0;
+    if ((slot = cr_l2slot_of(l2, hash, key, keylen)) != NULL && (off = slot->off) != 0 &&
+        (data = cr_l2record_at(l2, off, key, keylen, &rec)) != NULL) {
+      if (rec.expires > cr_l2now()) {
+        if (l2->value.size < (int) rec.vallen + 1 && 
+            cr_moremem(&(l2->value), rec.vallen + 1 - l2->value.size))
+          return -1;
+        memcpy(l2->value.data, data, rec.vallen);
+        l2->value.data[rec.vallen] = '\0';
+        found = 1;
+      }
+      else
+        found = -1;
+    }
+    CR_BARRIER();
+    if (h->seq != seq)
+      continue;
+
+    if (found == 1 && !h->stale) {
+      l2->stats.hits++;
+      *val = l2->value.data;
+      return 0;
+    }
+    if (found == -1)
+      l2->stats.expired++;
+    break;
+  }
+  l2->stats.misses++;
+
+  return -1;
+}
+
+/* Stores `val' of `key' for `ttl' milliseconds, or at most the time to 
+ * live of cache, or invalidates `key' if `val' is NULL, after it was 
+ * written. If another writer holds lock for long handle stops using cache.
+ * A read-only handle remembers the key, to no longer look it up in cache. */
+static void cr_l2put(REDIS rhnd, const char *key, const char *val, long long ttl)
+{
+  cr_l2 *l2 = rhnd->l2;
+  cr_l2header *h;
+  cr_l2slot *slot;
+  cr_l2record *rec;
+  unsigned long long hash, need;
+  int keylen, vallen;
+
+  if (l2 == NULL || !l2->active || l2->failed)
+    return;
+
+  h = (cr_l2header *) l2->map;
+  keylen = strlen(key);
+  vallen = val != NULL ? (int) strlen(val) : 0;
+  hash = cr_hash(key, keylen);
+
+  if (l2->readonly) {
+    l2->written[(hash % CR_L2_WRITTEN_BITS) / 8] |= 1 << (hash % 8);
+    return;
+  }
+  need = CR_L2_ALIGN(sizeof(cr_l2record) + keylen + vallen);
+  if (ttl <= 0 || ttl > l2->ttl)
+    ttl = l2->ttl;
+
+  if (need > (l2->size - h->data) / 4)
+    val = NULL; /* too large, only invalidate */
+
+  if (cr_l2writelock(l2) != 0)
+    return;
+
+  if ((slot = cr_l2slot_of(l2, hash, key, keylen)) != NULL && slot->off != 0 && val == NULL) {
+    /* expire in place */
+    h->seq++;
+    CR_BARRIER();
+    ((cr_l2record *) (l2->map + slot->off))->expires = 0;
+    CR_BARRIER();
+    h->seq++;
+  }
+  else if (val != NULL) {
+    /* log and index are emptied when full, which is cheaper than compacting
+     * and what is hot is soon cached again */
+    if (slot == NULL || h->tail + need > l2->size || (h->entries + 1) * 10 > h->buckets * 7) {
+      cr_l2reset(h);
+      slot = cr_l2slot_of(l2, hash, key, keylen);
+    }
+    h->seq++;
+    CR_BARRIER();
+    rec = (cr_l2record *) (l2->map + h->tail);
+    rec->keylen = keylen;
+    rec->vallen = vallen;
+    rec->expires = cr_l2now() + ttl;
+    memcpy((char *) rec + sizeof(cr_l2record), key, keylen);
+    memcpy((char *) rec + sizeof(cr_l2record) + keylen, val, vallen);
+    if (slot->off == 0)
+      h->entries++;
+    slot->hash = hash;
+    slot->off = h->tail;
+    h->tail += need;
+    CR_BARRIER();
+    h->seq++;
+    l2->stats.stores++;
+  }
+
+  CR_UNLOCK(&(h->lock));
+}
+
+/* Invalidates `key' in cache of `rhnd' if any */
+static void cr_l2invalidate(REDIS rhnd, const char *key)
+{
+  cr_l2put(rhnd, key, NULL, 0);
+}
+
+/* Stores `val' of `key' as read from server, unless handle is read-only */
+static void cr_l2fill(REDIS rhnd, const char *key, const char *val)
+{
+  if (rhnd->l2 != NULL && !rhnd->l2->readonly)
+    cr_l2put(rhnd, key, val, 0);
+}
+
+/* Empties cache of `rhnd', since keyspace was flushed */
+static void cr_l2clear(REDIS rhnd)
+{
+  cr_l2 *l2 = rhnd->l2;
+  cr_l2header *h;
+
+  if (l2 == NULL || l2->failed)
+    return;
+  if (l2->readonly) {
+    l2->failed = 1;
+    return;
+  }
+  if (cr_l2writelock(l2) != 0)
+    return;
+  h = (cr_l2header *) l2->map;
+  cr_l2reset(h);
+  CR_UNLOCK(&(h->lock));
+}
+
+static void cr_l2free(cr_l2 *l2)
+{
+  if (l2->map != NULL)
+    munmap(l2->map, l2->size);
+  if (l2->fd >= 0)
+    close(l2->fd);
+  free(l2->value.data);
+  free(l2);
+}
+
+int credis_l2_attach(REDIS rhnd, const char *path, long long size, long long ttl, int readonly)
+{
+  cr_l2 *l2;
+  cr_l2header *h;
+  struct stat st;
+  unsigned long long buckets;
+  char server[64];
+  int init = 0;
+
+  if (ttl <= 0)
+    return -EINVAL;
+
+  credis_l2_detach(rhnd);
+  snprintf(server, sizeof(server), "%s:%d", rhnd->ip, rhnd->port);
+
+  if ((l2 = calloc(1, sizeof(cr_l2))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  l2->readonly = readonly;
+  l2->ttl = ttl;
+  l2->active = 1;
+
+  if ((l2->fd = open(path, readonly ? O_RDONLY : O_RDWR | O_CREAT, 0644)) < 0 ||
+      fstat(l2->fd, &st) != 0)
+    goto error;
+
+  /* an existing cache of any size is reused, it survives restarts */
+  if (st.st_size >= CR_L2_MINSIZE)
+    size = st.st_size;
+  else if (readonly || size < CR_L2_MINSIZE || ftruncate(l2->fd, size) != 0)
+    goto error;
+  else
+    init = 1;
+  l2->size = size;
+
+  if ((l2->map = mmap(NULL, l2->size, readonly ? PROT_READ : PROT_READ | PROT_WRITE, 
+                      MAP_SHARED, l2->fd, 0)) == MAP_FAILED) {
+    l2->map = NULL;
+    goto error;
+  }
+  h = (cr_l2header *) l2->map;
+
+  if (!init && (memcmp(h->magic, CR_L2_MAGIC, sizeof(h->magic)) != 0 || 
+                h->size != l2->size)) {
+    if (readonly)
+      goto error;
+    init = 1;
+  }
+
+  if (init) {
+    /* index gets about an eighth of file, in a power of 2 number of slots */
+    for (buckets = 1; buckets * 2 * sizeof(cr_l2slot) * 8 <= l2->size; buckets *= 2)
+      ;
+    memset(h, 0, sizeof(cr_l2header));
+    h->size = l2->size;
+    h->buckets = buckets;
+    h->data = CR_L2_ALIGN(sizeof(cr_l2header) + buckets * sizeof(cr_l2slot));
+    cr_l2reset(h);
+    h->resets = 0;
+    strcpy(h->server, server);
+    CR_BARRIER();
+    memcpy(h->magic, CR_L2_MAGIC, sizeof(h->magic));
+  }
+  else if (strncmp(h->server, server, sizeof(h->server)) != 0) {
+    /* values of another server are of no use, and would be wrong */
+    if (readonly || cr_l2lock(l2) != 0)
+      goto error;
+    cr_l2reset(h);
+    strcpy(h->server, server);
+    CR_UNLOCK(&(h->lock));
+  }
+  else if (!readonly && (h->lock != 0 || h->stale)) {
+    /* a writer that died holding lock is found out by taking it */
+    if (cr_l2lock(l2) == 0)
+      CR_UNLOCK(&(h->lock));
+  }
+
+  rhnd->l2 = l2;
+
+  return 0;
+
+error:
+  cr_l2free(l2);
+
+  return CREDIS_ERR;
+}
+
+void credis_l2_detach(REDIS rhnd)
+{
+  if (rhnd->l2 != NULL) {
+    cr_l2free(rhnd->l2);
+    rhnd->l2 = NULL;
+  }
+}
+
+int credis_l2_stats(REDIS rhnd, REDIS_L2_STATS *stats)
+{
+  cr_l2header *h;
+
+  if (rhnd->l2 == NULL)
+    return CREDIS_ERR;
+
+  h = (cr_l2header *) rhnd->l2->map;
+  *stats = rhnd->l2->stats;
+  stats->entries = h->entries;
+  stats->resets = h->resets;
+  stats->used = h->tail - h->data;
+  stats->size = rhnd->l2->size - h->data;
+
+  return 0;
+}
+
+/* Returns capabilities of a server of the version in `rhnd' */
+static int cr_versioncaps(REDIS rhnd)
+{
+  static const struct {
+    int version;
+    int caps;
+  } table[] = {
+    {CREDIS_VERSION_ENCODE(1, 2, 0), CREDIS_CAP_MULTIBULK},
+    {CREDIS_VERSION_ENCODE(2, 0, 0), CREDIS_CAP_KEYSMULTIBULK},
+    {CREDIS_VERSION_ENCODE(2, 4, 0), CREDIS_CAP_VARIADIC},
+    {CREDIS_VERSION_ENCODE(2, 6, 0), CREDIS_CAP_MILLISECONDS},
+    {CREDIS_VERSION_ENCODE(2, 8, 0), CREDIS_CAP_SCAN | CREDIS_CAP_PSYNC},
+    {CREDIS_VERSION_ENCODE(2, 8, 13), CREDIS_CAP_COMMAND},
+    {CREDIS_VERSION_ENCODE(4, 0, 0), CREDIS_CAP_UNLINK | CREDIS_CAP_MEMORY},
+    {CREDIS_VERSION_ENCODE(5, 0, 0), CREDIS_CAP_STREAMS}
+  };
+  int i, caps = 0, version = CR_SERVER_VERSION(rhnd);
+
+  /* version is unknown if INFO was refused, e.g. before authentication, 
+   * assume a server that at least understands the unified protocol */
+  if (version == 0)
+    return CR_CAPS_UNKNOWN;
+
+  for (i = 0; i < (int) (sizeof(table) / sizeof(table[0])); i++)
+    if (version >= table[i].version)
+      caps |= table[i].caps;
+
+  return caps;
+}
+
+/* Gets version of server with INFO and derives capabilities from it.
+ * Returns:
+ *   0  on success
+ *   1  if version could not be parsed 
+ *  <0  if INFO failed, version remains unknown */
+static int cr_detectversion(REDIS rhnd)
+{
+  char *str;
+  int rc, items;
+
+  /* We can receive 2 version formats: x.yz and x.y.z, where x.yz was only used prior 
+   * first 1.1.0 release(?), e.g. stable releases 1.02 and 1.2.6. Newer servers
+   * start the INFO output with a section header, hence search for the field. */
+  if ((rc = cr_sendfandreceive(rhnd, CR_BULK, "INFO\r\n")) == 0) {
+    str = strstr(rhnd->reply.bulk, "redis_version:");
+    items = str == NULL ? 0 : sscanf(str,
+                       "redis_version:%d.%d.%d\r\n",
+                       &(rhnd->version.major),
+                       &(rhnd->version.minor),
+                       &(rhnd->version.patch));
+    if (items < 2) {
+      memset(&(rhnd->version), 0, sizeof(rhnd->version));
+      rc = 1;
+    }
+    else if (items == 2) {
+      rhnd->version.patch = rhnd->version.minor;
+      rhnd->version.minor = 0;
+    }
+    DEBUG("Connected to Redis version: %d.%d.%d\n", 
+          rhnd->version.major, rhnd->version.minor, rhnd->version.patch);
+  }
+
+  rhnd->caps = cr_versioncaps(rhnd);
+
+  return rc;
+}
+
+/* Applies socket options of `o' to socket `fd'. Returns 0 on success, 1 if
+ * any option is not available or not permitted. */
+static int cr_setsockopts(int fd, const REDIS_SOCKET_OPTIONS *o)
+{
+  int rc = 0;
+
+  rc |= cr_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, o->sndbuf);
+  rc |= cr_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, o->rcvbuf);
+  rc |= cr_setsockopt(fd, IPPROTO_IP, IP_TOS, o->tos);
+#ifdef TCP_USER_TIMEOUT
+  rc |= cr_setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, o->user_timeout);
+#else
+  rc |= o->user_timeout != 0;
+#endif
+#ifdef TCP_KEEPIDLE
+  rc |= cr_setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, o->keepidle);
+#else
+  rc |= o->keepidle != 0;
+#endif
+#ifdef TCP_KEEPINTVL
+  rc |= cr_setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, o->keepintvl);
+  rc |= cr_setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, o->keepcnt);
+#else
+  rc |= o->keepintvl != 0 || o->keepcnt != 0;
+#endif
+#ifdef TCP_QUICKACK
+  rc |= cr_setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, o->quickack);
+#else
+  rc |= o->quickack > 0;
+#endif
+#ifndef MSG_MORE
+  rc |= o->cork > 0;
+#endif
+
+  return rc;
+}
+
+/* Returns handle connected to `host' and `port' with socket options 
+ * `options' unless NULL, of which server version is not yet known */
+static REDIS cr_connect(const char *host, int port, int timeout, 
+                        const REDIS_SOCKET_OPTIONS *options)
+{
+  int fd, rc, flags, yes = 1, use_he = 0;
+  struct sockaddr_in sa;  
+  struct hostent *he;
+  REDIS rhnd;
+
+#ifdef WIN32
+  unsigned long addr;
+  WSADATA data;
+  
+  if (WSAStartup(MAKEWORD(2,2), &data) != 0) {
+    DEBUG("Failed to init Windows Sockets DLL\n");
+    return NULL;
+  }
+#endif
+
+  if ((rhnd = cr_new()) == NULL)
+    return NULL;
+
+  if (host == NULL)
+    host = "127.0.0.1";
+  if (port == 0)
+    port = 6379;
+
+#ifdef WIN32
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (const char *)&yes, sizeof(yes)) == -1 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&yes, sizeof(yes)) == -1)
+    goto error;
+#else
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&yes, sizeof(yes)) == -1 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&yes, sizeof(yes)) == -1)
+    goto error;
+#endif
+
+  /* before connecting, so that buffer sizes count when window scaling is 
+   * negotiated */
+  if (options != NULL) {
+    rhnd->sockopts = *options;
+    if (cr_setsockopts(fd, options) != 0) {
+      DEBUG("some socket options could not be applied");
+    }
+  }
+
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+
+#ifdef WIN32
+  /* TODO use getaddrinfo() instead! */
+  addr = inet_addr(host);
+  if (addr == INADDR_NONE) {
+    he = gethostbyname(host);
+    use_he = 1;
+  }
+  else {
+    he = gethostbyaddr((char *)&addr, sizeof(addr), AF_INET);
+    use_he = 1;
+  }
+#else
+  if (inet_aton(host, &sa.sin_addr) == 0) {
+    he = gethostbyname(host);
+    use_he = 1;
+  }
+#endif
+
+  if (use_he) {
+    if (he == NULL)
+      goto error;
+    memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
+  } 
+
+  /* connect with user specified timeout */
+
+  flags = fcntl(fd, F_GETFL);
+  if ((rc = fcntl(fd, F_SETFL, flags | O_NONBLOCK)) < 0) {
+    DEBUG("Setting socket non-blocking failed with: %d\n", rc);
+  }
+
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    if (errno != EINPROGRESS)
+      goto error;
+
+    if (cr_selectwritable(fd, timeout) > 0) {
+      int err;
+      unsigned int len = sizeof(err);
+      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+        goto error;
+    }
+    else /* timeout or select error */
+      goto error;
+  }
+  /* else connect completed immediately */
+
+  strcpy(rhnd->ip, inet_ntoa(sa.sin_addr));
+  rhnd->port = port;
+  rhnd->fd = fd;
+  rhnd->timeout = timeout;
+
+  return rhnd;
+
+error:
+  if (fd > 0)
+    close(fd);
+  cr_delete(rhnd);
+
+  return NULL;
+}
+
+REDIS credis_connect_options(const char *host, int port, int timeout, 
+                             const REDIS_SOCKET_OPTIONS *options)
+{
+  REDIS rhnd;
+
+  if ((rhnd = cr_connect(host, port, timeout, options)) == NULL)
+    return NULL;
+
+  if (cr_detectversion(rhnd) == 1) {
+    credis_close(rhnd);
+    return NULL;
+  }
+
+  return rhnd;
+}
+
+REDIS credis_connect(const char *host, int port, int timeout)
+{
+  return credis_connect_options(host, port, timeout, NULL);
+}
+
+/* Returns another connection to server of `rhnd', encrypted the same way 
+ * and with the same socket options */
+static REDIS cr_connectlike(REDIS rhnd)
+{
+  REDIS like;
+
+  if ((like = cr_connect(rhnd->ip, rhnd->port, rhnd->timeout, &(rhnd->sockopts))) == NULL)
+    return NULL;
+
+#ifdef WITH_OPENSSL
+  if (rhnd->tls != NULL && cr_tlsstart(like, rhnd->tls->ctx, rhnd->tls->name) != 0) {
+    credis_close(like);
+    return NULL;
+  }
+#endif
+
+  if (cr_detectversion(like) == 1) {
+    credis_close(like);
+    return NULL;
+  }
+
+  return like;
+}
+
+REDIS credis_connect_tls(const char *host, int port, int timeout, 
+                         const REDIS_TLS_OPTIONS *options)
+{
+#ifdef WITH_OPENSSL
+  REDIS rhnd;
+  SSL_CTX *ctx;
+  int rc;
+
+  if ((ctx = cr_tlscontext(options)) == NULL)
+    return NULL;
+  if ((rhnd = cr_connect(host, port, timeout, options ? options->socket : NULL)) == NULL) {
+    SSL_CTX_free(ctx);
+    return NULL;
+  }
+
+  if (options != NULL && options->server_name != NULL)
+    host = options->server_name;
+  rc = cr_tlsstart(rhnd, ctx, host != NULL ? host : rhnd->ip);
+  SSL_CTX_free(ctx);
+
+  if (rc != 0 || cr_detectversion(rhnd) == 1) {
+    credis_close(rhnd);
+    return NULL;
+  }
+
+  return rhnd;
+#else
+  (void) host; (void) port; (void) timeout; (void) options;
+  DEBUG("TLS requires building with OpenSSL");
+  return NULL;
+#endif
+}
+
+int credis_tls_info(REDIS rhnd, REDIS_TLS_INFO *info)
+{
+#ifdef WITH_OPENSSL
+  SSL *ssl;
+
+  if (rhnd->tls == NULL)
+    return -1;
+  ssl = rhnd->tls->ssl;
+
+  memset(info, 0, sizeof(REDIS_TLS_INFO));
+  info->version = SSL_get_version(ssl);
+  info->cipher = SSL_get_cipher_name(ssl);
+  info->resumed = SSL_session_reused(ssl);
+#ifdef BIO_get_ktls_send
+  info->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+  info->ktls_receive = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+#endif
+
+  return 0;
+#else
+  (void) rhnd; (void) info;
+  return -1;
+#endif
+}
+
+void credis_settimeout(REDIS rhnd, int timeout)
+{
+  rhnd->timeout = timeout;
+}
+
+int credis_setsocketoptions(REDIS rhnd, const REDIS_SOCKET_OPTIONS *options)
+{
+  REDIS_SOCKET_OPTIONS *o = &(rhnd->sockopts);
+
+  /* options set are kept for connections made like this one */
+#define CR_SOCKOPT_MERGE(name) if (options->name != 0) o->name = options->name
+  CR_SOCKOPT_MERGE(sndbuf);
+  CR_SOCKOPT_MERGE(rcvbuf);
+  CR_SOCKOPT_MERGE(user_timeout);
+  CR_SOCKOPT_MERGE(keepidle);
+  CR_SOCKOPT_MERGE(keepintvl);
+  CR_SOCKOPT_MERGE(keepcnt);
+  CR_SOCKOPT_MERGE(quickack);
+  CR_SOCKOPT_MERGE(cork);
+  CR_SOCKOPT_MERGE(tos);
+#undef CR_SOCKOPT_MERGE
+
+  return cr_setsockopts(rhnd->fd, options);
+}
+
+int credis_setbusypoll(REDIS rhnd, int usecs)
+{
+  rhnd->busypoll = usecs > 0 ? usecs : 0;
+
+  /* let kernel poll device queue as well, which may require privileges */
+#ifdef SO_BUSY_POLL
+  if (setsockopt(rhnd->fd, SOL_SOCKET, SO_BUSY_POLL, (void *)&(rhnd->busypoll), 
+                 sizeof(rhnd->busypoll)) == 0)
+    return 0;
+#endif
+
+  return rhnd->busypoll > 0 ? 1 : 0;
+}
+
+int credis_capabilities(REDIS rhnd)
+{
+  return rhnd->caps;
+}
+
+void credis_setcapabilities(REDIS rhnd, int caps)
+{
+  rhnd->caps = caps;
+}
+
+/* Returns index of the entry following the one at `i' in multi-bulk `mb',
+ * skipping nested multi-bulks */
+static int cr_multibulknext(const cr_multibulk *mb, int i)
+{
+  int n = 1;
+
+  /* nested multi-bulk entries hold their number of entries in `lens' */
+  while (n > 0 && i < mb->len) {
+    if (mb->types[i] == CR_MULTIBULK && mb->lens[i] > 0)
+      n += mb->lens[i];
+    n--;
+    i++;
+  }
+
+  return i;
+}
+
+int credis_probe_capabilities(REDIS rhnd)
+{
+  static const struct {
+    const char *name;
+    int caps;
+  } table[] = {
+    {"scan", CREDIS_CAP_SCAN},
+    {"psync", CREDIS_CAP_PSYNC},
+    {"unlink", CREDIS_CAP_UNLINK},
+    {"memory", CREDIS_CAP_MEMORY},
+    {"xadd", CREDIS_CAP_STREAMS}
+  };
+  const int n = sizeof(table) / sizeof(table[0]);
+  const char *argv[2 + sizeof(table) / sizeof(table[0])];
+  cr_multibulk *mb = &(rhnd->reply.multibulk);
+  int i, j, rc, caps;
+
+  if (!(rhnd->caps & CREDIS_CAP_COMMAND))
+    return rhnd->caps;
+
+  argv[0] = "COMMAND";
+  argv[1] = "INFO";
+  for (i = 0; i < n; i++)
+    argv[2 + i] = table[i].name;
+  if ((rc = cr_sendcmd(rhnd, CR_MULTIBULK, 2 + n, argv)) != 0) {
+    /* keep what version says if COMMAND is renamed or disabled */
+    cr_unknowncommand(rhnd, CREDIS_CAP_COMMAND);
+    return rc;
+  }
+
+  /* a server that knows COMMAND supports everything up to Redis 2.8.13, 
+   * the rest depends on whether commands are available, where unknown 
+   * ones are replied as nil */
+  caps = CREDIS_CAP_MULTIBULK | CREDIS_CAP_KEYSMULTIBULK | CREDIS_CAP_VARIADIC | 
+    CREDIS_CAP_MILLISECONDS | CREDIS_CAP_COMMAND;
+  for (i = 0, j = 0; i < mb->len && j < n; j++) {
+    if (mb->types[i] == CR_MULTIBULK && mb->lens[i] > 0)
+      caps |= table[j].caps;
+    i = cr_multibulknext(mb, i);
+  }
+  if (j < n)
+    return CREDIS_ERR_PROTOCOL;
+  rhnd->caps = caps;
+
+  return caps;
+}
+
+int credis_set(REDIS rhnd, const char *key, const char *val)
+{
+  const char *argv[] = {"SET", key, val};
+  int rc;
+
+  cr_filteradd(rhnd, key);
+  rc = cr_sendcmd(rhnd, CR_INLINE, 3, argv);
+  cr_l2put(rhnd, key, rc == 0 ? val : NULL, 0);
+
+  return rc;
+}
+
+int credis_get(REDIS rhnd, const char *key, char **val)
+{
+  int rc;
+
+  if (!cr_filtercheck(rhnd, key))
+    return -1;
+  if (cr_l2get(rhnd, key, val) == 0)
+    return 0;
+
+  rc = cr_sendfandreceive(rhnd, CR_BULK, "GET %s\r\n", key);
+
+  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL) {
+    cr_filtermiss(rhnd);
+    return -1;
+  }
+  if (rc == 0)
+    cr_l2fill(rhnd, key, *val);
+
+  return rc;
+}
+
+int credis_getset(REDIS rhnd, const char *key, const char *set_val, char **get_val)
+{
+  const char *argv[] = {"GETSET", key, set_val};
+  int rc = cr_sendcmd(rhnd, CR_BULK, 3, argv);
+
+  cr_filteradd(rhnd, key);
+  cr_l2put(rhnd, key, rc == 0 ? set_val : NULL, 0);
+  if (rc == 0 && (*get_val = rhnd->reply.bulk) == NULL)
+    return -1;
+
+  return rc;
+}
+
+int credis_ping(REDIS rhnd) 
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "PING\r\n");
+}
+
+int credis_auth(REDIS rhnd, const char *password)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "AUTH %s\r\n", password);
+
+  /* INFO may have been refused when connecting */
+  if (rc == 0 && CR_SERVER_VERSION(rhnd) == 0)
+    cr_detectversion(rhnd);
+
+  return rc;
+}
+
+static int cr_multikeybulkcommand(REDIS rhnd, const char *cmd, int keyc, 
+                                  const char **keyv, char ***valv)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  int rc;
+
+  buf->len = 0;
+  if ((rc = cr_appendstr(buf, cmd, 0)) != 0)
+    return rc;
+  if ((rc = cr_appendstrarray(buf, keyc, keyv, 1)) != 0)
+    return rc;
+  if ((rc = cr_sendandreceive(rhnd, CR_MULTIBULK)) == 0) {
+    *valv = rhnd->reply.multibulk.bulks;
+    rc = rhnd->reply.multibulk.len;
+  }
+
+  return rc;
+}
+
+static int cr_multikeystorecommand(REDIS rhnd, const char *cmd, const char *destkey, 
+                                   int keyc, const char **keyv)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  int rc;
+
+  buf->len = 0;
   if ((rc = cr_appendstr(buf, cmd, 0)) != 0)
     return rc;
-  if ((rc = cr_appendstrarray(buf, keyc, keyv, 1)) != 0)
+  if ((rc = cr_appendstr(buf, destkey, 1)) != 0)
+    return rc;
+  if ((rc = cr_appendstrarray(buf, keyc, keyv, 1)) != 0)
+    return rc;
+
+  return cr_sendandreceive(rhnd, CR_INLINE);
+}
+
+int credis_mget(REDIS rhnd, int keyc, const char **keyv, char ***valv)
+{
+  return cr_multikeybulkcommand(rhnd, "MGET", keyc, keyv, valv);
+}
+
+int credis_setnx(REDIS rhnd, const char *key, const char *val)
+{
+  const char *argv[] = {"SETNX", key, val};
+  int rc = cr_sendcmd(rhnd, CR_INT, 3, argv);
+
+  cr_filteradd(rhnd, key);
+  cr_l2invalidate(rhnd, key);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_setex(REDIS rhnd, const char *key, int secs, const char *val)
+{
+  char ttl[16];
+  const char *argv[] = {"SETEX", key, ttl, val};
+  int rc;
+
+  cr_filteradd(rhnd, key);
+  sprintf(ttl, "%d", secs);
+  rc = cr_sendcmd(rhnd, CR_INLINE, 4, argv);
+  cr_l2put(rhnd, key, rc == 0 ? val : NULL, secs * 1000LL);
+
+  return rc;
+}
+
+int credis_psetex(REDIS rhnd, const char *key, long long msecs, const char *val)
+{
+  char ttl[24];
+  const char *argv[] = {"PSETEX", key, ttl, val};
+  int rc;
+
+  cr_filteradd(rhnd, key);
+  /* older servers get the expiry rounded up to whole seconds */
+  if (!(rhnd->caps & CREDIS_CAP_MILLISECONDS))
+    return credis_setex(rhnd, key, (int) ((msecs + 999) / 1000), val);
+
+  sprintf(ttl, "%lld", msecs);
+  rc = cr_sendcmd(rhnd, CR_INLINE, 4, argv);
+  cr_l2put(rhnd, key, rc == 0 ? val : NULL, msecs);
+
+  return rc;
+}
+
+static int cr_incr(REDIS rhnd, int incr, int decr, const char *key, int *new_val)
+{
+  int rc = 0;
+
+  cr_filteradd(rhnd, key);
+  cr_l2invalidate(rhnd, key);
+  if (incr == 1 || decr == 1)
+    rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s\r\n", 
+                            incr>0?"INCR":"DECR", key);
+  else if (incr > 1 || decr > 1)
+    rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s %d\r\n", 
+                            incr>0?"INCRBY":"DECRBY", key, incr>0?incr:decr);
+
+  if (rc == 0 && new_val != NULL)
+    *new_val = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_incr(REDIS rhnd, const char *key, int *new_val)
+{
+  return cr_incr(rhnd, 1, 0, key, new_val);
+}
+
+int credis_decr(REDIS rhnd, const char *key, int *new_val)
+{
+  return cr_incr(rhnd, 0, 1, key, new_val);
+}
+
+int credis_incrby(REDIS rhnd, const char *key, int incr_val, int *new_val)
+{
+  return cr_incr(rhnd, incr_val, 0, key, new_val);
+}
+
+int credis_decrby(REDIS rhnd, const char *key, int decr_val, int *new_val)
+{
+  return cr_incr(rhnd, 0, decr_val, key, new_val);
+}
+
+int credis_append(REDIS rhnd, const char *key, const char *val)
+{
+  const char *argv[] = {"APPEND", key, val};
+  int rc = cr_sendcmd(rhnd, CR_INT, 3, argv);
+                            
+  cr_filteradd(rhnd, key);
+  cr_l2invalidate(rhnd, key);
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;                            
+}
+
+int credis_substr(REDIS rhnd, const char *key, int start, int end, char **substr)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_BULK, "SUBSTR %s %d %d\r\n", 
+                              key, start, end);
+
+  if (rc == 0 && substr) 
+    *substr = rhnd->reply.bulk;
+
+  return rc;                            
+}
+
+int credis_exists(REDIS rhnd, const char *key)
+{
+  int rc;
+
+  if (!cr_filtercheck(rhnd, key))
+    return -1;
+
+  rc = cr_sendfandreceive(rhnd, CR_INT, "EXISTS %s\r\n", key);
+
+  if (rc == 0 && rhnd->reply.integer == 0) {
+    cr_filtermiss(rhnd);
+    rc = -1;
+  }
+
+  return rc;
+}
+
+int credis_del(REDIS rhnd, const char *key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "DEL %s\r\n", key);
+
+  cr_l2invalidate(rhnd, key);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+/* Returns type of value as replied by TYPE, refer to CREDIS_TYPE_* defines */
+static int cr_parsetype(const char *type)
+{
+  if (!strcmp("string", type))
+    return CREDIS_TYPE_STRING;
+  else if (!strcmp("list", type))
+    return CREDIS_TYPE_LIST;
+  else if (!strcmp("set", type))
+    return CREDIS_TYPE_SET;
+  else if (!strcmp("zset", type))
+    return CREDIS_TYPE_ZSET;
+  else if (!strcmp("hash", type))
+    return CREDIS_TYPE_HASH;
+  else if (!strcmp("stream", type))
+    return CREDIS_TYPE_STREAM;
+  else if (!strcmp("none", type))
+    return CREDIS_TYPE_NONE;
+  return CREDIS_TYPE_MODULE;
+}
+
+int credis_type(REDIS rhnd, const char *key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "TYPE %s\r\n", key);
+
+  if (rc == 0)
+    rc = cr_parsetype(rhnd->reply.line);
+
+  return rc;
+}
+
+int credis_keys(REDIS rhnd, const char *pattern, char ***keyv)
+{
+  int rc;
+
+  if (rhnd->caps & CREDIS_CAP_KEYSMULTIBULK) {
+    if ((rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "KEYS %s\r\n", pattern)) == 0) {
+      *keyv = rhnd->reply.multibulk.bulks;
+      rc = rhnd->reply.multibulk.len;
+    }
+    return rc;
+  }
+
+  if ((rc = cr_sendfandreceive(rhnd, CR_BULK, "KEYS %s\r\n", pattern)) == 0) {
+    /* server returns keys as space-separated strings, use multi-bulk 
+     * storage to store keys */
+    if ((rc = cr_splitstrtromultibulk(rhnd, rhnd->reply.bulk, ' ')) == 0) {
+      *keyv = rhnd->reply.multibulk.bulks;
+      rc = rhnd->reply.multibulk.len;
+    }
+  }
+
+  return rc;
+}
+
+int credis_randomkey(REDIS rhnd, char **key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "RANDOMKEY\r\n");
+
+  if (rc == 0 && key) 
+    *key = rhnd->reply.line;
+
+  return rc;
+}
+
+int credis_rename(REDIS rhnd, const char *key, const char *new_key_name)
+{
+  cr_filteradd(rhnd, new_key_name);
+  cr_l2invalidate(rhnd, key);
+  cr_l2invalidate(rhnd, new_key_name);
+  return cr_sendfandreceive(rhnd, CR_INLINE, "RENAME %s %s\r\n", 
+                            key, new_key_name);
+}
+
+int credis_renamenx(REDIS rhnd, const char *key, const char *new_key_name)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "RENAMENX %s %s\r\n", 
+                              key, new_key_name);
+
+  cr_filteradd(rhnd, new_key_name);
+  cr_l2invalidate(rhnd, key);
+  cr_l2invalidate(rhnd, new_key_name);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_dbsize(REDIS rhnd)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "DBSIZE\r\n");
+
+  if (rc == 0) 
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_expire(REDIS rhnd, const char *key, int secs)
+{ 
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "EXPIRE %s %d\r\n", key, secs);
+
+  cr_l2invalidate(rhnd, key);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_ttl(REDIS rhnd, const char *key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "TTL %s\r\n", key);
+
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+/* Redis >= 2.0 replies with length of list instead of status code */
+static int cr_push(REDIS rhnd, int left, const char *key, const char *val)
+{
+  const char *argv[] = {left==1?"LPUSH":"RPUSH", key, val};
+  int rc = cr_sendcmd(rhnd, CR_ANY, 3, argv);
+
+  cr_filteradd(rhnd, key);
+  if (rc == 0 && rhnd->reply.type != CR_INLINE && rhnd->reply.type != CR_INT)
+    rc = CREDIS_ERR_PROTOCOL;
+
+  return rc;
+}
+
+int credis_rpush(REDIS rhnd, const char *key, const char *val)
+{
+  return cr_push(rhnd, 0, key, val);
+}
+
+int credis_lpush(REDIS rhnd, const char *key, const char *val)
+{
+  return cr_push(rhnd, 1, key, val);
+}
+
+int credis_rpushv(REDIS rhnd, const char *key, int elemc, const char **elemv)
+{
+  cr_filteradd(rhnd, key);
+  return cr_variadic(rhnd, "RPUSH", key, elemc, NULL, elemv, 0);
+}
+
+int credis_lpushv(REDIS rhnd, const char *key, int elemc, const char **elemv)
+{
+  cr_filteradd(rhnd, key);
+  return cr_variadic(rhnd, "LPUSH", key, elemc, NULL, elemv, 0);
+}
+
+int credis_llen(REDIS rhnd, const char *key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "LLEN %s\r\n", key);
+
+  if (rc == 0) 
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_lrange(REDIS rhnd, const char *key, int start, int end, char ***valv)
+{
+  int rc;
+
+  if ((rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "LRANGE %s %d %d\r\n", 
+                               key, start, end)) == 0) {
+    *valv = rhnd->reply.multibulk.bulks;
+    rc = rhnd->reply.multibulk.len;
+  }
+
+  return rc;
+}
+
+static int cr_lrangenumbers(REDIS rhnd, const char *key, int start, int end, 
+                            long long *longv, double *doublev, int size)
+{
+  int rc;
+
+  rhnd->buf.len = 0;
+  if ((rc = cr_appendstrf(&(rhnd->buf), "LRANGE %s %d %d\r\n", key, start, end)) != 0 ||
+      (rc = cr_send(rhnd)) != 0)
+    return rc;
+
+  return cr_receivenumbers(rhnd, longv, doublev, size);
+}
+
+int credis_lrange_int64(REDIS rhnd, const char *key, int start, int end, 
+                        long long *valv, int size)
+{
+  return cr_lrangenumbers(rhnd, key, start, end, valv, NULL, size);
+}
+
+int credis_lrange_double(REDIS rhnd, const char *key, int start, int end, 
+                         double *valv, int size)
+{
+  return cr_lrangenumbers(rhnd, key, start, end, NULL, valv, size);
+}
+
+int credis_ltrim(REDIS rhnd, const char *key, int start, int end)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "LTRIM %s %d %d\r\n", 
+                            key, start, end);
+}
+
+int credis_lindex(REDIS rhnd, const char *key, int index, char **val)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_BULK, "LINDEX %s %d\r\n", key, index);
+
+  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL)
+    return -1;
+
+  return rc;
+}
+
+int credis_lset(REDIS rhnd, const char *key, int index, const char *val)
+{
+  char idx[16];
+  const char *argv[] = {"LSET", key, idx, val};
+
+  sprintf(idx, "%d", index);
+  return cr_sendcmd(rhnd, CR_INLINE, 4, argv);
+}
+
+int credis_lrem(REDIS rhnd, const char *key, int count, const char *val)
+{
+  char cnt[16];
+  const char *argv[] = {"LREM", key, cnt, val};
+
+  sprintf(cnt, "%d", count);
+  return cr_sendcmd(rhnd, CR_INT, 4, argv);
+}
+
+static int cr_pop(REDIS rhnd, int left, const char *key, char **val)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_BULK, "%s %s\r\n", 
+                              left==1?"LPOP":"RPOP", key);
+
+  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL)
+    return -1;
+
+  return rc;
+}
+
+int credis_lpop(REDIS rhnd, const char *key, char **val)
+{
+  return cr_pop(rhnd, 1, key, val);
+}
+
+int credis_rpop(REDIS rhnd, const char *key, char **val)
+{
+  return cr_pop(rhnd, 0, key, val);
+}
+
+int credis_select(REDIS rhnd, int index)
+{
+  int rc;
+
+  cr_filterinvalidate(rhnd);
+  /* cache holds keys of database 0 */
+  if (rhnd->l2 != NULL)
+    rhnd->l2->active = index == 0;
+  rc = cr_sendfandreceive(rhnd, CR_INLINE, "SELECT %d\r\n", index);
+  if (rc == 0)
+    rhnd->db = index;
+
+  return rc;
+}
+
+int credis_move(REDIS rhnd, const char *key, int index)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "MOVE %s %d\r\n", key, index);
+
+  cr_l2invalidate(rhnd, key);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_flushdb(REDIS rhnd)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "FLUSHDB\r\n");
+
+  if (rc == 0) {
+    cr_filterclear(rhnd);
+    cr_l2clear(rhnd);
+  }
+
+  return rc;
+}
+
+int credis_flushall(REDIS rhnd)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "FLUSHALL\r\n");
+
+  if (rc == 0) {
+    cr_filterclear(rhnd);
+    cr_l2clear(rhnd);
+  }
+
+  return rc;
+}
+
+int credis_sort(REDIS rhnd, const char *query, char ***elementv)
+{
+  int rc;
+
+  if ((rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "SORT %s\r\n", query)) == 0) {
+    *elementv = rhnd->reply.multibulk.bulks;
+    rc = rhnd->reply.multibulk.len;
+  }
+
+  return rc;
+}
+
+int credis_save(REDIS rhnd)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "SAVE\r\n");
+}
+
+int credis_bgsave(REDIS rhnd)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "BGSAVE\r\n");
+}
+
+int credis_lastsave(REDIS rhnd)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "LASTSAVE\r\n");
+
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_shutdown(REDIS rhnd)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "SHUTDOWN\r\n");
+}
+
+int credis_bgrewriteaof(REDIS rhnd)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "BGREWRITEAOF\r\n");
+}
+
+/* Parse Redis `info' string for a particular `field', storing its value to 
+ * `storage' according to `format'.
+ */
+void cr_parseinfo(const char *info, const char *field, const char *format, void *storage)
+{
+  char *str = strstr(info, field);
+  if (str) {
+    str += strlen(field) + 1; /* also skip the ':' */
+    sscanf(str, format, storage); 
+  }
+}
+
+int credis_info(REDIS rhnd, REDIS_INFO *info)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_BULK, "INFO\r\n");
+
+  if (rc == 0) {
+    char role;
+    memset(info, 0, sizeof(REDIS_INFO));
+    cr_parseinfo(rhnd->reply.bulk, "redis_version", "%"CR_VERSION_STRING_SIZE_STR"s\r\n", &(info->redis_version));
+    cr_parseinfo(rhnd->reply.bulk, "arch_bits", "%d", &(info->arch_bits));
+    cr_parseinfo(rhnd->reply.bulk, "multiplexing_api", "%"CR_MULTIPLEXING_API_SIZE_STR"s\r\n", &(info->multiplexing_api));
+    cr_parseinfo(rhnd->reply.bulk, "process_id", "%ld", &(info->process_id));
+    cr_parseinfo(rhnd->reply.bulk, "uptime_in_seconds", "%ld", &(info->uptime_in_seconds));
+    cr_parseinfo(rhnd->reply.bulk, "uptime_in_days", "%ld", &(info->uptime_in_days));
+    cr_parseinfo(rhnd->reply.bulk, "connected_clients", "%d", &(info->connected_clients));
+    cr_parseinfo(rhnd->reply.bulk, "connected_slaves", "%d", &(info->connected_slaves));
+    cr_parseinfo(rhnd->reply.bulk, "blocked_clients", "%d", &(info->blocked_clients));
+    cr_parseinfo(rhnd->reply.bulk, "used_memory", "%zu", &(info->used_memory));
+    cr_parseinfo(rhnd->reply.bulk, "used_memory_human", "%"CR_USED_MEMORY_HUMAN_SIZE_STR"s", &(info->used_memory_human));
+    cr_parseinfo(rhnd->reply.bulk, "changes_since_last_save", "%lld", &(info->changes_since_last_save));
+    cr_parseinfo(rhnd->reply.bulk, "bgsave_in_progress", "%d", &(info->bgsave_in_progress));
+    cr_parseinfo(rhnd->reply.bulk, "last_save_time", "%ld", &(info->last_save_time));
+    cr_parseinfo(rhnd->reply.bulk, "bgrewriteaof_in_progress", "%d", &(info->bgrewriteaof_in_progress));
+    cr_parseinfo(rhnd->reply.bulk, "total_connections_received", "%lld", &(info->total_connections_received));
+    cr_parseinfo(rhnd->reply.bulk, "total_commands_processed", "%lld", &(info->total_commands_processed));
+    cr_parseinfo(rhnd->reply.bulk, "expired_keys", "%lld", &(info->expired_keys));
+    cr_parseinfo(rhnd->reply.bulk, "hash_max_zipmap_entries", "%zu", &(info->hash_max_zipmap_entries));
+    cr_parseinfo(rhnd->reply.bulk, "hash_max_zipmap_value", "%zu", &(info->hash_max_zipmap_value));
+    cr_parseinfo(rhnd->reply.bulk, "pubsub_channels", "%ld", &(info->pubsub_channels));
+    cr_parseinfo(rhnd->reply.bulk, "pubsub_patterns", "%u", &(info->pubsub_patterns));
+    cr_parseinfo(rhnd->reply.bulk, "vm_enabled", "%d", &(info->vm_enabled));
+    cr_parseinfo(rhnd->reply.bulk, "role", "%c", &role);
+
+    info->role = ((role=='m')?CREDIS_SERVER_MASTER:CREDIS_SERVER_SLAVE);
+  }
+  
+  return rc;
+}
+
+int credis_monitor(REDIS rhnd)
+{
+  return cr_sendfandreceive(rhnd, CR_INLINE, "MONITOR\r\n");
+}
+
+int credis_slaveof(REDIS rhnd, const char *host, int port)
+{
+  if (host == NULL || port == 0)
+    return cr_sendfandreceive(rhnd, CR_INLINE, "SLAVEOF no one\r\n");
+  else
+    return cr_sendfandreceive(rhnd, CR_INLINE, "SLAVEOF %s %d\r\n", host, port);
+}
+
+/* Acknowledges replication offset `offset' to master. A separate buffer
+ * is used since the common buffer may hold not yet parsed stream data. */
+static int cr_syncack(REDIS rhnd, long long offset)
+{
+  char ack[64], num[24];
+  int len;
+
+  len = snprintf(num, sizeof(num), "%lld", offset);
+  len = snprintf(ack, sizeof(ack), "*3\r\n$8\r\nREPLCONF\r\n$3\r\nACK\r\n$%d\r\n%s\r\n", 
+                 len, num);
+
+  if (cr_senddata(rhnd, ack, len) != len)
+    return CREDIS_ERR_SEND;
+
+  return 0;
+}
+
+/* Receives the snapshot that master transfers initially and passes it on
+ * to `rdbcb' in chunks, as it arrives. The transfer is either preceded by 
+ * its length or, for disk-less transfers, terminated with an end mark. */
+static int cr_syncrdb(REDIS rhnd, REDIS_RDB_CALLBACK rdbcb, void *arg)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  char *line, eofmark[CR_SYNC_EOFMARK_SIZE];
+  long long remaining = 0;
+  int rc, avail, usemark = 0;
+
+  if ((rc = cr_readln(rhnd, 0, &line, NULL)) <= 0)
+    return CREDIS_ERR_RECV;
+
+  /* master sends newlines to keep the link alive while snapshot is saved */
+  while (*line == '\n')
+    line++;
+
+  if (*(line++) != CR_BULK)
+    return CREDIS_ERR_PROTOCOL;
+
+  if (strncmp(line, "EOF:", 4) == 0) {
+    if (strlen(line + 4) != CR_SYNC_EOFMARK_SIZE)
+      return CREDIS_ERR_PROTOCOL;
+    memcpy(eofmark, line + 4, CR_SYNC_EOFMARK_SIZE);
+    usemark = 1;
+  }
+  else if ((remaining = strtoll(line, NULL, 10)) < 0)
+    return CREDIS_ERR_PROTOCOL;
+
+  cr_compactbuffer(buf);
+
+  for (;;) {
+    avail = buf->len;
+
+    if (usemark) {
+      if (avail >= CR_SYNC_EOFMARK_SIZE &&
+          !memcmp(buf->data + avail - CR_SYNC_EOFMARK_SIZE, eofmark, CR_SYNC_EOFMARK_SIZE))
+        usemark = -1;
+      /* hold back what might be the beginning of the end mark */
+      avail -= CR_SYNC_EOFMARK_SIZE;
+    }
+    else if (avail > remaining)
+      avail = remaining;
+
+    if (avail > 0) {
+      if (rdbcb != NULL && rdbcb(buf->data, avail, arg) != 0)
+        return 1;
+      remaining -= avail;
+      buf->idx = avail;
+      cr_compactbuffer(buf);
+    }
+
+    if (usemark == -1) {
+      /* nothing follows the end mark until transfer is acknowledged */
+      buf->len = 0;
+      break;
+    }
+    if (usemark == 0 && remaining <= 0)
+      break;
+
+    if (buf->size - buf->len < CR_BUFFER_WATERMARK)
+      if (cr_moremem(buf, CR_BUFFER_SIZE))
+        return CREDIS_ERR_NOMEM;
+
+    rc = cr_receivedata(rhnd, buf->data + buf->len, buf->size - buf->len);
+    if (rc > 0)
+      buf->len += rc;
+    else if (rc == -2)
+      return CREDIS_ERR_TIMEOUT;
+    else
+      return CREDIS_ERR_RECV;
+  }
+
+  return 0;
+}
+
+int credis_sync(REDIS rhnd, REDIS_RDB_CALLBACK rdbcb, REDIS_COMMAND_CALLBACK cmdcb, void *arg)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  char *line;
+  long long offset = 0;
+  int rc, psync;
+
+  /* PSYNC makes master report the replication offset of the snapshot, 
+   * which it expects to be acknowledged continuously */
+  psync = rhnd->caps & CREDIS_CAP_PSYNC;
+
+  buf->len = 0;
+  buf->idx = 0;
+  if ((rc = cr_appendstr(buf, psync ? "PSYNC ? -1\r\n" : "SYNC\r\n", 0)) != 0)
+    return rc;
+  if (cr_senddata(rhnd, buf->data, buf->len) != buf->len)
+    return CREDIS_ERR_SEND;
+  buf->len = 0;
+
+  if (psync) {
+    if (cr_readln(rhnd, 0, &line, NULL) <= 0)
+      return CREDIS_ERR_RECV;
+    while (*line == '\n')
+      line++;
+    if (*line == CR_ERROR)
+      return cr_receiveerror(rhnd, line + 1);
+    if (sscanf(line, "+FULLRESYNC %*s %lld", &offset) != 1)
+      return CREDIS_ERR_PROTOCOL;
+  }
+
+  if ((rc = cr_syncrdb(rhnd, rdbcb, arg)) != 0)
+    return rc > 0 ? 0 : rc;
+  if (psync && (rc = cr_syncack(rhnd, offset)) != 0)
+    return rc;
+
+  /* replicated commands are sent as multi-bulk requests */
+  for (;;) {
+    cr_compactbuffer(buf);
+
+    /* master is silent between commands for up to its ping period, which
+     * may exceed timeout of handle, so offset is acknowledged meanwhile */
+    while (buf->idx == buf->len && (rc = cr_readable(rhnd, rhnd->timeout)) <= 0) {
+      if (rc < 0)
+        return CREDIS_ERR_RECV;
+      if (psync && (rc = cr_syncack(rhnd, offset)) != 0)
+        return rc;
+    }
+
+    if ((rc = cr_readreply(rhnd, CR_MULTIBULK)) != 0)
+      return rc;
+    offset += buf->idx;
+
+    if (rhnd->reply.multibulk.len == 0)
+      continue;
+
+    /* master pings periodically, which is also a good time to acknowledge 
+     * the offset since master disconnects replicas that fall silent */
+    if (!strcasecmp(rhnd->reply.multibulk.bulks[0], "PING") ||
+        !strcasecmp(rhnd->reply.multibulk.bulks[0], "REPLCONF")) {
+      if ((rc = cr_syncack(rhnd, offset)) != 0)
+        return rc;
+      continue;
+    }
+
+    if (cmdcb != NULL && 
+        cmdcb(rhnd->reply.multibulk.len, rhnd->reply.multibulk.bulks, 
+              rhnd->reply.multibulk.lens, arg) != 0)
+      return 0;
+  }
+}
+
+static int cr_setaddrem(REDIS rhnd, const char *cmd, const char *key, const char *member)
+{
+  const char *argv[] = {cmd, key, member};
+  int rc = cr_sendcmd(rhnd, CR_INT, 3, argv);
+
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_sadd(REDIS rhnd, const char *key, const char *member)
+{
+  cr_filteradd(rhnd, key);
+  return cr_setaddrem(rhnd, "SADD", key, member);
+}
+
+int credis_saddv(REDIS rhnd, const char *key, int membc, const char **membv)
+{
+  cr_filteradd(rhnd, key);
+  return cr_variadic(rhnd, "SADD", key, membc, NULL, membv, 1);
+}
+
+int credis_srem(REDIS rhnd, const char *key, const char *member)
+{
+  return cr_setaddrem(rhnd, "SREM", key, member);
+}
+
+int credis_spop(REDIS rhnd, const char *key, char **member)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_BULK, "SPOP %s\r\n", key);
+
+  if (rc == 0 && (*member = rhnd->reply.bulk) == NULL)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_smove(REDIS rhnd, const char *sourcekey, const char *destkey, 
+                 const char *member)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "SMOVE %s %s %s\r\n", 
+                              sourcekey, destkey, member);
+
+  cr_filteradd(rhnd, destkey);
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_scard(REDIS rhnd, const char *key) 
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "SCARD %s\r\n", key);
+
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_sinter(REDIS rhnd, int keyc, const char **keyv, char ***members)
+{
+  return cr_multikeybulkcommand(rhnd, "SINTER", keyc, keyv, members);
+}
+
+int credis_sunion(REDIS rhnd, int keyc, const char **keyv, char ***members)
+{
+  return cr_multikeybulkcommand(rhnd, "SUNION", keyc, keyv, members);
+}
+
+int credis_sdiff(REDIS rhnd, int keyc, const char **keyv, char ***members)
+{
+  return cr_multikeybulkcommand(rhnd, "SDIFF", keyc, keyv, members);
+}
+
+int credis_sinterstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+{
+  cr_filteradd(rhnd, destkey);
+  return cr_multikeystorecommand(rhnd, "SINTERSTORE", destkey, keyc, keyv);
+}
+
+int credis_sunionstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+{
+  cr_filteradd(rhnd, destkey);
+  return cr_multikeystorecommand(rhnd, "SUNIONSTORE", destkey, keyc, keyv);
+}
+
+int credis_sdiffstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+{
+  cr_filteradd(rhnd, destkey);
+  return cr_multikeystorecommand(rhnd, "SDIFFSTORE", destkey, keyc, keyv);
+}
+
+int credis_sismember(REDIS rhnd, const char *key, const char *member)
+{
+  return cr_setaddrem(rhnd, "SISMEMBER", key, member);
+}
+
+int credis_smembers(REDIS rhnd, const char *key, char ***members)
+{
+  return cr_multikeybulkcommand(rhnd, "SMEMBERS", 1, &key, members);
+}
+
+static int cr_smembersnumbers(REDIS rhnd, const char *key, long long *longv, 
+                              double *doublev, int size)
+{
+  int rc;
+
+  rhnd->buf.len = 0;
+  if ((rc = cr_appendstrf(&(rhnd->buf), "SMEMBERS %s\r\n", key)) != 0 ||
+      (rc = cr_send(rhnd)) != 0)
+    return rc;
+
+  return cr_receivenumbers(rhnd, longv, doublev, size);
+}
+
+int credis_smembers_int64(REDIS rhnd, const char *key, long long *membv, int size)
+{
+  return cr_smembersnumbers(rhnd, key, membv, NULL, size);
+}
+
+int credis_smembers_double(REDIS rhnd, const char *key, double *membv, int size)
+{
+  return cr_smembersnumbers(rhnd, key, NULL, membv, size);
+}
+
+int credis_zadd(REDIS rhnd, const char *key, double score, const char *member)
+{
+  char scr[32];
+  const char *argv[] = {"ZADD", key, scr, member};
+  int rc;
+
+  cr_filteradd(rhnd, key);
+  snprintf(scr, sizeof(scr), "%.17g", score);
+  rc = cr_sendcmd(rhnd, CR_INT, 4, argv);
+
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+int credis_zaddv(REDIS rhnd, const char *key, int membc, const double *scorev, 
+                 const char **membv)
+{
+  cr_filteradd(rhnd, key);
+  return cr_variadic(rhnd, "ZADD", key, membc, scorev, membv, 1);
+}
+
+int credis_zrem(REDIS rhnd, const char *key, const char *member)
+{
+  const char *argv[] = {"ZREM", key, member};
+  int rc = cr_sendcmd(rhnd, CR_INT, 3, argv);
+
+  if (rc == 0 && rhnd->reply.integer == 0)
+    rc = -1;
+
+  return rc;
+}
+
+/* TODO what does Redis return if member is not member of set? */
+int credis_zincrby(REDIS rhnd, const char *key, double incr_score, const char *member, double *new_score)
+{
+  char incr[32];
+  const char *argv[] = {"ZINCRBY", key, incr, member};
+  int rc;
+
+  cr_filteradd(rhnd, key);
+  snprintf(incr, sizeof(incr), "%.17g", incr_score);
+  rc = cr_sendcmd(rhnd, CR_BULK, 4, argv);
+
+  if (rc == 0 && new_score)
+    *new_score = strtod(rhnd->reply.bulk, NULL);
+
+  return rc;
+}
+
+/* TODO what does Redis return if member is not member of set? */
+static int cr_zrank(REDIS rhnd, int reverse, const char *key, const char *member)
+{
+  const char *argv[] = {reverse==1?"ZREVRANK":"ZRANK", key, member};
+  int rc = cr_sendcmd(rhnd, CR_ANY, 3, argv);
+
+  /* Redis >= 2.0 replies with an integer */
+  if (rc == 0 && rhnd->reply.type == CR_INT)
+    rc = rhnd->reply.integer;
+  else if (rc == 0 && rhnd->reply.type == CR_BULK)
+    rc = atoi(rhnd->reply.bulk);
+  else if (rc == 0)
+    rc = CREDIS_ERR_PROTOCOL;
+
+  return rc;
+}
+
+int credis_zrank(REDIS rhnd, const char *key, const char *member)
+{
+  return cr_zrank(rhnd, 0, key, member);
+}
+
+int credis_zrevrank(REDIS rhnd, const char *key, const char *member)
+{
+  return cr_zrank(rhnd, 1, key, member);
+}
+
+int cr_zrange(REDIS rhnd, int reverse, const char *key, int start, int end, char ***elementv)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "%s %s %d %d\r\n",
+                              reverse==1?"ZREVRANGE":"ZRANGE", key, start, end);
+
+  if (rc == 0) {
+    *elementv = rhnd->reply.multibulk.bulks;
+    rc = rhnd->reply.multibulk.len;
+  }
+
+  return rc;
+}
+
+int credis_zrange(REDIS rhnd, const char *key, int start, int end, char ***elementv)
+{
+  return cr_zrange(rhnd, 0, key, start, end, elementv);
+}
+
+int credis_zrevrange(REDIS rhnd, const char *key, int start, int end, char ***elementv)
+{
+  return cr_zrange(rhnd, 1, key, start, end, elementv);
+}
+
+int credis_zcard(REDIS rhnd, const char *key)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZCARD %s\r\n", key);
+
+  if (rc == 0) {
+    if (rhnd->reply.integer == 0)
+      rc = -1;
+    else
+      rc = rhnd->reply.integer;
+  }
+
+  return rc;
+}
+
+int credis_zscore(REDIS rhnd, const char *key, const char *member, double *score)
+{
+  const char *argv[] = {"ZSCORE", key, member};
+  int rc = cr_sendcmd(rhnd, CR_BULK, 3, argv);
+
+  if (rc == 0) {
+    if (!rhnd->reply.bulk)
+      rc = -1;
+    else if (score)
+      *score = strtod(rhnd->reply.bulk, NULL);
+  }
+
+  return rc;
+}
+
+int credis_zremrangebyscore(REDIS rhnd, const char *key, double min, double max)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZREMRANGEBYSCORE %s %f %f\r\n", 
+                              key, min, max);
+
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_zremrangebyrank(REDIS rhnd, const char *key, int start, int end)
+{
+  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZREMRANGEBYRANK %s %d %d\r\n", 
+                              key, start, end);
+
+  if (rc == 0)
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+/* TODO add writev() support instead and push strings to send onto a vector of
+ * strings to send instead... */
+static int cr_zstore(REDIS rhnd, int inter, const char *destkey, int keyc, const char **keyv, 
+                     const int *weightv, REDIS_AGGREGATE aggregate)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  int rc, i;
+
+  buf->len = 0;
+  
+  if ((rc = cr_appendstrf(buf, "%s %s %d ", inter?"ZINTERSTORE":"ZUNIONSTORE", destkey, keyc)) != 0)
+    return rc;
+  if ((rc = cr_appendstrarray(buf, keyc, keyv, 0)) != 0)
+    return rc;
+  if (weightv != NULL)
+    for (i = 0; i < keyc; i++)
+      if ((rc = cr_appendstrf(buf, " %d", weightv[i])) != 0)
+        return rc;
+
+  switch (aggregate) {
+  case SUM: 
+    rc = cr_appendstr(buf, "AGGREGATE SUM", 0);
+    break;
+  case MIN:
+    rc = cr_appendstr(buf, "AGGREGATE MIN", 0);
+    break;
+  case MAX:
+    rc = cr_appendstr(buf, "AGGREGATE MAX", 0);
+    break;
+  case NONE:
+    ; /* avoiding compiler warning */
+  }
+  if (rc != 0)
+    return rc;
+
+  if ((rc = cr_appendstr(buf, "\r\n", 0)) != 0)
+    return rc;
+
+  if ((rc = cr_sendandreceive(rhnd, CR_INT)) == 0) 
+    rc = rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_zinterstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv, 
+                       const int *weightv, REDIS_AGGREGATE aggregate)
+{
+  cr_filteradd(rhnd, destkey);
+  return cr_zstore(rhnd, 1, destkey, keyc, keyv, weightv, aggregate);
+}
+
+int credis_zunionstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv, 
+                       const int *weightv, REDIS_AGGREGATE aggregate)
+{
+  cr_filteradd(rhnd, destkey);
+  return cr_zstore(rhnd, 0, destkey, keyc, keyv, weightv, aggregate);
+}
+
+/*
+ * RDB snapshot parsing
+ */
+
+#define CR_RDB_OPCODE_SLOTINFO 0xF4
+#define CR_RDB_OPCODE_FUNCTION2 0xF5
+#define CR_RDB_OPCODE_MODULE_AUX 0xF7
+#define CR_RDB_OPCODE_IDLE 0xF8
+#define CR_RDB_OPCODE_FREQ 0xF9
+#define CR_RDB_OPCODE_AUX 0xFA
+#define CR_RDB_OPCODE_RESIZEDB 0xFB
+#define CR_RDB_OPCODE_EXPIRETIME_MS 0xFC
+#define CR_RDB_OPCODE_EXPIRETIME 0xFD
+#define CR_RDB_OPCODE_SELECTDB 0xFE
+#define CR_RDB_OPCODE_EOF 0xFF
+
+#define CR_RDB_TYPE_STRING 0
+#define CR_RDB_TYPE_LIST 1
+#define CR_RDB_TYPE_SET 2
+#define CR_RDB_TYPE_ZSET 3
+#define CR_RDB_TYPE_HASH 4
+#define CR_RDB_TYPE_ZSET_2 5
+#define CR_RDB_TYPE_MODULE_2 7
+#define CR_RDB_TYPE_HASH_ZIPMAP 9
+#define CR_RDB_TYPE_LIST_ZIPLIST 10
+#define CR_RDB_TYPE_SET_INTSET 11
+#define CR_RDB_TYPE_ZSET_ZIPLIST 12
+#define CR_RDB_TYPE_HASH_ZIPLIST 13
+#define CR_RDB_TYPE_LIST_QUICKLIST 14
+#define CR_RDB_TYPE_STREAM_LISTPACKS 15
+#define CR_RDB_TYPE_HASH_LISTPACK 16
+#define CR_RDB_TYPE_ZSET_LISTPACK 17
+#define CR_RDB_TYPE_LIST_QUICKLIST_2 18
+#define CR_RDB_TYPE_STREAM_LISTPACKS_2 19
+#define CR_RDB_TYPE_SET_LISTPACK 20
+#define CR_RDB_TYPE_STREAM_LISTPACKS_3 21
+
+#define CR_RDB_ENC_INT8 0
+#define CR_RDB_ENC_INT16 1
+#define CR_RDB_ENC_INT32 2
+#define CR_RDB_ENC_LZF 3
+
+/* returned internally when a callback asks to stop parsing */
+#define CR_RDB_STOP 1
+
+#define CR_RDB_NEED(rdb, n)                             \
+  do {                                                  \
+    if ((unsigned long long) ((rdb)->end - (rdb)->p) < \
+        (unsigned long long) (n))                       \
+      return CREDIS_ERR_PROTOCOL;                       \
+  } while (0)
+
+typedef struct _cr_rdb {
+  const unsigned char *p;
+  const unsigned char *end;
+  REDIS_RDB_RECORD rec;
+  REDIS_RDB_ELEMENT_CALLBACK elemcb;
+  void *arg;
+  cr_buffer key;  /* scratch for keys that are compressed or integers */
+  cr_buffer val;  /* scratch for compressed ziplists, intsets, etc */
+  cr_buffer elem; /* scratch for compressed elements */
+} cr_rdb;
+
+/* Makes sure scratch buffer `buf' can hold at least `size' bytes. Scratch 
+ * buffers are reused for all records and only grow.
+ * Returns:
+ *   0  on success
+ *  <0  on error, i.e. more memory not available */
+static int cr_rdbscratch(cr_buffer *buf, int size)
+{
+  if (size > buf->size && cr_moremem(buf, size - buf->size))
+    return CREDIS_ERR_NOMEM;
+  return 0;
+}
+
+/* Decompresses LZF compressed data `in' of `inlen' bytes to `out' which 
+ * has room for exactly `outlen' bytes.
+ * Returns:
+ *   0  on success
+ *  <0  on error, i.e. data is corrupt */
+static int cr_lzfdecompress(const unsigned char *in, int inlen, unsigned char *out, int outlen)
+{
+  const unsigned char *ip = in, *inend = in + inlen;
+  unsigned char *op = out, *outend = out + outlen, *ref;
+  unsigned int ctrl, len;
+
+  while (ip < inend) {
+    ctrl = *ip++;
+
+    if (ctrl < (1 << 5)) { /* literal run */
+      ctrl++;
+      if (op + ctrl > outend || ip + ctrl > inend)
+        return CREDIS_ERR_PROTOCOL;
+      memcpy(op, ip, ctrl);
+      op += ctrl;
+      ip += ctrl;
+    }
+    else { /* back reference */
+      len = ctrl >> 5;
+      if (len == 7) {
+        if (ip >= inend)
+          return CREDIS_ERR_PROTOCOL;
+        len += *ip++;
+      }
+      if (ip >= inend)
+        return CREDIS_ERR_PROTOCOL;
+      ref = op - ((ctrl & 0x1f) << 8) - 1 - *ip++;
+      len += 2;
+      if (op + len > outend || ref < out)
+        return CREDIS_ERR_PROTOCOL;
+      /* regions may overlap, copy byte by byte */
+      while (len--)
+        *op++ = *ref++;
+    }
+  }
+
+  return op == outend ? 0 : CREDIS_ERR_PROTOCOL;
+}
+
+/* Loads a length, if `encoded' is not NULL it is set to 1 when the length
+ * instead describes how the string that follows is encoded. */
+static int cr_rdbloadlen(cr_rdb *rdb, unsigned long long *len, int *encoded)
+{
+  unsigned char b;
+  int i;
+
+  if (encoded)
+    *encoded = 0;
+
+  CR_RDB_NEED(rdb, 1);
+  b = *rdb->p++;
+
+  switch (b >> 6) {
+  case 0:
+    *len = b & 0x3f;
+    break;
+  case 1:
+    CR_RDB_NEED(rdb, 1);
+    *len = ((b & 0x3f) << 8) | *rdb->p++;
+    break;
+  case 2:
+    if (b != 0x80 && b != 0x81)
+      return CREDIS_ERR_PROTOCOL;
+    /* 32 or 64 bit big endian */
+    CR_RDB_NEED(rdb, b == 0x80 ? 4 : 8);
+    for (*len = 0, i = (b == 0x80 ? 4 : 8); i > 0; i--)
+      *len = (*len << 8) | *rdb->p++;
+    break;
+  default:
+    if (encoded == NULL)
+      return CREDIS_ERR_PROTOCOL;
+    *encoded = 1;
+    *len = b & 0x3f;
+  }
+
+  return 0;
+}
+
+/* Loads a little endian integer of `size' bytes. */
+static unsigned long long cr_rdbloadle(const unsigned char *p, int size)
+{
+  unsigned long long v = 0;
+
+  while (size-- > 0)
+    v = (v << 8) | p[size];
+
+  return v;
+}
+
+/* Loads a string, which either refers directly to the snapshot or, if it
+ * had to be decoded, to scratch buffer `scratch'. */
+static int cr_rdbloadstring(cr_rdb *rdb, cr_buffer *scratch, const char **str, int *len)
+{
+  unsigned long long l, clen;
+  long long v;
+  int rc, encoded;
+
+  if ((rc = cr_rdbloadlen(rdb, &l, &encoded)) != 0)
+    return rc;
+
+  if (!encoded) {
+    CR_RDB_NEED(rdb, l);
+    if (l > INT_MAX)
+      return CREDIS_ERR_PROTOCOL;
+    *str = (const char *) rdb->p;
+    *len = l;
+    rdb->p += l;
+    return 0;
+  }
+
+  switch (l) {
+  case CR_RDB_ENC_INT8:
+  case CR_RDB_ENC_INT16:
+  case CR_RDB_ENC_INT32:
+    CR_RDB_NEED(rdb, 1 << l);
+    v = cr_rdbloadle(rdb->p, 1 << l);
+    /* sign extend */
+    if (l == CR_RDB_ENC_INT8)
+      v = (signed char) v;
+    else if (l == CR_RDB_ENC_INT16)
+      v = (short) v;
+    else
+      v = (int) v;
+    rdb->p += 1 << l;
+    if ((rc = cr_rdbscratch(scratch, 24)) != 0)
+      return rc;
+    *len = snprintf(scratch->data, scratch->size, "%lld", v);
+    *str = scratch->data;
+    return 0;
+
+  case CR_RDB_ENC_LZF:
+    if ((rc = cr_rdbloadlen(rdb, &clen, NULL)) != 0 ||
+        (rc = cr_rdbloadlen(rdb, &l, NULL)) != 0)
+      return rc;
+    CR_RDB_NEED(rdb, clen);
+    if (l > INT_MAX - 1 || clen > INT_MAX)
+      return CREDIS_ERR_PROTOCOL;
+    if ((rc = cr_rdbscratch(scratch, l + 1)) != 0)
+      return rc;
+    if ((rc = cr_lzfdecompress(rdb->p, clen, (unsigned char *) scratch->data, l)) != 0)
+      return rc;
+    scratch->data[l] = '\0';
+    rdb->p += clen;
+    *str = scratch->data;
+    *len = l;
+    return 0;
+  }
+
+  return CREDIS_ERR_PROTOCOL;
+}
+
+static int cr_rdbelement(cr_rdb *rdb, const char *str, int len)
+{
+  if (rdb->elemcb != NULL && rdb->elemcb(&(rdb->rec), str, len, rdb->arg) != 0)
+    return CR_RDB_STOP;
+  return 0;
+}
+
+static int cr_rdbelementint(cr_rdb *rdb, long long v)
+{
+  char str[24];
+  int len;
+
+  if (rdb->elemcb == NULL)
+    return 0;
+  len = snprintf(str, sizeof(str), "%lld", v);
+  return cr_rdbelement(rdb, str, len);
+}
+
+/* Loads a string element of a list, set, sorted set or hash */
+static int cr_rdbloadelement(cr_rdb *rdb)
+{
+  const char *str;
+  int rc, len;
+
+  if ((rc = cr_rdbloadstring(rdb, &(rdb->elem), &str, &len)) != 0)
+    return rc;
+  return cr_rdbelement(rdb, str, len);
+}
+
+/* Loads score of sorted set member, stored as a string or as binary */
+static int cr_rdbloadscore(cr_rdb *rdb, int binary)
+{
+  union { unsigned long long u; double d; } v;
+  char str[32];
+  int len;
+
+  if (binary) {
+    CR_RDB_NEED(rdb, 8);
+    v.u = cr_rdbloadle(rdb->p, 8);
+    rdb->p += 8;
+    if (rdb->elemcb == NULL)
+      return 0;
+    len = snprintf(str, sizeof(str), "%.17g", v.d);
+    return cr_rdbelement(rdb, str, len);
+  }
+
+  CR_RDB_NEED(rdb, 1);
+  len = *rdb->p++;
+  switch (len) {
+  case 253:
+    return cr_rdbelement(rdb, "nan", 3);
+  case 254:
+    return cr_rdbelement(rdb, "inf", 3);
+  case 255:
+    return cr_rdbelement(rdb, "-inf", 4);
+  }
+  CR_RDB_NEED(rdb, len);
+  rdb->p += len;
+  return cr_rdbelement(rdb, (const char *) rdb->p - len, len);
+}
+
+/* Walks a ziplist, passing each entry on as an element */
+static int cr_rdbziplist(cr_rdb *rdb, const unsigned char *zl, int size, long long *count)
+{
+  const unsigned char *p, *end = zl + size;
+  unsigned long long len;
+  long long v;
+  int rc, enc;
+
+  if (size < 11)
+    return CREDIS_ERR_PROTOCOL;
+
+  for (p = zl + 10; p < end && *p != 0xff; ) {
+    /* length of previous entry */
+    p += (*p == 0xfe) ? 5 : 1;
+    if (p >= end)
+      return CREDIS_ERR_PROTOCOL;
+
+    enc = *p++;
+    switch (enc >> 6) {
+    case 0:
+      len = enc & 0x3f;
+      break;
+    case 1:
+      if (p + 1 > end)
+        return CREDIS_ERR_PROTOCOL;
+      len = ((enc & 0x3f) << 8) | *p++;
+      break;
+    case 2:
+      if (p + 4 > end)
+        return CREDIS_ERR_PROTOCOL;
+      len = ((unsigned long long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      p += 4;
+      break;
+    default:
+      /* integer encodings */
+      switch (enc) {
+      case 0xc0: len = 2; break;
+      case 0xd0: len = 4; break;
+      case 0xe0: len = 8; break;
+      case 0xf0: len = 3; break;
+      case 0xfe: len = 1; break;
+      default:
+        if (enc < 0xf1 || enc > 0xfd)
+          return CREDIS_ERR_PROTOCOL;
+        len = 0; /* value is stored in the encoding itself */
+      }
+      if (p + len > end)
+        return CREDIS_ERR_PROTOCOL;
+      if (len == 0)
+        v = (enc & 0x0f) - 1;
+      else {
+        v = cr_rdbloadle(p, len);
+        /* sign extend */
+        if (len < 8)
+          v = (v ^ (1ULL << (len * 8 - 1))) - (1ULL << (len * 8 - 1));
+      }
+      p += len;
+      (*count)++;
+      if ((rc = cr_rdbelementint(rdb, v)) != 0)
+        return rc;
+      continue;
+    }
+
+    if (len > (unsigned long long) (end - p))
+      return CREDIS_ERR_PROTOCOL;
+    (*count)++;
+    if ((rc = cr_rdbelement(rdb, (const char *) p, len)) != 0)
+      return rc;
+    p += len;
+  }
+
+  return 0;
+}
+
+/* Walks a listpack, passing each entry on as an element */
+static int cr_rdblistpack(cr_rdb *rdb, const unsigned char *lp, int size, long long *count)
+{
+  const unsigned char *p, *end = lp + size;
+  unsigned long long len = 0, entry;
+  long long v = 0;
+  int rc, enc, bits;
+
+  if (size < 7)
+    return CREDIS_ERR_PROTOCOL;
+
+  for (p = lp + 6; p < end && *p != 0xff; ) {
+    enc = *p;
+    bits = 0;
+
+    if ((enc & 0x80) == 0) {        /* 7 bit unsigned integer */
+      v = enc & 0x7f;
+      entry = 1;
+    }
+    else if ((enc & 0xc0) == 0x80) { /* 6 bit string length */
+      len = enc & 0x3f;
+      entry = 1 + len;
+    }
+    else if ((enc & 0xe0) == 0xc0) { /* 13 bit signed integer */
+      bits = 13;
+      entry = 2;
+    }
+    else if ((enc & 0xf0) == 0xe0) { /* 12 bit string length */
+      if (p + 2 > end)
+        return CREDIS_ERR_PROTOCOL;
+      len = ((enc & 0x0f) << 8) | p[1];
+      entry = 2 + len;
+    }
+    else {
+      switch (enc) {
+      case 0xf0:                      /* 32 bit string length */
+        if (p + 5 > end)
+          return CREDIS_ERR_PROTOCOL;
+        len = cr_rdbloadle(p + 1, 4);
+        entry = 5 + len;
+        break;
+      case 0xf1: bits = 16; entry = 3; break;
+      case 0xf2: bits = 24; entry = 4; break;
+      case 0xf3: bits = 32; entry = 5; break;
+      case 0xf4: bits = 64; entry = 9; break;
+      default:
+        return CREDIS_ERR_PROTOCOL;
+      }
+    }
+
+    if (entry > (unsigned long long) (end - p))
+      return CREDIS_ERR_PROTOCOL;
+
+    (*count)++;
+    if (bits == 13) {
+      v = ((enc & 0x1f) << 8) | p[1];
+      if (v >= (1 << 12))
+        v -= 1 << 13;
+      rc = cr_rdbelementint(rdb, v);
+    }
+    else if (bits > 0) {
+      v = cr_rdbloadle(p + 1, bits / 8);
+      if (bits < 64)
+        v = (v ^ (1ULL << (bits - 1))) - (1ULL << (bits - 1));
+      rc = cr_rdbelementint(rdb, v);
+    }
+    else if ((enc & 0x80) == 0)
+      rc = cr_rdbelementint(rdb, v);
+    else
+      rc = cr_rdbelement(rdb, (const char *) p + (entry - len), len);
+    if (rc != 0)
+      return rc;
+
+    /* skip entry and the back-length that follows it */
+    p += entry;
+    p += entry <= 127 ? 1 : entry < 16383 ? 2 : entry < 2097151 ? 3 : entry < 268435455 ? 4 : 5;
+  }
+
+  return 0;
+}
+
+/* Walks an intset, passing each integer on as an element */
+static int cr_rdbintset(cr_rdb *rdb, const unsigned char *is, int size, long long *count)
+{
+  unsigned int enc, len, i;
+  long long v;
+  int rc;
+
+  if (size < 8)
+    return CREDIS_ERR_PROTOCOL;
+
+  enc = cr_rdbloadle(is, 4);
+  len = cr_rdbloadle(is + 4, 4);
+  if ((enc != 2 && enc != 4 && enc != 8) || 
+      (unsigned long long) len * enc > (unsigned long long) size - 8)
+    return CREDIS_ERR_PROTOCOL;
+
+  for (i = 0; i < len; i++) {
+    v = cr_rdbloadle(is + 8 + i * enc, enc);
+    if (enc == 2)
+      v = (short) v;
+    else if (enc == 4)
+      v = (int) v;
+    (*count)++;
+    if ((rc = cr_rdbelementint(rdb, v)) != 0)
+      return rc;
+  }
+
+  return 0;
+}
+
+/* Walks a zipmap, passing each field and value on as elements */
+static int cr_rdbzipmap(cr_rdb *rdb, const unsigned char *zm, int size, long long *count)
+{
+  const unsigned char *p = zm + 1, *end = zm + size;
+  unsigned long long len;
+  int rc, value = 0;
+
+  while (p < end && *p != 0xff) {
+    if (*p == 254) {
+      if (p + 5 > end)
+        return CREDIS_ERR_PROTOCOL;
+      len = cr_rdbloadle(p + 1, 4);
+      p += 5;
+    }
+    else
+      len = *p++;
+
+    /* values are followed by the number of free bytes after them */
+    if (value && p++ >= end)
+      return CREDIS_ERR_PROTOCOL;
+    if (len > (unsigned long long) (end - p))
+      return CREDIS_ERR_PROTOCOL;
+
+    (*count)++;
+    if ((rc = cr_rdbelement(rdb, (const char *) p, len)) != 0)
+      return rc;
+    p += len;
+    if (value)
+      p += p[-len - 1];
+    value = !value;
+  }
+
+  return 0;
+}
+
+/* Skips a module value which is stored as a sequence of typed opcodes */
+static int cr_rdbskipmodule(cr_rdb *rdb)
+{
+  unsigned long long opcode, v;
+  const char *str;
+  int rc, len;
+
+  for (;;) {
+    if ((rc = cr_rdbloadlen(rdb, &opcode, NULL)) != 0)
+      return rc;
+
+    switch (opcode) {
+    case 0: /* EOF */
+      return 0;
+    case 1: /* signed integer */
+    case 2: /* unsigned integer */
+      if ((rc = cr_rdbloadlen(rdb, &v, NULL)) != 0)
+        return rc;
+      break;
+    case 3: /* float */
+      CR_RDB_NEED(rdb, 4);
+      rdb->p += 4;
+      break;
+    case 4: /* double */
+      CR_RDB_NEED(rdb, 8);
+      rdb->p += 8;
+      break;
+    case 5: /* string */
+      if ((rc = cr_rdbloadstring(rdb, &(rdb->elem), &str, &len)) != 0)
+        return rc;
+      break;
+    default:
+      return CREDIS_ERR_PROTOCOL;
+    }
+  }
+}
+
+/* Skips a stream, only the number of entries is kept */
+static int cr_rdbstream(cr_rdb *rdb, int type)
+{
+  unsigned long long n, i, m, j, pel, v;
+  const char *str;
+  int rc, len;
+
+#define CR_RDB_LOADLEN(rdb, v) if ((rc = cr_rdbloadlen(rdb, &(v), NULL)) != 0) return rc
+#define CR_RDB_SKIPSTRING(rdb) if ((rc = cr_rdbloadstring(rdb, &((rdb)->elem), &str, &len)) != 0) return rc
+
+  /* listpacks keyed by master entry ID */
+  CR_RDB_LOADLEN(rdb, n);
+  for (i = 0; i < n; i++) {
+    CR_RDB_SKIPSTRING(rdb);
+    CR_RDB_SKIPSTRING(rdb);
+  }
+
+  /* number of entries, last ID and additional metadata */
+  CR_RDB_LOADLEN(rdb, v);
+  rdb->rec.elements = v;
+  CR_RDB_LOADLEN(rdb, v);
+  CR_RDB_LOADLEN(rdb, v);
+  if (type >= CR_RDB_TYPE_STREAM_LISTPACKS_2)
+    for (i = 0; i < 5; i++)
+      CR_RDB_LOADLEN(rdb, v);
+
+  /* consumer groups */
+  CR_RDB_LOADLEN(rdb, n);
+  for (i = 0; i < n; i++) {
+    CR_RDB_SKIPSTRING(rdb);
+    CR_RDB_LOADLEN(rdb, v);
+    CR_RDB_LOADLEN(rdb, v);
+    if (type >= CR_RDB_TYPE_STREAM_LISTPACKS_2)
+      CR_RDB_LOADLEN(rdb, v);
+
+    /* pending entries: raw ID, delivery time and delivery count */
+    CR_RDB_LOADLEN(rdb, pel);
+    for (j = 0; j < pel; j++) {
+      CR_RDB_NEED(rdb, 24);
+      rdb->p += 24;
+      CR_RDB_LOADLEN(rdb, v);
+    }
+
+    /* consumers: name, seen time, possibly active time and pending IDs */
+    CR_RDB_LOADLEN(rdb, m);
+    for (j = 0; j < m; j++) {
+      CR_RDB_SKIPSTRING(rdb);
+      CR_RDB_NEED(rdb, type >= CR_RDB_TYPE_STREAM_LISTPACKS_3 ? 16 : 8);
+      rdb->p += type >= CR_RDB_TYPE_STREAM_LISTPACKS_3 ? 16 : 8;
+      CR_RDB_LOADLEN(rdb, pel);
+      CR_RDB_NEED(rdb, pel * 16);
+      rdb->p += pel * 16;
+    }
+  }
+
+#undef CR_RDB_LOADLEN
+#undef CR_RDB_SKIPSTRING
+
+  return 0;
+}
+
+/* Loads a value of RDB object type `type', passing its elements on */
+static int cr_rdbvalue(cr_rdb *rdb, int type)
+{
+  unsigned long long n, i, container;
+  long long count = 0;
+  const char *str;
+  int rc, len;
+
+  switch (type) {
+  case CR_RDB_TYPE_STRING:
+    if ((rc = cr_rdbloadstring(rdb, &(rdb->elem), &str, &len)) != 0)
+      return rc;
+    rdb->rec.type = CREDIS_TYPE_STRING;
+    rdb->rec.elements = 1;
+    return cr_rdbelement(rdb, str, len);
+
+  case CR_RDB_TYPE_LIST:
+  case CR_RDB_TYPE_SET:
+  case CR_RDB_TYPE_ZSET:
+  case CR_RDB_TYPE_ZSET_2:
+  case CR_RDB_TYPE_HASH:
+    rdb->rec.type = (type == CR_RDB_TYPE_LIST) ? CREDIS_TYPE_LIST : 
+                    (type == CR_RDB_TYPE_SET) ? CREDIS_TYPE_SET : 
+                    (type == CR_RDB_TYPE_HASH) ? CREDIS_TYPE_HASH : CREDIS_TYPE_ZSET;
+    if ((rc = cr_rdbloadlen(rdb, &n, NULL)) != 0)
+      return rc;
+    rdb->rec.elements = n;
+    for (i = 0; i < n; i++) {
+      if ((rc = cr_rdbloadelement(rdb)) != 0)
+        return rc;
+      if (type == CR_RDB_TYPE_HASH)
+        rc = cr_rdbloadelement(rdb);
+      else if (type == CR_RDB_TYPE_ZSET || type == CR_RDB_TYPE_ZSET_2)
+        rc = cr_rdbloadscore(rdb, type == CR_RDB_TYPE_ZSET_2);
+      if (rc != 0)
+        return rc;
+    }
+    return 0;
+
+  case CR_RDB_TYPE_LIST_QUICKLIST:
+  case CR_RDB_TYPE_LIST_QUICKLIST_2:
+    rdb->rec.type = CREDIS_TYPE_LIST;
+    if ((rc = cr_rdbloadlen(rdb, &n, NULL)) != 0)
+      return rc;
+    for (i = 0; i < n; i++) {
+      container = 2; /* packed */
+      if (type == CR_RDB_TYPE_LIST_QUICKLIST_2 && 
+          (rc = cr_rdbloadlen(rdb, &container, NULL)) != 0)
+        return rc;
+      if ((rc = cr_rdbloadstring(rdb, &(rdb->val), &str, &len)) != 0)
+        return rc;
+      if (container == 1) { /* plain, a single large element */
+        count++;
+        rc = cr_rdbelement(rdb, str, len);
+      }
+      else if (type == CR_RDB_TYPE_LIST_QUICKLIST)
+        rc = cr_rdbziplist(rdb, (const unsigned char *) str, len, &count);
+      else
+        rc = cr_rdblistpack(rdb, (const unsigned char *) str, len, &count);
+      if (rc != 0)
+        return rc;
+    }
+    rdb->rec.elements = count;
+    return 0;
+
+  case CR_RDB_TYPE_HASH_ZIPMAP:
+  case CR_RDB_TYPE_LIST_ZIPLIST:
+  case CR_RDB_TYPE_SET_INTSET:
+  case CR_RDB_TYPE_ZSET_ZIPLIST:
+  case CR_RDB_TYPE_HASH_ZIPLIST:
+  case CR_RDB_TYPE_HASH_LISTPACK:
+  case CR_RDB_TYPE_ZSET_LISTPACK:
+  case CR_RDB_TYPE_SET_LISTPACK:
+    if ((rc = cr_rdbloadstring(rdb, &(rdb->val), &str, &len)) != 0)
+      return rc;
+    switch (type) {
+    case CR_RDB_TYPE_HASH_ZIPMAP:
+      rdb->rec.type = CREDIS_TYPE_HASH;
+      rc = cr_rdbzipmap(rdb, (const unsigned char *) str, len, &count);
+      count /= 2;
+      break;
+    case CR_RDB_TYPE_LIST_ZIPLIST:
+      rdb->rec.type = CREDIS_TYPE_LIST;
+      rc = cr_rdbziplist(rdb, (const unsigned char *) str, len, &count);
+      break;
+    case CR_RDB_TYPE_SET_INTSET:
+      rdb->rec.type = CREDIS_TYPE_SET;
+      rc = cr_rdbintset(rdb, (const unsigned char *) str, len, &count);
+      break;
+    case CR_RDB_TYPE_SET_LISTPACK:
+      rdb->rec.type = CREDIS_TYPE_SET;
+      rc = cr_rdblistpack(rdb, (const unsigned char *) str, len, &count);
+      break;
+    case CR_RDB_TYPE_ZSET_ZIPLIST:
+    case CR_RDB_TYPE_HASH_ZIPLIST:
+      rdb->rec.type = (type == CR_RDB_TYPE_ZSET_ZIPLIST) ? CREDIS_TYPE_ZSET : CREDIS_TYPE_HASH;
+      rc = cr_rdbziplist(rdb, (const unsigned char *) str, len, &count);
+      count /= 2;
+      break;
+    default:
+      rdb->rec.type = (type == CR_RDB_TYPE_ZSET_LISTPACK) ? CREDIS_TYPE_ZSET : CREDIS_TYPE_HASH;
+      rc = cr_rdblistpack(rdb, (const unsigned char *) str, len, &count);
+      count /= 2;
+    }
+    rdb->rec.elements = count;
+    return rc;
+
+  case CR_RDB_TYPE_STREAM_LISTPACKS:
+  case CR_RDB_TYPE_STREAM_LISTPACKS_2:
+  case CR_RDB_TYPE_STREAM_LISTPACKS_3:
+    rdb->rec.type = CREDIS_TYPE_STREAM;
+    return cr_rdbstream(rdb, type);
+
+  case CR_RDB_TYPE_MODULE_2:
+    rdb->rec.type = CREDIS_TYPE_MODULE;
+    if ((rc = cr_rdbloadlen(rdb, &n, NULL)) != 0)
+      return rc;
+    return cr_rdbskipmodule(rdb);
+  }
+
+  /* module values of the first version can not be skipped without the 
+   * module itself, other types are unknown */
+  return CREDIS_ERR;
+}
+
+long long credis_rdb_parse(const char *data, long long size, 
+                           REDIS_RDB_RECORD_CALLBACK reccb, 
+                           REDIS_RDB_ELEMENT_CALLBACK elemcb, void *arg)
+{
+  cr_rdb rdb;
+  const unsigned char *start;
+  unsigned long long v;
+  const char *str;
+  int rc = 0, type, len, version;
+
+  if (size < 9 || memcmp(data, "REDIS", 5) != 0)
+    return CREDIS_ERR_PROTOCOL;
+  version = atoi(data + 5);
+
+  memset(&rdb, 0, sizeof(rdb));
+  rdb.p = (const unsigned char *) data + 9;
+  rdb.end = (const unsigned char *) data + size;
+  rdb.elemcb = elemcb;
+  rdb.arg = arg;
+  rdb.rec.expire = -1;
+
+  while (rc == 0) {
+    if (rdb.p >= rdb.end) {
+      rc = CREDIS_ERR_PROTOCOL;
+      break;
+    }
+    type = *rdb.p++;
+
+    switch (type) {
+    case CR_RDB_OPCODE_EOF:
+      /* followed by a CRC64 checksum since version 5 */
+      if (version >= 5)
+        rdb.p += (rdb.end - rdb.p < 8) ? rdb.end - rdb.p : 8;
+      rc = -1;
+      continue;
+
+    case CR_RDB_OPCODE_SELECTDB:
+      rc = cr_rdbloadlen(&rdb, &v, NULL);
+      rdb.rec.db = v;
+      continue;
+
+    case CR_RDB_OPCODE_EXPIRETIME:
+      if (rdb.end - rdb.p < 4)
+        rc = CREDIS_ERR_PROTOCOL;
+      else {
+        rdb.rec.expire = cr_rdbloadle(rdb.p, 4) * 1000;
+        rdb.p += 4;
+      }
+      continue;
+
+    case CR_RDB_OPCODE_EXPIRETIME_MS:
+      if (rdb.end - rdb.p < 8)
+        rc = CREDIS_ERR_PROTOCOL;
+      else {
+        rdb.rec.expire = cr_rdbloadle(rdb.p, 8);
+        rdb.p += 8;
+      }
+      continue;
+
+    case CR_RDB_OPCODE_RESIZEDB:
+      if ((rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0)
+        rc = cr_rdbloadlen(&rdb, &v, NULL);
+      continue;
+
+    case CR_RDB_OPCODE_SLOTINFO:
+      if ((rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0 &&
+          (rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0)
+        rc = cr_rdbloadlen(&rdb, &v, NULL);
+      continue;
+
+    case CR_RDB_OPCODE_AUX:
+      if ((rc = cr_rdbloadstring(&rdb, &(rdb.key), &str, &len)) == 0)
+        rc = cr_rdbloadstring(&rdb, &(rdb.elem), &str, &len);
+      continue;
+
+    case CR_RDB_OPCODE_FUNCTION2:
+      rc = cr_rdbloadstring(&rdb, &(rdb.elem), &str, &len);
+      continue;
+
+    case CR_RDB_OPCODE_MODULE_AUX:
+      /* module ID, when-opcode and when, followed by module value */
+      if ((rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0 &&
+          (rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0 &&
+          (rc = cr_rdbloadlen(&rdb, &v, NULL)) == 0)
+        rc = cr_rdbskipmodule(&rdb);
+      continue;
+
+    case CR_RDB_OPCODE_IDLE:
+      rc = cr_rdbloadlen(&rdb, &v, NULL);
+      continue;
+
+    case CR_RDB_OPCODE_FREQ:
+      if (rdb.p++ >= rdb.end)
+        rc = CREDIS_ERR_PROTOCOL;
+      continue;
+    }
+
+    /* key-value pair */
+    if ((rc = cr_rdbloadstring(&rdb, &(rdb.key), &(rdb.rec.key), &(rdb.rec.keylen))) != 0)
+      break;
+    rdb.rec.encoding = type;
+    rdb.rec.elements = 0;
+    start = rdb.p;
+    if ((rc = cr_rdbvalue(&rdb, type)) != 0)
+      break;
+    rdb.rec.size = rdb.p - start;
+
+    if (reccb != NULL && reccb(&(rdb.rec), arg) != 0)
+      rc = CR_RDB_STOP;
+    rdb.rec.expire = -1;
+  }
+
+  free(rdb.key.data);
+  free(rdb.val.data);
+  free(rdb.elem.data);
+
+  /* end of snapshot or stopped by callback */
+  if (rc == -1 || rc == CR_RDB_STOP)
+    return (const char *) rdb.p - data;
+
+  return rc;
+}
+
+long long credis_rdb_file(const char *path, REDIS_RDB_RECORD_CALLBACK reccb, 
+                          REDIS_RDB_ELEMENT_CALLBACK elemcb, void *arg)
+{
+  struct stat st;
+  long long rc;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    return CREDIS_ERR;
+
+  if (fstat(fd, &st) == -1 || st.st_size == 0 ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return CREDIS_ERR;
+  }
+  close(fd);
+
+  /* snapshot is read front to back exactly once */
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  rc = credis_rdb_parse(map, st.st_size, reccb, elemcb, arg);
+
+  munmap(map, st.st_size);
+
+  return rc;
+}
+
+/*
+ * Append-only file (AOF) reading and replay
+ */
+
+#define CR_AOF_WINDOW 1024
+#define CR_AOF_INTERVAL 100000
+#define CR_AOF_ARGS 16
+
+/* Called for each command of an append-only file. `cmd' refers to the 
+ * `len' bytes of the command in the file, which can be sent as is, or is 
+ * NULL if the command was generated from a snapshot preamble. */
+typedef int (*cr_aofcallback)(void *ctx, const char *cmd, long long len, 
+                              int argc, char **argv, int *argl);
+
+typedef struct _cr_aof {
+  cr_aofcallback cb;
+  int (*unmap)(void *ctx); /* called before a file is unmapped, or NULL */
+  void *ctx;
+  char **argv;
+  int *argl;
+  int argsize;
+  cr_buffer pair;       /* first half of a field-value or member-score pair */
+  int pairlen;          /* length of first half, or -1 if none */
+  int db;               /* database of last snapshot record */
+  long long skipped;    /* snapshot records that could not be converted */
+  long long bytes;      /* bytes read */
+  int truncated;
+  int rc;               /* non-zero if callback stopped walking */
+} cr_aof;
+
+/* Makes sure there is room for at least `argc' arguments */
+static int cr_aofargs(cr_aof *aof, int argc)
+{
+  char **argv;
+  int *argl, size;
+
+  if (argc <= aof->argsize)
+    return 0;
+
+  size = argc > 2 * aof->argsize ? argc : 2 * aof->argsize;
+  if ((argv = realloc(aof->argv, size * sizeof(char *))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  aof->argv = argv;
+  if ((argl = realloc(aof->argl, size * sizeof(int))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  aof->argl = argl;
+  aof->argsize = size;
+
+  return 0;
+}
+
+/* Parses a number terminated by "\r\n" and prefixed with `prefix', at most
+ * `size' bytes from `p'.
+ * Returns:
+ *  >0  number of bytes parsed
+ *   0  more data needed
+ *  -1  on error */
+static int cr_parsenumber(const char *p, long long size, char prefix, long long *num)
+{
+  char *nl, *end;
+
+  if (size < 1)
+    return 0;
+  if (*p != prefix)
+    return -1;
+
+  /* a number never needs more than a few bytes */
+  if ((nl = cr_findnl((char *) p, size < 32 ? size : 32)) == NULL)
+    return size < 32 ? 0 : -1;
+
+  *num = strtoll(p + 1, &end, 10);
+  if (end != nl)
+    return -1;
+
+  return nl - p + 2;
+}
+
+/* Parses the multi-bulk request at `p', without copying or modifying it, 
+ * storing its arguments in `aof'. Arguments are not zero-terminated.
+ * Returns:
+ *  >0  number of bytes the request occupies
+ *   0  request is incomplete
+ *  <0  on error */
+static long long cr_aofparse(cr_aof *aof, const char *p, long long size, int *argc)
+{
+  long long n, len, used, i;
+  int rc;
+
+  if ((rc = cr_parsenumber(p, size, CR_MULTIBULK, &n)) <= 0)
+    return rc < 0 ? CREDIS_ERR_PROTOCOL : 0;
+  if (n < 1 || n > INT_MAX)
+    return CREDIS_ERR_PROTOCOL;
+  used = rc;
+  if ((rc = cr_aofargs(aof, n)) != 0)
+    return rc;
+
+  for (i = 0; i < n; i++) {
+    if ((rc = cr_parsenumber(p + used, size - used, CR_BULK, &len)) <= 0)
+      return rc < 0 ? CREDIS_ERR_PROTOCOL : 0;
+    used += rc;
+    if (len < 0 || len > INT_MAX)
+      return CREDIS_ERR_PROTOCOL;
+    if (size - used < len + 2)
+      return 0;
+    if (p[used + len] != '\r' || p[used + len + 1] != '\n')
+      return CREDIS_ERR_PROTOCOL;
+    aof->argv[i] = (char *) p + used;
+    aof->argl[i] = len;
+    used += len + 2;
+  }
+  *argc = n;
+
+  return used;
+}
+
+/* Passes on a command generated from a snapshot record */
+static int cr_aofgenerate(cr_aof *aof, int argc, const char *arg0, const char *arg1, int len1,
+                          const char *arg2, int len2, const char *arg3, int len3)
+{
+  int rc;
+
+  if ((rc = cr_aofargs(aof, 4)) != 0)
+    return rc;
+
+  aof->argv[0] = (char *) arg0;
+  aof->argl[0] = strlen(arg0);
+  aof->argv[1] = (char *) arg1;
+  aof->argl[1] = len1;
+  aof->argv[2] = (char *) arg2;
+  aof->argl[2] = len2;
+  aof->argv[3] = (char *) arg3;
+  aof->argl[3] = len3;
+
+  if ((rc = aof->cb(aof->ctx, NULL, 0, argc, aof->argv, aof->argl)) != 0) {
+    aof->rc = rc;
+    return CR_RDB_STOP;
+  }
+
+  return 0;
+}
+
+/* Converts each element of a snapshot preamble to a write command */
+static int cr_aofrdbelement(const REDIS_RDB_RECORD *rec, const char *elem, int len, void *arg)
+{
+  cr_aof *aof = arg;
+  char db[16];
+  int rc, dblen;
+
+  if (rec->db != aof->db) {
+    aof->db = rec->db;
+    dblen = snprintf(db, sizeof(db), "%d", rec->db);
+    if ((rc = cr_aofgenerate(aof, 2, "SELECT", db, dblen, NULL, 0, NULL, 0)) != 0)
+      return rc;
+  }
+
+  switch (rec->type) {
+  case CREDIS_TYPE_STRING:
+    return cr_aofgenerate(aof, 3, "SET", rec->key, rec->keylen, elem, len, NULL, 0);
+  case CREDIS_TYPE_LIST:
+    return cr_aofgenerate(aof, 3, "RPUSH", rec->key, rec->keylen, elem, len, NULL, 0);
+  case CREDIS_TYPE_SET:
+    return cr_aofgenerate(aof, 3, "SADD", rec->key, rec->keylen, elem, len, NULL, 0);
+  case CREDIS_TYPE_ZSET:
+  case CREDIS_TYPE_HASH:
+    /* elements come in pairs, keep the first until the second arrives */
+    if (aof->pairlen < 0) {
+      if ((rc = cr_rdbscratch(&(aof->pair), len)) != 0)
+        return rc;
+      memcpy(aof->pair.data, elem, len);
+      aof->pairlen = len;
+      return 0;
+    }
+    rc = aof->pairlen;
+    aof->pairlen = -1;
+    if (rec->type == CREDIS_TYPE_HASH)
+      return cr_aofgenerate(aof, 4, "HSET", rec->key, rec->keylen, 
+                            aof->pair.data, rc, elem, len);
+    return cr_aofgenerate(aof, 4, "ZADD", rec->key, rec->keylen, 
+                          elem, len, aof->pair.data, rc);
+  }
+
+  return 0;
+}
+
+static int cr_aofrdbrecord(const REDIS_RDB_RECORD *rec, void *arg)
+{
+  cr_aof *aof = arg;
+  char ms[24];
+  int len;
+
+  if (rec->type == CREDIS_TYPE_STREAM || rec->type == CREDIS_TYPE_MODULE) {
+    aof->skipped++;
+    return 0;
+  }
+
+  if (rec->expire != -1) {
+    len = snprintf(ms, sizeof(ms), "%lld", rec->expire);
+    return cr_aofgenerate(aof, 3, "PEXPIREAT", rec->key, rec->keylen, ms, len, NULL, 0);
+  }
+
+  return 0;
+}
+
+/* Walks all commands of append-only file `path', which is memory-mapped.
+ * Returns:
+ *   0  on success
+ *  <0  on error */
+static int cr_aofwalkfile(cr_aof *aof, const char *path)
+{
+  struct stat st;
+  const char *data;
+  long long off = 0, rc = 0;
+  void *map;
+  int fd, argc = 0;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    return CREDIS_ERR;
+
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return CREDIS_ERR;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return CREDIS_ERR;
+  }
+  close(fd);
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  data = map;
+
+  /* rewritten files may start with a snapshot */
+  if (st.st_size >= 5 && memcmp(data, "REDIS", 5) == 0) {
+    aof->db = 0;
+    aof->pairlen = -1;
+    if ((off = credis_rdb_parse(data, st.st_size, cr_aofrdbrecord, 
+                                cr_aofrdbelement, aof)) < 0) {
+      munmap(map, st.st_size);
+      return off;
+    }
+    aof->bytes += off;
+  }
+
+  while (off < st.st_size && aof->rc == 0) {
+    if ((rc = cr_aofparse(aof, data + off, st.st_size - off, &argc)) <= 0) {
+      /* an incomplete command at the end is left by an interrupted write */
+      if (rc == 0)
+        aof->truncated = 1;
+      break;
+    }
+    if ((aof->rc = aof->cb(aof->ctx, data + off, rc, argc, aof->argv, aof->argl)) != 0)
+      break;
+    off += rc;
+    aof->bytes += rc;
+    rc = 0;
+  }
+
+  if (aof->unmap != NULL && aof->rc == 0)
+    aof->rc = aof->unmap(aof->ctx);
+  munmap(map, st.st_size);
+
+  if (aof->rc != 0)
+    return aof->rc;
+  return rc < 0 ? rc : 0;
+}
+
+/* Walks all commands of append-only file `path'. If `path' is a directory
+ * it is expected to hold a manifest, listing a base file and incremental 
+ * files, as written by Redis >= 7.0. */
+static int cr_aofwalk(cr_aof *aof, const char *path)
+{
+  char file[1024], name[512], type;
+  struct dirent *de;
+  struct stat st;
+  FILE *manifest = NULL;
+  DIR *dir;
+  int rc = 0, pass, len;
+
+  if (stat(path, &st) == -1)
+    return CREDIS_ERR;
+  if (!S_ISDIR(st.st_mode))
+    return cr_aofwalkfile(aof, path);
+
+  if ((dir = opendir(path)) == NULL)
+    return CREDIS_ERR;
+  while ((de = readdir(dir)) != NULL) {
+    len = strlen(de->d_name);
+    if (len > 9 && !strcmp(de->d_name + len - 9, ".manifest")) {
+      snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+      manifest = fopen(file, "r");
+      break;
+    }
+  }
+  closedir(dir);
+  if (manifest == NULL)
+    return CREDIS_ERR;
+
+  /* base file first, followed by incremental files in order */
+  for (pass = 0; pass < 2 && rc == 0; pass++) {
+    rewind(manifest);
+    while (rc == 0 && fgets(file, sizeof(file), manifest) != NULL) {
+      if (sscanf(file, "file %511s seq %*d type %c", name, &type) != 2 ||
+          type != (pass == 0 ? 'b' : 'i'))
+        continue;
+      snprintf(file, sizeof(file), "%s/%s", path, name);
+      rc = cr_aofwalkfile(aof, file);
+    }
+  }
+  fclose(manifest);
+
+  return rc;
+}
+
+typedef struct _cr_aofcommands {
+  REDIS_COMMAND_CALLBACK cmdcb;
+  void *arg;
+  long long count;
+} cr_aofcommands;
+
+static int cr_aofcommand(void *ctx, const char *cmd, long long len, 
+                         int argc, char **argv, int *argl)
+{
+  cr_aofcommands *c = ctx;
+
+  (void) cmd;
+  (void) len;
+  c->count++;
+
+  return c->cmdcb(argc, argv, argl, c->arg) ? CR_RDB_STOP : 0;
+}
+
+long long credis_aof_file(const char *path, REDIS_COMMAND_CALLBACK cmdcb, void *arg)
+{
+  cr_aofcommands c;
+  cr_aof aof;
+  int rc;
+
+  memset(&aof, 0, sizeof(aof));
+  aof.cb = cr_aofcommand;
+  aof.ctx = &c;
+  c.cmdcb = cmdcb;
+  c.arg = arg;
+  c.count = 0;
+
+  rc = cr_aofwalk(&aof, path);
+
+  free(aof.argv);
+  free(aof.argl);
+  free(aof.pair.data);
+
+  return (rc < 0) ? rc : c.count;
+}
+
+typedef struct _cr_aofreplay {
+  REDIS rhnd;
+  REDIS_AOF_OPTIONS opts;
+  REDIS_AOF_STATS *stats;
+  cr_aof *aof;
+  cr_buffer out;        /* generated commands that are not yet sent */
+  const char *run;      /* commands in file that are not yet sent */
+  long long runlen;
+  int unsent;
+  int inflight;
+  int db;               /* of commands in file */
+  int selected;         /* set if a SELECT was replayed */
+  struct timeval start;
+} cr_aofreplay;
+
+/* Sends commands that are not yet sent and then reads replies until no 
+ * more than `inflight' commands remain in flight. */
+static int cr_aofflush(cr_aofreplay *r, int inflight)
+{
+  REDIS rhnd = r->rhnd;
+  int rc;
+
+  if (r->out.len > 0) {
+    cr_hotkeystrack(r->out.data, r->out.len);
+    if (cr_sendpart(rhnd, r->out.data, r->out.len, r->runlen > 0) != r->out.len)
+      return CREDIS_ERR_SEND;
+    r->out.len = 0;
+  }
+
+  /* send directly from the mapped file, in chunks since a run can be 
+   * larger than what fits in an int */
+  while (r->runlen > 0) {
+    int len = r->runlen > INT_MAX ? INT_MAX : r->runlen;
+    cr_hotkeystrack(r->run, len);
+    if (cr_sendpart(rhnd, (char *) r->run, len, r->runlen > len) != len)
+      return CREDIS_ERR_SEND;
+    r->run += len;
+    r->runlen -= len;
+  }
+
+  r->inflight += r->unsent;
+  r->stats->sent += r->unsent;
+  r->unsent = 0;
+
+  while (r->inflight > inflight) {
+    cr_compactbuffer(&(rhnd->buf));
+    if ((rc = cr_readreply(rhnd, CR_ANY)) != 0) {
+      if (rhnd->reply.type != CR_ERROR)
+        return rc;
+      r->stats->errors++;
+    }
+    r->inflight--;
+  }
+
+  return 0;
+}
+
+/* Sends what refers to a file that is about to be unmapped */
+static int cr_aofreplayunmap(void *ctx)
+{
+  cr_aofreplay *r = ctx;
+
+  return cr_aofflush(r, r->opts.window);
+}
+
+static int cr_aofreplaycommand(void *ctx, const char *cmd, long long len, 
+                               int argc, char **argv, int *argl)
+{
+  cr_aofreplay *r = ctx;
+  struct timeval now;
+  int rc, skip = 0;
+
+  r->stats->commands++;
+  r->stats->bytes = r->aof->bytes;
+
+  if (argl[0] == 6 && !strncasecmp(argv[0], "SELECT", 6) && argc == 2) {
+    r->db = atoi(argv[1]);
+    r->selected = 1;
+  }
+  else if (r->opts.dbfilter && r->db != r->opts.db)
+    skip = 1;
+  else if (r->opts.pattern != NULL && argc > 1) {
+    /* first key is assumed to be the first argument */
+    char key[1024];
+    int keylen = argl[1] < (int) sizeof(key) ? argl[1] : (int) sizeof(key) - 1;
+    memcpy(key, argv[1], keylen);
+    key[keylen] = '\0';
+    skip = fnmatch(r->opts.pattern, key, 0) != 0;
+  }
+
+  if (skip) {
+    r->stats->filtered++;
+    /* send what precedes the skipped command */
+    if (r->runlen > 0 && (rc = cr_aofflush(r, r->opts.window)) != 0)
+      return rc;
+    r->run = NULL;
+    return 0;
+  }
+
+  if (cmd == NULL) {
+    if ((rc = cr_appendcmdv(&(r->out), argc, (const char **) argv, argl)) != 0)
+      return rc;
+  }
+  else {
+    if (r->out.len > 0 || (r->run != NULL && r->run + r->runlen != cmd))
+      if ((rc = cr_aofflush(r, r->opts.window)) != 0)
+        return rc;
+    if (r->runlen == 0)
+      r->run = cmd;
+    r->runlen += len;
+  }
+
+  /* keep half a window in flight while sending the other half */
+  if (++r->unsent >= r->opts.window / 2 || r->out.len > CR_BUFFER_SIZE * 16)
+    if ((rc = cr_aofflush(r, r->opts.window / 2)) != 0)
+      return rc;
+
+  if (r->opts.progress != NULL && r->stats->commands % r->opts.interval == 0) {
+    gettimeofday(&now, NULL);
+    r->stats->elapsed = (now.tv_sec - r->start.tv_sec) + 
+                        (now.tv_usec - r->start.tv_usec) / 1000000.0;
+    if (r->opts.progress(r->stats, r->opts.arg) != 0)
+      return CR_RDB_STOP;
+  }
+
+  return 0;
+}
+
+int credis_aof_replay(REDIS rhnd, const char *path, const REDIS_AOF_OPTIONS *options, 
+                      REDIS_AOF_STATS *stats)
+{
+  REDIS_AOF_STATS localstats;
+  cr_aofreplay r;
+  struct timeval now;
+  cr_aof aof;
+  int rc;
+
+  memset(&r, 0, sizeof(r));
+  memset(&aof, 0, sizeof(aof));
+  if (stats == NULL)
+    stats = &localstats;
+  memset(stats, 0, sizeof(REDIS_AOF_STATS));
+
+  if (options != NULL)
+    r.opts = *options;
+  if (r.opts.window < 2)
+    r.opts.window = CR_AOF_WINDOW;
+  if (r.opts.interval <= 0)
+    r.opts.interval = CR_AOF_INTERVAL;
+
+  r.rhnd = rhnd;
+  r.stats = stats;
+  r.aof = &aof;
+  aof.cb = cr_aofreplaycommand;
+  aof.unmap = cr_aofreplayunmap;
+  aof.ctx = &r;
+
+  rhnd->buf.len = 0;
+  rhnd->buf.idx = 0;
+  gettimeofday(&r.start, NULL);
+
+  rc = cr_aofwalk(&aof, path);
+  if (rc == 0 || rc == CR_RDB_STOP)
+    rc = cr_aofflush(&r, 0);
+  /* replayed SELECT commands switched database of connection */
+  if (rc == 0 && r.selected)
+    rc = credis_select(rhnd, rhnd->db);
+  /* replayed commands may have written any key */
+  cr_filterinvalidate(rhnd);
+  cr_l2clear(rhnd);
+
+  gettimeofday(&now, NULL);
+  stats->elapsed = (now.tv_sec - r.start.tv_sec) + (now.tv_usec - r.start.tv_usec) / 1000000.0;
+  stats->bytes = aof.bytes;
+  stats->skipped = aof.skipped;
+  stats->truncated = aof.truncated;
+
+  free(aof.argv);
+  free(aof.argl);
+  free(aof.pair.data);
+  free(r.out.data);
+
+  return rc;
+}
+
+/*
+ * Keyspace analysis
+ */
+
+#define CR_SKETCH_DEPTH 4
+#define CR_SKETCH_WIDTH 4096
+#define CR_ANALYZE_COUNT 100
+#define CR_ANALYZE_TOP 20
+#define CR_ANALYZE_PREFIXES 4096
+#define CR_ANALYZE_NAME_SIZE 24
+
+/* Count-min sketch, estimates how many times a string has been counted 
+ * using a fixed amount of memory. An estimate is never too low, and with 
+ * high probability too high by at most a small fraction of the total. */
+typedef struct _cr_sketch {
+  long long total;
+  long long counts[CR_SKETCH_DEPTH][CR_SKETCH_WIDTH];
+} cr_sketch;
+
+/* Adds `n' to the count of `str' of `len' bytes, 0 to only look it up.
+ * Returns estimated count of `str' */
+static long long cr_sketchadd(cr_sketch *s, const char *str, int len, long long n)
+{
+  unsigned long long h = cr_hash(str, len);
+  unsigned int h1 = (unsigned int) h, h2 = (unsigned int) (h >> 32) | 1;
+  long long *c, est = LLONG_MAX;
+  int i;
+
+  s->total += n;
+  for (i = 0; i < CR_SKETCH_DEPTH; i++) {
+    c = &(s->counts[i][(h1 + i * h2) & (CR_SKETCH_WIDTH - 1)]);
+    *c += n;
+    if (*c < est)
+      est = *c;
+  }
+
+  return est;
+}
+
+/* keys of one SCAN reply that are to be inspected */
+typedef struct _cr_keybatch {
+  cr_buffer names;     /* zero-terminated names */
+  int *offs;
+  int *types;
+  int len;
+  int size;
+} cr_keybatch;
+
+typedef struct _cr_analyzer {
+  REDIS rhnd;
+  char cursor[CR_ANALYZE_NAME_SIZE];
+  int scanning;
+  int keys;              /* KEYS instead of SCAN, i.e. Redis < 2.8 */
+  int memory;
+  int freq;
+  long long commands;
+  cr_keybatch batch[3];
+  cr_keybatch *inspect;  /* type is known, inspect next */
+  cr_keybatch *type;     /* get type next */
+  cr_keybatch *scan;     /* keys of next SCAN reply */
+} cr_analyzer;
+
+typedef struct _cr_analysis {
+  REDIS_ANALYZE_OPTIONS opts;
+  REDIS_ANALYZE_REPORT *report;
+  cr_analyzer *servers;
+  int serverc;
+  /* the most common prefixes, as estimated by `sketch', are kept in a 
+   * chained hash table of fixed size */
+  REDIS_ANALYZE_STAT prefixes[CR_ANALYZE_PREFIXES];
+  unsigned int hashes[CR_ANALYZE_PREFIXES];
+  int next[CR_ANALYZE_PREFIXES];
+  int buckets[CR_ANALYZE_PREFIXES * 2];
+  int len;
+  int coldest;         /* prefix with fewest keys, or -1 if not known */
+  cr_sketch sketch;
+  struct timeval start;
+} cr_analysis;
+
+static int cr_keybatchadd(cr_keybatch *b, const char *name, int len)
+{
+  int *optr, *tptr;
+
+  if (b->len == b->size) {
+    optr = realloc(b->offs, (b->size + CR_ANALYZE_COUNT) * sizeof(int));
+    if (optr != NULL)
+      b->offs = optr;
+    tptr = realloc(b->types, (b->size + CR_ANALYZE_COUNT) * sizeof(int));
+    if (tptr != NULL)
+      b->types = tptr;
+    if (optr == NULL || tptr == NULL)
+      return CREDIS_ERR_NOMEM;
+    b->size += CR_ANALYZE_COUNT;
+  }
+  if (b->names.size - b->names.len < len + 1)
+    if (cr_moremem(&(b->names), len + 1))
+      return CREDIS_ERR_NOMEM;
+
+  b->offs[b->len] = b->names.len;
+  b->types[b->len++] = CREDIS_TYPE_NONE;
+  memcpy(b->names.data + b->names.len, name, len);
+  b->names.len += len;
+  b->names.data[b->names.len++] = '\0';
+
+  return 0;
+}
+
+/* Returns length of name `i' of batch `b' */
+static int cr_keybatchlen(const cr_keybatch *b, int i)
+{
+  return (i + 1 < b->len ? b->offs[i + 1] : b->names.len) - b->offs[i] - 1;
+}
+
+/* Returns length of prefix of key `name' of `len' bytes */
+static int cr_prefixlen(cr_analysis *a, const char *name, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+    if (strchr(a->opts.delimiters, name[i]))
+      break;
+
+  return i;
+}
+
+/* Returns index of prefix `name' of `len' bytes, or -1 if it is not among 
+ * the most common ones. If `count' is not 0 a key with the prefix is 
+ * counted and the prefix is added if it is now estimated to be more common
+ * than the least common prefix kept. */
+static int cr_prefixlookup(cr_analysis *a, const char *name, int len, int count)
+{
+  REDIS_ANALYZE_STAT *s, *other = &(a->report->other);
+  unsigned int h = (unsigned int) cr_hash(name, len);
+  long long keys;
+  int i, *ip;
+
+  keys = cr_sketchadd(&(a->sketch), name, len, count ? 1 : 0);
+
+  for (i = a->buckets[h & (CR_ANALYZE_PREFIXES * 2 - 1)]; i >= 0; i = a->next[i]) {
+    s = &(a->prefixes[i]);
+    if (a->hashes[i] == h && !strncmp(s->name, name, len) && s->name[len] == '\0') {
+      s->keys = keys;
+      return i;
+    }
+  }
+  if (!count)
+    return -1;
+
+  if (a->len < CR_ANALYZE_PREFIXES)
+    i = a->len++;
+  else {
+    if (a->coldest < 0) {
+      a->coldest = 0;
+      for (i = 1; i < a->len; i++)
+        if (a->prefixes[i].keys < a->prefixes[a->coldest].keys)
+          a->coldest = i;
+    }
+    i = a->coldest;
+    s = &(a->prefixes[i]);
+    if (keys <= s->keys)
+      return -1;
+
+    /* replace least common prefix, what was learned about it is kept */
+    for (ip = &(a->buckets[a->hashes[i] & (CR_ANALYZE_PREFIXES * 2 - 1)]); 
+         *ip != i; ip = &(a->next[*ip]))
+      ;
+    *ip = a->next[i];
+    other->sampled += s->sampled;
+    other->elements += s->elements;
+    other->bytes += s->bytes;
+    other->freq += s->freq;
+    free(s->name);
+    a->coldest = -1;
+  }
+
+  s = &(a->prefixes[i]);
+  memset(s, 0, sizeof(REDIS_ANALYZE_STAT));
+  if ((s->name = malloc(len + 1)) == NULL)
+    return CREDIS_ERR_NOMEM;
+  memcpy(s->name, name, len);
+  s->name[len] = '\0';
+  s->keys = keys;
+  a->hashes[i] = h;
+  a->next[i] = a->buckets[h & (CR_ANALYZE_PREFIXES * 2 - 1)];
+  a->buckets[h & (CR_ANALYZE_PREFIXES * 2 - 1)] = i;
+
+  return i;
+}
+
+/* Keeps the `size' keys of `top' of highest `rank', sorted on rank */
+static int cr_analyzetop(REDIS_ANALYZE_KEY *top, int *len, int size, 
+                         const REDIS_ANALYZE_KEY *key, long long rank, int byfreq)
+{
+  int i;
+
+#define CR_RANK(k) (byfreq ? (k)->freq : (k)->bytes > 0 ? (k)->bytes : (k)->elements)
+  if (*len == size) {
+    if (rank <= CR_RANK(&top[size - 1]))
+      return 0;
+    free(top[--(*len)].name);
+  }
+
+  for (i = *len; i > 0 && CR_RANK(&top[i - 1]) < rank; i--)
+    top[i] = top[i - 1];
+#undef CR_RANK
+
+  top[i] = *key;
+  if ((top[i].name = strdup(key->name)) == NULL)
+    return CREDIS_ERR_NOMEM;
+  (*len)++;
+
+  return 0;
+}
+
+static const char *cr_lengthcommand[] = 
+  {NULL, NULL, "STRLEN", "LLEN", "SCARD", "ZCARD", "HLEN", "XLEN", NULL};
+
+/* Reads next reply of a pipeline. 
+ * Returns:
+ *   0  on success
+ *   1  if server replied with an error
+ *  <0  on error */
+static int cr_analyzereply(REDIS rhnd)
+{
+  int rc;
+
+  if ((rc = cr_pipelinereply(rhnd, CR_ANY)) != 0)
+    return rhnd->reply.type == CR_ERROR ? 1 : rc;
+
+  return 0;
+}
+
+/* Appends commands of the next round: inspection of keys whose type is 
+ * known, type of keys of the last SCAN reply and the next SCAN */
+static int cr_analyzesend(cr_analysis *a, cr_analyzer *s)
+{
+  cr_buffer *buf = &(s->rhnd->buf);
+  const char *argv[6];
+  int i, rc, argc;
+
+  buf->len = 0;
+  buf->idx = 0;
+
+  for (i = 0; i < s->inspect->len; i++) {
+    if (s->inspect->types[i] == CREDIS_TYPE_NONE)
+      continue;
+    argv[1] = s->inspect->names.data + s->inspect->offs[i];
+    if ((argv[0] = cr_lengthcommand[s->inspect->types[i]]) != NULL) {
+      if ((rc = cr_appendcmdv(buf, 2, argv, NULL)) != 0)
+        return rc;
+      s->commands++;
+    }
+    if (s->memory) {
+      argv[0] = "MEMORY";
+      argv[1] = "USAGE";
+      argv[2] = s->inspect->names.data + s->inspect->offs[i];
+      if ((rc = cr_appendcmdv(buf, 3, argv, NULL)) != 0)
+        return rc;
+      s->commands++;
+    }
+    if (s->freq) {
+      argv[0] = "OBJECT";
+      argv[1] = "FREQ";
+      argv[2] = s->inspect->names.data + s->inspect->offs[i];
+      if ((rc = cr_appendcmdv(buf, 3, argv, NULL)) != 0)
+        return rc;
+      s->commands++;
+    }
+  }
+
+  argv[0] = "TYPE";
+  for (i = 0; i < s->type->len; i++) {
+    argv[1] = s->type->names.data + s->type->offs[i];
+    if ((rc = cr_appendcmdv(buf, 2, argv, NULL)) != 0)
+      return rc;
+    s->commands++;
+  }
+
+  if (s->scanning && s->keys) {
+    argv[0] = "KEYS";
+    argv[1] = a->opts.pattern != NULL ? a->opts.pattern : "*";
+    if ((rc = cr_appendcmdv(buf, 2, argv, NULL)) != 0)
+      return rc;
+    s->commands++;
+  }
+  else if (s->scanning) {
+    char count[16];
+    argc = 0;
+    argv[argc++] = "SCAN";
+    argv[argc++] = s->cursor;
+    if (a->opts.pattern != NULL) {
+      argv[argc++] = "MATCH";
+      argv[argc++] = a->opts.pattern;
+    }
+    sprintf(count, "%d", a->opts.count);
+    argv[argc++] = "COUNT";
+    argv[argc++] = count;
+    if ((rc = cr_appendcmdv(buf, argc, argv, NULL)) != 0)
+      return rc;
+    s->commands++;
+  }
+
+  return 0;
+}
+
+/* Reads replies of the commands appended by cr_analyzesend() */
+static int cr_analyzereceive(cr_analysis *a, cr_analyzer *s, int server)
+{
+  REDIS rhnd = s->rhnd;
+  REDIS_ANALYZE_REPORT *report = a->report;
+  REDIS_ANALYZE_STAT *stats[3];
+  REDIS_ANALYZE_KEY key;
+  cr_multibulk *mb;
+  cr_keybatch *b;
+  int i, j, n, rc, len, freq = s->freq;
+
+  rhnd->buf.len = 0;
+  rhnd->buf.idx = 0;
+
+  for (i = 0; i < s->inspect->len; i++) {
+    if (s->inspect->types[i] == CREDIS_TYPE_NONE)
+      continue;
+    memset(&key, 0, sizeof(key));
+    key.name = s->inspect->names.data + s->inspect->offs[i];
+    key.type = s->inspect->types[i];
+    key.server = server;
+    key.freq = -1;
+    if (cr_lengthcommand[key.type] != NULL) {
+      if ((rc = cr_analyzereply(rhnd)) < 0)
+        return rc;
+      if (rc == 0 && rhnd->reply.type == CR_INT)
+        key.elements = strtoll(rhnd->reply.line, NULL, 10);
+      if (key.type == CREDIS_TYPE_STRING)
+        key.bytes = key.elements;
+    }
+    if (s->memory) {
+      if ((rc = cr_analyzereply(rhnd)) < 0)
+        return rc;
+      if (rc == 0 && rhnd->reply.type == CR_INT)
+        key.bytes = strtoll(rhnd->reply.line, NULL, 10);
+      else if (rc == 0) 
+        key.type = CREDIS_TYPE_NONE; /* removed since TYPE */
+    }
+    if (freq) {
+      if ((rc = cr_analyzereply(rhnd)) < 0)
+        return rc;
+      if (rc == 0 && rhnd->reply.type == CR_INT)
+        key.freq = rhnd->reply.integer;
+      else if (rc == 1 && strstr(rhnd->reply.line, "LFU") != NULL)
+        s->freq = 0; /* maxmemory-policy is not LFU */
+    }
+    if (key.type == CREDIS_TYPE_NONE)
+      continue;
+
+    len = strlen(key.name);
+    n = cr_prefixlookup(a, key.name, cr_prefixlen(a, key.name, len), 0);
+    stats[0] = n >= 0 ? &(a->prefixes[n]) : &(report->other);
+    stats[1] = &(report->types[key.type]);
+    stats[2] = &(report->total);
+    stats[1]->keys++;
+    for (j = 0; j < 3; j++) {
+      stats[j]->sampled++;
+      stats[j]->elements += key.elements;
+      stats[j]->bytes += key.bytes;
+      if (key.freq > 0)
+        stats[j]->freq += key.freq;
+    }
+
+    if ((rc = cr_analyzetop(report->biggest, &(report->biggestc), a->opts.top, &key, 
+                            key.bytes > 0 ? key.bytes : key.elements, 0)) != 0)
+      return rc;
+    if (key.freq > 0 && 
+        (rc = cr_analyzetop(report->hottest, &(report->hottestc), a->opts.top, &key, 
+                            key.freq, 1)) != 0)
+      return rc;
+  }
+
+  for (i = 0; i < s->type->len; i++) {
+    if ((rc = cr_analyzereply(rhnd)) < 0)
+      return rc;
+    if (rc == 0 && rhnd->reply.type == CR_INLINE)
+      s->type->types[i] = cr_parsetype(rhnd->reply.line);
+  }
+
+  b = s->scan;
+  b->len = 0;
+  b->names.len = 0;
+  if (s->scanning) {
+    if ((rc = cr_analyzereply(rhnd)) != 0)
+      return rc < 0 ? rc : CREDIS_ERR_PROTOCOL;
+    mb = &(rhnd->reply.multibulk);
+    if (rhnd->reply.type != CR_MULTIBULK)
+      return CREDIS_ERR_PROTOCOL;
+    if (s->keys) {
+      s->scanning = 0;
+      i = 0;
+    }
+    else {
+      if (mb->len < 2 || mb->types[1] != CR_MULTIBULK || mb->lens[0] >= CR_ANALYZE_NAME_SIZE)
+        return CREDIS_ERR_PROTOCOL;
+      memcpy(s->cursor, mb->bulks[0], mb->lens[0] + 1);
+      s->scanning = strcmp(s->cursor, "0") != 0;
+      i = 2;
+    }
+
+    for (; i < mb->len; i++) {
+      report->total.keys++;
+      len = cr_prefixlen(a, mb->bulks[i], mb->lens[i]);
+      if ((n = cr_prefixlookup(a, mb->bulks[i], len, 1)) < -1)
+        return n;
+      if (a->opts.sample > 1 && cr_hash(mb->bulks[i], mb->lens[i]) % a->opts.sample != 0)
+        continue;
+      if ((rc = cr_keybatchadd(b, mb->bulks[i], mb->lens[i])) != 0)
+        return rc;
+    }
+  }
+
+  /* keys of this SCAN reply get their type next round and are inspected 
+   * the round after that */
+  b = s->inspect;
+  b->len = 0;
+  b->names.len = 0;
+  s->inspect = s->type;
+  s->type = s->scan;
+  s->scan = b;
+
+  return 0;
+}
+
+/* Sleeps until `done' operations are due, at a rate of `rate' operations 
+ * per second since `start'. Does nothing if `rate' is 0. */
+static void cr_pace(const struct timeval *start, long long done, int rate)
+{
+  struct timeval now, tv;
+  long long usecs;
+
+  if (rate <= 0)
+    return;
+
+  gettimeofday(&now, NULL);
+  usecs = done * 1000000 / rate - 
+    ((now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_usec - start->tv_usec));
+  if (usecs > 0) {
+    tv.tv_sec = usecs / 1000000;
+    tv.tv_usec = usecs % 1000000;
+    select(0, NULL, NULL, NULL, &tv);
+  }
+}
+
+/* Waits so that no server gets more than `budget' commands per second */
+static void cr_analyzethrottle(cr_analysis *a)
+{
+  long long commands = 0;
+  int i;
+
+  for (i = 0; i < a->serverc; i++)
+    if (a->servers[i].commands > commands)
+      commands = a->servers[i].commands;
+
+  cr_pace(&(a->start), commands, a->opts.budget);
+}
+
+static int cr_comparestat(const void *a, const void *b)
+{
+  const REDIS_ANALYZE_STAT *sa = a, *sb = b;
+
+  if (sa->bytes != sb->bytes)
+    return sa->bytes < sb->bytes ? 1 : -1;
+  if (sa->keys != sb->keys)
+    return sa->keys < sb->keys ? 1 : -1;
+  return 0;
+}
+
+static int cr_analyze(cr_analysis *a, REDIS *rhndv, int rhndc)
+{
+  REDIS_ANALYZE_REPORT *report = a->report;
+  cr_analyzer *s;
+  int i, rc, active;
+
+  for (i = 0; i < rhndc; i++) {
+    s = &(a->servers[i]);
+    s->rhnd = rhndv[i];
+    if (!(s->rhnd->caps & (CREDIS_CAP_SCAN | CREDIS_CAP_KEYSMULTIBULK)))
+      return CREDIS_ERR; /* neither SCAN nor KEYS replying multi-bulk */
+    strcpy(s->cursor, "0");
+    s->scanning = 1;
+    s->keys = !(s->rhnd->caps & CREDIS_CAP_SCAN);
+    s->memory = a->opts.memory && (s->rhnd->caps & CREDIS_CAP_MEMORY);
+    s->freq = a->opts.frequency && (s->rhnd->caps & CREDIS_CAP_MEMORY);
+    s->inspect = &(s->batch[0]);
+    s->type = &(s->batch[1]);
+    s->scan = &(s->batch[2]);
+  }
+
+  /* all servers get their commands before any replies are read, so they 
+   * work on them in parallel */
+  do {
+    cr_analyzethrottle(a);
+
+    for (i = 0, active = 0; i < rhndc; i++) {
+      s = &(a->servers[i]);
+      if (!s->scanning && s->inspect->len == 0 && s->type->len == 0)
+        continue;
+      if ((rc = cr_analyzesend(a, s)) != 0)
+        return rc;
+      if (cr_senddata(s->rhnd, s->rhnd->buf.data, 
+                      s->rhnd->buf.len) != s->rhnd->buf.len)
+        return CREDIS_ERR_SEND;
+      active++;
+    }
+
+    for (i = 0; i < rhndc; i++) {
+      s = &(a->servers[i]);
+      if (!s->scanning && s->inspect->len == 0 && s->type->len == 0)
+        continue;
+      if ((rc = cr_analyzereceive(a, s, i)) != 0)
+        return rc;
+    }
+  } while (active > 0);
+
+  for (i = 0; i < rhndc; i++)
+    report->commands += a->servers[i].commands;
+
+  if ((report->prefixes = malloc((a->len + 1) * sizeof(REDIS_ANALYZE_STAT))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  report->other.keys = report->total.keys;
+  for (i = 0; i < a->len; i++) {
+    report->prefixes[i] = a->prefixes[i];
+    report->other.keys -= a->prefixes[i].keys;
+    a->prefixes[i].name = NULL;
+  }
+  if (report->other.keys < 0)
+    report->other.keys = 0;
+  report->prefixc = a->len;
+  qsort(report->prefixes, report->prefixc, sizeof(REDIS_ANALYZE_STAT), cr_comparestat);
+
+  return 0;
+}
+
+int credis_analyze(REDIS *rhndv, int rhndc, const REDIS_ANALYZE_OPTIONS *options,
+                   REDIS_ANALYZE_REPORT *report)
+{
+  cr_analysis *a;
+  struct timeval now;
+  int i, j, rc;
+
+  memset(report, 0, sizeof(REDIS_ANALYZE_REPORT));
+
+  if (rhndv == NULL || rhndc <= 0)
+    return -EINVAL;
+  if ((a = calloc(1, sizeof(cr_analysis))) == NULL)
+    return CREDIS_ERR_NOMEM;
+
+  if (options != NULL)
+    a->opts = *options;
+  if (a->opts.count <= 0)
+    a->opts.count = CR_ANALYZE_COUNT;
+  if (a->opts.top <= 0)
+    a->opts.top = CR_ANALYZE_TOP;
+  if (a->opts.delimiters == NULL)
+    a->opts.delimiters = ":";
+  for (i = 0; i < CR_ANALYZE_PREFIXES * 2; i++)
+    a->buckets[i] = -1;
+  a->coldest = -1;
+  a->report = report;
+  a->serverc = rhndc;
+  gettimeofday(&(a->start), NULL);
+
+  if ((a->servers = calloc(rhndc, sizeof(cr_analyzer))) == NULL ||
+      (report->biggest = calloc(a->opts.top, sizeof(REDIS_ANALYZE_KEY))) == NULL ||
+      (report->hottest = calloc(a->opts.top, sizeof(REDIS_ANALYZE_KEY))) == NULL)
+    rc = CREDIS_ERR_NOMEM;
+  else
+    rc = cr_analyze(a, rhndv, rhndc);
+
+  gettimeofday(&now, NULL);
+  report->elapsed = (now.tv_sec - a->start.tv_sec) + 
+                    (now.tv_usec - a->start.tv_usec) / 1000000.0;
+
+  for (i = 0; i < a->len; i++)
+    free(a->prefixes[i].name);
+  for (i = 0; a->servers != NULL && i < rhndc; i++) {
+    for (j = 0; j < 3; j++) {
+      free(a->servers[i].batch[j].names.data);
+      free(a->servers[i].batch[j].offs);
+      free(a->servers[i].batch[j].types);
+    }
+  }
+  free(a->servers);
+  free(a);
+
+  if (rc != 0)
+    credis_analyze_free(report);
+
+  return rc;
+}
+
+void credis_analyze_free(REDIS_ANALYZE_REPORT *report)
+{
+  int i;
+
+  for (i = 0; report->prefixes != NULL && i < report->prefixc; i++)
+    free(report->prefixes[i].name);
+  for (i = 0; i < report->biggestc; i++)
+    free(report->biggest[i].name);
+  for (i = 0; i < report->hottestc; i++)
+    free(report->hottest[i].name);
+  free(report->prefixes);
+  free(report->biggest);
+  free(report->hottest);
+  memset(report, 0, sizeof(REDIS_ANALYZE_REPORT));
+}
+
+/*
+ * Incremental deletion
+ */
+
+#define CR_DELETE_BATCH 100
+
+/* Appends command `cmd', with `key' unless NULL, and `n' names of batch `b', 
+ * starting with name `first', as arguments */
+static int cr_appendbatchcmd(cr_buffer *buf, const char *cmd, const char *key, 
+                             const cr_keybatch *b, int first, int n)
+{
+  const char *argv[2];
+  int i, rc, len, argc = 0;
+
+  argv[argc++] = cmd;
+  if (key != NULL)
+    argv[argc++] = key;
+  if ((rc = cr_appendstrf(buf, "*%d\r\n", argc + n)) != 0)
+    return rc;
+  for (i = 0; i < argc; i++) 
+    if ((rc = cr_appendstrf(buf, "$%zu\r\n%s\r\n", strlen(argv[i]), argv[i])) != 0)
+      return rc;
+
+  for (i = first; i < first + n; i++) {
+    len = cr_keybatchlen(b, i);
+    if ((rc = cr_appendstrf(buf, "$%d\r\n", len)) != 0)
+      return rc;
+    if (buf->size - buf->len < len + 3)
+      if (cr_moremem(buf, len + 3))
+        return CREDIS_ERR_NOMEM;
+    memcpy(buf->data + buf->len, b->names.data + b->offs[i], len);
+    buf->len += len;
+    buf->data[buf->len++] = '\r';
+    buf->data[buf->len++] = '\n';
+  }
+
+  return 0;
+}
+
+/* Iterates with `scan' (SCAN, SSCAN or HSCAN) over `key', or the keyspace 
+ * if NULL, and deletes what is found, with `del' for `key', in batches. The
+ * deletion of the last batch found is pipelined with the scan for the next. 
+ * KEYS can be used as `scan' too, which gets all keys at once. */
+static int cr_delscan(REDIS rhnd, const char *scan, const char *key, const char *pattern, 
+                      const char *del, const REDIS_DELETE_OPTIONS *opts, 
+                      long long *deleted)
+{
+  cr_buffer *buf = &(rhnd->buf);
+  cr_multibulk *mb;
+  cr_keybatch b;
+  struct timeval start;
+  const char *argv[7];
+  char cursor[CR_ANALYZE_NAME_SIZE], count[16];
+  int i, n, rc = 0, argc, more, first = 0, pairs = !strcmp(scan, "HSCAN");
+  int keys = !strcmp(scan, "KEYS");
+
+  memset(&b, 0, sizeof(b));
+  strcpy(cursor, "0");
+  sprintf(count, "%d", opts->batch);
+  gettimeofday(&start, NULL);
+
+  do {
+    buf->len = 0;
+    buf->idx = 0;
+    n = b.len - first < opts->batch ? b.len - first : opts->batch;
+    if (n > 0 && (rc = cr_appendbatchcmd(buf, del, key, &b, first, n)) != 0)
+      break;
+    if (key == NULL)
+      for (i = first; i < first + n; i++)
+        cr_l2invalidate(rhnd, b.names.data + b.offs[i]);
+    more = cursor[0] != '\0' && first + n == b.len;
+    if (more && keys) {
+      argv[0] = scan;
+      argv[1] = pattern != NULL ? pattern : "*";
+      if ((rc = cr_appendcmdv(buf, 2, argv, NULL)) != 0)
+        break;
+    }
+    else if (more) {
+      argc = 0;
+      argv[argc++] = scan;
+      if (key != NULL)
+        argv[argc++] = key;
+      argv[argc++] = cursor;
+      if (pattern != NULL) {
+        argv[argc++] = "MATCH";
+        argv[argc++] = pattern;
+      }
+      argv[argc++] = "COUNT";
+      argv[argc++] = count;
+      if ((rc = cr_appendcmdv(buf, argc, argv, NULL)) != 0)
+        break;
+    }
+    if ((rc = cr_pipelinesend(&rhnd, 1)) != 0)
+      break;
+
+    if (n > 0) {
+      if ((rc = cr_pipelinereply(rhnd, CR_INT)) != 0)
+        break;
+      *deleted += strtoll(rhnd->reply.line, NULL, 10);
+      if ((first += n) == b.len) {
+        b.len = 0;
+        b.names.len = 0;
+        first = 0;
+      }
+    }
+
+    if (more) {
+      if ((rc = cr_pipelinereply(rhnd, CR_MULTIBULK)) != 0)
+        break;
+      mb = &(rhnd->reply.multibulk);
+      /* a finished scan is marked with an empty cursor */
+      if (keys) {
+        cursor[0] = '\0';
+        i = 0;
+      }
+      else if (mb->len < 2 || mb->types[1] != CR_MULTIBULK || mb->lens[0] >= CR_ANALYZE_NAME_SIZE) {
+        rc = CREDIS_ERR_PROTOCOL;
+        break;
+      }
+      else {
+        if (!strcmp(mb->bulks[0], "0"))
+          cursor[0] = '\0';
+        else
+          memcpy(cursor, mb->bulks[0], mb->lens[0] + 1);
+        i = 2;
+      }
+      for (; i < mb->len; i += pairs ? 2 : 1)
+        if ((rc = cr_keybatchadd(&b, mb->bulks[i], mb->lens[i])) != 0)
+          break;
+      if (rc != 0)
+        break;
+    }
+
+    cr_pace(&start, *deleted, opts->rate);
+  } while (cursor[0] != '\0' || b.len > 0);
+
+  free(b.names.data);
+  free(b.offs);
+  free(b.types);
+
+  return rc;
+}
+
+/* Deletes `key' with UNLINK, which frees memory in the background, if 
+ * server supports it, otherwise with DEL */
+static int cr_unlink(REDIS rhnd, const char *key)
+{
+  int rc;
+
+  if (rhnd->caps & CREDIS_CAP_UNLINK) {
+    rc = cr_sendfandreceive(rhnd, CR_INT, "UNLINK %s\r\n", key);
+    if (rc == 0 || !cr_unknowncommand(rhnd, CREDIS_CAP_UNLINK))
+      return rc;
+  }
+
+  return cr_sendfandreceive(rhnd, CR_INT, "DEL %s\r\n", key);
+}
+
+/* Removes elements of sorted set or list `key' from one end, in batches 
+ * until it is empty */
+static int cr_delrange(REDIS rhnd, const char *key, int type, 
+                       const REDIS_DELETE_OPTIONS *opts, long long *deleted)
+{
+  struct timeval start;
+  long long len = -1, left;
+  int rc, more;
+
+  gettimeofday(&start, NULL);
+
+  do {
+    if (type == CREDIS_TYPE_ZSET) {
+      if ((rc = cr_sendfandreceive(rhnd, CR_INT, "ZREMRANGEBYRANK %s 0 %d\r\n", 
+                                   key, opts->batch - 1)) != 0)
+        return rc;
+      *deleted += rhnd->reply.integer;
+      more = rhnd->reply.integer == opts->batch;
+    }
+    else {
+      /* trim from the tail and get what is left in the same round trip */
+      if (len < 0) {
+        if ((rc = cr_sendfandreceive(rhnd, CR_INT, "LLEN %s\r\n", key)) != 0)
+          return rc;
+        len = strtoll(rhnd->reply.line, NULL, 10);
+      }
+      if ((rc = cr_sendfandreceive(rhnd, CR_INLINE, "LTRIM %s 0 %d\r\nLLEN %s\r\n", 
+                                   key, -opts->batch - 1, key)) != 0 ||
+          (rc = cr_pipelinereply(rhnd, CR_INT)) != 0)
+        return rc;
+      left = strtoll(rhnd->reply.line, NULL, 10);
+      *deleted += len - left;
+      len = left;
+      more = left > 0;
+    }
+
+    cr_pace(&start, *deleted, opts->rate);
+  } while (more);
+
+  return 0;
+}
+
+int credis_del_incremental(REDIS rhnd, const char *key, const REDIS_DELETE_OPTIONS *options,
+                           long long *deleted)
+{
+  REDIS_DELETE_OPTIONS opts;
+  long long localdeleted;
+  int rc, type, scan;
+
+  memset(&opts, 0, sizeof(opts));
+  if (options != NULL)
+    opts = *options;
+  if (opts.batch <= 0)
+    opts.batch = CR_DELETE_BATCH;
+  if (deleted == NULL)
+    deleted = &localdeleted;
+  *deleted = 0;
+
+  scan = rhnd->caps & CREDIS_CAP_SCAN;
+
+  if ((rc = cr_sendfandreceive(rhnd, CR_INLINE, "TYPE %s\r\n", key)) != 0)
+    return rc;
+  type = cr_parsetype(rhnd->reply.line);
+
+  if (type == CREDIS_TYPE_NONE)
+    return -1;
+  else if (type == CREDIS_TYPE_SET && scan)
+    rc = cr_delscan(rhnd, "SSCAN", key, NULL, "SREM", &opts, deleted);
+  else if (type == CREDIS_TYPE_HASH && scan)
+    rc = cr_delscan(rhnd, "HSCAN", key, NULL, "HDEL", &opts, deleted);
+  else if (type == CREDIS_TYPE_ZSET || type == CREDIS_TYPE_LIST)
+    rc = cr_delrange(rhnd, key, type, &opts, deleted);
+  if (rc != 0)
+    return rc;
+
+  /* what remains is small, or can not be deleted incrementally */
+  cr_l2invalidate(rhnd, key);
+  if ((rc = cr_unlink(rhnd, key)) == 0)
+    *deleted += rhnd->reply.integer;
+
+  return rc;
+}
+
+int credis_del_pattern(REDIS rhnd, const char *pattern, const REDIS_DELETE_OPTIONS *options,
+                       long long *deleted)
+{
+  REDIS_DELETE_OPTIONS opts;
+  long long localdeleted;
+
+  memset(&opts, 0, sizeof(opts));
+  if (options != NULL)
+    opts = *options;
+  if (opts.batch <= 0)
+    opts.batch = CR_DELETE_BATCH;
+  if (deleted == NULL)
+    deleted = &localdeleted;
+  *deleted = 0;
+
+  if (!(rhnd->caps & (CREDIS_CAP_SCAN | CREDIS_CAP_KEYSMULTIBULK)))
+    return CREDIS_ERR; /* neither SCAN nor KEYS replying multi-bulk */
+
+  return cr_delscan(rhnd, (rhnd->caps & CREDIS_CAP_SCAN) ? "SCAN" : "KEYS", NULL, pattern, 
+                    (rhnd->caps & CREDIS_CAP_UNLINK) ? "UNLINK" : "DEL", &opts, deleted);
+}
+
+/*
+ * Striped counters and replicated keys
+ */
+
+#define CR_SUBKEY_SIZE 256
+
+#if __GNUC__
+static __thread int cr_thread = -1;
+#else
+static int cr_thread = -1;
+#endif
+static volatile int cr_threads;
+
+/* Returns which of `stripes' calling thread uses, threads are spread 
+ * round-robin over stripes */
+static int cr_threadstripe(int stripes)
+{
+  if (cr_thread < 0)
+    cr_thread = CR_ATOMIC_INC(&cr_threads) & INT_MAX;
+
+  return cr_thread % stripes;
+}
+
+/* Returns name of stripe or copy `n' of `key', formatted in `buf' of 
+ * CR_SUBKEY_SIZE bytes */
+static const char *cr_subkey(char *buf, const char *key, int n)
+{
+  snprintf(buf, CR_SUBKEY_SIZE, "%s:%d", key, n);
+  return buf;
+}
+
+/* Appends command `cmd' with all of the `n' stripes or copies of `key' 
+ * that are stored on each handle, stripe `i' being stored on handle 
+ * `i' modulo `rhndc'. */
+static int cr_subkeycommand(REDIS *rhndv, int rhndc, const char *cmd, const char *key, int n)
+{
+  char sub[CR_SUBKEY_SIZE];
+  int i, rc;
+
+  for (i = 0; i < n; i++) {
+    cr_buffer *buf = &(rhndv[i % rhndc]->buf);
+    if (i < rhndc && (rc = cr_appendstr(buf, cmd, 0)) != 0)
+      return rc;
+    if ((rc = cr_appendstr(buf, cr_subkey(sub, key, i), 1)) != 0)
+      return rc;
+  }
+  for (i = 0; i < rhndc && i < n; i++)
+    if ((rc = cr_appendstr(&(rhndv[i]->buf), "\r\n", 0)) != 0)
+      return rc;
+
+  return 0;
+}
+
+int credis_counter_incr(REDIS *rhndv, int rhndc, const char *key, int stripes, long long incr)
+{
+  char sub[CR_SUBKEY_SIZE];
+  int n;
+
+  if (rhndc <= 0 || stripes <= 0 || strlen(key) > CR_SUBKEY_SIZE - 12)
+    return -EINVAL;
+
+  n = cr_threadstripe(stripes);
+  cr_subkey(sub, key, n);
+  cr_filteradd(rhndv[n % rhndc], sub);
+  cr_l2invalidate(rhndv[n % rhndc], sub);
+
+  return cr_sendfandreceive(rhndv[n % rhndc], CR_INT, "INCRBY %s %lld\r\n", sub, incr);
+}
+
+int credis_counter_get(REDIS *rhndv, int rhndc, const char *key, int stripes, long long *value)
+{
+  cr_multibulk *mb;
+  int i, j, rc;
+
+  if (rhndc <= 0 || stripes <= 0 || strlen(key) > CR_SUBKEY_SIZE - 12)
+    return -EINVAL;
+
+  cr_pipelinereset(rhndv, rhndc);
+  if ((rc = cr_subkeycommand(rhndv, rhndc, "MGET", key, stripes)) != 0 ||
+      (rc = cr_pipelinesend(rhndv, rhndc)) != 0)
+    return rc;
+
+  *value = 0;
+  for (i = 0; i < rhndc && i < stripes; i++) {
+    if ((rc = cr_pipelinereply(rhndv[i], CR_MULTIBULK)) != 0)
+      return rc;
+    mb = &(rhndv[i]->reply.multibulk);
+    for (j = 0; j < mb->len; j++)
+      if (mb->bulks[j] != NULL)
+        *value += strtoll(mb->bulks[j], NULL, 10);
+  }
+
+  return 0;
+}
+
+int credis_counter_del(REDIS *rhndv, int rhndc, const char *key, int stripes)
+{
+  char sub[CR_SUBKEY_SIZE];
+  int i, rc;
+
+  if (rhndc <= 0 || stripes <= 0 || strlen(key) > CR_SUBKEY_SIZE - 12)
+    return -EINVAL;
+
+  for (i = 0; i < stripes; i++)
+    cr_l2invalidate(rhndv[i % rhndc], cr_subkey(sub, key, i));
+
+  cr_pipelinereset(rhndv, rhndc);
+  if ((rc = cr_subkeycommand(rhndv, rhndc, "DEL", key, stripes)) != 0 ||
+      (rc = cr_pipelinesend(rhndv, rhndc)) != 0)
+    return rc;
+
+  for (i = 0; i < rhndc && i < stripes; i++)
+    if ((rc = cr_pipelinereply(rhndv[i], CR_INT)) != 0)
+      return rc;
+
+  return 0;
+}
+
+int credis_replicated_set(REDIS *rhndv, int rhndc, const char *key, int copies, 
+                          const char *val)
+{
+  char sub[CR_SUBKEY_SIZE];
+  const char *argv[3];
+  int i, rc, err = 0;
+
+  if (rhndc <= 0 || copies <= 0 || strlen(key) > CR_SUBKEY_SIZE - 12)
+    return -EINVAL;
+
+  cr_pipelinereset(rhndv, rhndc);
+  argv[0] = "SET";
+  argv[1] = sub;
+  argv[2] = val;
+  for (i = 0; i < copies; i++) {
+    cr_subkey(sub, key, i);
+    cr_filteradd(rhndv[i % rhndc], sub);
+    cr_l2invalidate(rhndv[i % rhndc], sub);
+    if ((rc = cr_appendcmdv(&(rhndv[i % rhndc]->buf), 3, argv, NULL)) != 0)
+      return rc;
+  }
+  if ((rc = cr_pipelinesend(rhndv, rhndc)) != 0)
     return rc;
-  if ((rc = cr_sendandreceive(rhnd, CR_MULTIBULK)) == 0) {
-    *valv = rhnd->reply.multibulk.bulks;
-    rc = rhnd->reply.multibulk.len;
+
+  /* read all replies, even if one is an error */
+  for (i = 0; i < copies; i++) {
+    if ((rc = cr_pipelinereply(rhndv[i % rhndc], CR_INLINE)) != 0) {
+      if (rhndv[i % rhndc]->reply.type != CR_ERROR)
+        return rc;
+      err = rc;
+    }
   }
 
+  return err;
+}
+
+int credis_replicated_get(REDIS *rhndv, int rhndc, const char *key, int copies, char **val)
+{
+  char sub[CR_SUBKEY_SIZE];
+  int n, rc;
+
+  if (rhndc <= 0 || copies <= 0 || strlen(key) > CR_SUBKEY_SIZE - 12)
+    return -EINVAL;
+
+  n = rand() % copies;
+  rc = cr_sendfandreceive(rhndv[n % rhndc], CR_BULK, "GET %s\r\n", cr_subkey(sub, key, n));
+
+  if (rc == 0 && (*val = rhndv[n % rhndc]->reply.bulk) == NULL)
+    return -1;
+
   return rc;
 }
 
-static int cr_multikeystorecommand(REDIS rhnd, const char *cmd, const char *destkey, 
-                                   int keyc, const char **keyv)
+int credis_replicated_del(REDIS *rhndv, int rhndc, const char *key, int copies)
+{
+  return credis_counter_del(rhndv, rhndc, key, copies);
+}
+
+/*
+ * Batch commands
+ */
+
+#define CR_BATCH_CHUNK 1024 /* most commands per pipelined chunk */
+
+#define CR_BATCH_SET 0
+#define CR_BATCH_GET 1
+#define CR_BATCH_EXISTS 2
+#define CR_BATCH_DEL 3
+
+/* Appends command `op' for item `i' of a batch */
+static int cr_batchappend(cr_buffer *buf, int op, int i, const char **keyv, 
+                          const char **valv, const int *ttlv)
+{
+  static const char *cmds[] = {"SET", "GET", "EXISTS", "DEL"};
+  const char *argv[4];
+  char ttl[16];
+  int argc = 0;
+
+  argv[argc++] = cmds[op];
+  argv[argc++] = keyv[i];
+  if (op == CR_BATCH_SET && ttlv != NULL && ttlv[i] > 0) {
+    sprintf(ttl, "%d", ttlv[i]);
+    argv[0] = "SETEX";
+    argv[argc++] = ttl;
+  }
+  if (op == CR_BATCH_SET)
+    argv[argc++] = valv[i];
+
+  return cr_appendcmdv(buf, argc, argv, NULL);
+}
+
+/* Returns status of item of a batch from reply of its command, and copies 
+ * value of GET to values of batch */
+static int cr_batchstatus(REDIS rhnd, int op)
+{
+  cr_reply *reply = &(rhnd->reply);
+  cr_buffer *values = &(rhnd->values);
+  int len;
+
+  switch (op) {
+  case CR_BATCH_SET:
+    return reply->type == CR_INLINE ? 0 : CREDIS_ERR_PROTOCOL;
+  case CR_BATCH_GET:
+    if (reply->type != CR_BULK)
+      return CREDIS_ERR_PROTOCOL;
+    if (reply->bulk == NULL)
+      return -1;
+    len = strlen(reply->bulk) + 1;
+    if (values->size - values->len < len)
+      if (cr_moremem(values, len))
+        return CREDIS_ERR_NOMEM;
+    memcpy(values->data + values->len, reply->bulk, len);
+    values->len += len;
+    return 0;
+  default:
+    if (reply->type != CR_INT)
+      return CREDIS_ERR_PROTOCOL;
+    return reply->integer > 0 ? 0 : -1;
+  }
+}
+
+/* Sends command `op' for each of the `n' items of a batch, pipelined in 
+ * chunks of at most CR_BATCH_CHUNK commands or about CR_CHUNK_SIZE bytes, 
+ * and stores status of each item in `statusv' */
+static int cr_batch(REDIS rhnd, int op, int n, const char **keyv, const char **valv, 
+                    const int *ttlv, char **outv, int *statusv)
 {
   cr_buffer *buf = &(rhnd->buf);
+  char *value;
+  int i, j, end, rc, ok = 0;
+
+  if (!(rhnd->caps & CREDIS_CAP_MULTIBULK))
+    return CREDIS_ERR;
+
+  rhnd->values.len = 0;
+
+  for (i = 0; i < n; i = end) {
+    end = i + CR_BATCH_CHUNK < n ? i + CR_BATCH_CHUNK : n;
+    cr_pipelinereset(&rhnd, 1);
+    for (j = i; j < end; j++) {
+      /* keys known to be missing are not looked up, marked with status 1 
+       * until replies are read */
+      statusv[j] = 0;
+      if ((op == CR_BATCH_GET || op == CR_BATCH_EXISTS) && !cr_filtercheck(rhnd, keyv[j])) {
+        statusv[j] = 1;
+        continue;
+      }
+      if ((rc = cr_batchappend(buf, op, j, keyv, valv, ttlv)) != 0)
+        goto error;
+      if (op == CR_BATCH_SET)
+        cr_filteradd(rhnd, keyv[j]);
+      if (op == CR_BATCH_SET || op == CR_BATCH_DEL)
+        cr_l2invalidate(rhnd, keyv[j]);
+      if (buf->len >= CR_CHUNK_SIZE)
+        end = j + 1;
+    }
+    if ((rc = cr_pipelinesend(&rhnd, 1)) != 0)
+      goto error;
+
+    for (j = i; j < end; j++) {
+      if (statusv[j] == 1) {
+        statusv[j] = -1;
+        continue;
+      }
+      if ((rc = cr_pipelinereply(rhnd, CR_ANY)) != 0) {
+        if (rhnd->reply.type != CR_ERROR)
+          goto error;
+        statusv[j] = CREDIS_ERR;
+        continue;
+      }
+      if ((statusv[j] = cr_batchstatus(rhnd, op)) == 0)
+        ok++;
+      else if (statusv[j] == -1 && op != CR_BATCH_DEL)
+        cr_filtermiss(rhnd);
+      else if (statusv[j] == CREDIS_ERR_NOMEM) {
+        rc = CREDIS_ERR_NOMEM;
+        goto error;
+      }
+    }
+  }
+
+  /* values are stored one after another, point them out when they do not 
+   * move anymore */
+  if (outv != NULL) {
+    for (i = 0, value = rhnd->values.data; i < n; i++) {
+      outv[i] = statusv[i] == 0 ? value : NULL;
+      if (statusv[i] == 0)
+        value += strlen(value) + 1;
+    }
+  }
+
+  return ok;
+
+error:
+  for (j = i; j < n; j++)
+    statusv[j] = rc;
+  if (outv != NULL)
+    memset(outv, 0, n * sizeof(char *));
+
+  return rc;
+}
+
+int credis_batch_set_ex(REDIS rhnd, int n, const char **keyv, const char **valv, 
+                        const int *ttlv, int *statusv)
+{
+  return cr_batch(rhnd, CR_BATCH_SET, n, keyv, valv, ttlv, NULL, statusv);
+}
+
+int credis_batch_get(REDIS rhnd, int n, const char **keyv, char **valv, int *statusv)
+{
+  return cr_batch(rhnd, CR_BATCH_GET, n, keyv, NULL, NULL, valv, statusv);
+}
+
+int credis_batch_exists(REDIS rhnd, int n, const char **keyv, int *statusv)
+{
+  return cr_batch(rhnd, CR_BATCH_EXISTS, n, keyv, NULL, NULL, NULL, statusv);
+}
+
+int credis_batch_del(REDIS rhnd, int n, const char **keyv, int *statusv)
+{
+  return cr_batch(rhnd, CR_BATCH_DEL, n, keyv, NULL, NULL, NULL, statusv);
+}
+
+/*
+ * Durable writes
+ */
+
+typedef struct _cr_durable {
+  REDIS rhnd;
+  cr_buffer cmds;   /* writes appended since last commit */
+  int n;
+} cr_durable;
+
+REDIS_DURABLE credis_durable_open(REDIS rhnd)
+{
+  cr_durable *group;
+
+  if (!(rhnd->caps & CREDIS_CAP_MULTIBULK) || (group = calloc(1, sizeof(cr_durable))) == NULL)
+    return NULL;
+  group->rhnd = rhnd;
+
+  return group;
+}
+
+int credis_durable_write(REDIS_DURABLE group, int argc, const char **argv)
+{
   int rc;
 
-  buf->len = 0;
-  if ((rc = cr_appendstr(buf, cmd, 0)) != 0)
+  if (argc <= 0)
+    return -EINVAL;
+  if ((rc = cr_appendcmdv(&(group->cmds), argc, argv, NULL)) != 0)
     return rc;
-  if ((rc = cr_appendstr(buf, destkey, 1)) != 0)
+
+  /* key is by convention the first argument of a write */
+  if (argc > 1) {
+    cr_filteradd(group->rhnd, argv[1]);
+    cr_l2invalidate(group->rhnd, argv[1]);
+  }
+
+  return group->n++;
+}
+
+int credis_durable_commit(REDIS_DURABLE group, int numreplicas, int timeout, int *statusv)
+{
+  REDIS rhnd = group->rhnd;
+  cr_buffer *cmds = &(group->cmds);
+  char replicas[16], msecs[16];
+  const char *argv[] = {"WAIT", replicas, msecs};
+  int i, rc, len, acked, saved, n = group->n;
+
+  if (timeout <= 0)
+    return -EINVAL;
+
+  /* writes are followed by one WAIT that covers them all */
+  snprintf(replicas, sizeof(replicas), "%d", numreplicas);
+  snprintf(msecs, sizeof(msecs), "%d", timeout);
+  rc = cr_appendcmdv(cmds, 3, argv, NULL);
+  len = cmds->len;
+  group->n = 0;
+  cmds->len = 0;
+  if (rc != 0)
     return rc;
-  if ((rc = cr_appendstrarray(buf, keyc, keyv, 1)) != 0)
+
+  cr_pipelinereset(&rhnd, 1);
+  cr_hotkeystrack(cmds->data, len);
+  if ((rc = cr_senddata(rhnd, cmds->data, len)) != len) {
+    rc = rc < 0 ? CREDIS_ERR_SEND : CREDIS_ERR_TIMEOUT;
+    for (i = 0; i < n; i++)
+      statusv[i] = rc;
     return rc;
+  }
 
-  return cr_sendandreceive(rhnd, CR_INLINE);
+  /* server replies to WAIT once replicas have acknowledged or its timeout
+   * has expired, so replies are waited for that much longer than usual */
+  saved = rhnd->timeout;
+  rhnd->timeout += timeout;
+  for (i = 0; i < n; i++) {
+    if ((rc = cr_pipelinereply(rhnd, CR_ANY)) != 0 && rhnd->reply.type != CR_ERROR)
+      break;
+    statusv[i] = rc == 0 ? 0 : CREDIS_ERR;
+  }
+  if (i == n)
+    rc = cr_pipelinereply(rhnd, CR_INT);
+  rhnd->timeout = saved;
+  if (i < n) {
+    for (; i < n; i++)
+      statusv[i] = rc;
+    return rc;
+  }
+  acked = rc == 0 ? rhnd->reply.integer : rc;
+
+  for (i = 0; i < n; i++)
+    if (statusv[i] == 0 && (rc != 0 || acked < numreplicas))
+      statusv[i] = 1;
+
+  return acked;
 }
 
-int credis_mget(REDIS rhnd, int keyc, const char **keyv, char ***valv)
+void credis_durable_close(REDIS_DURABLE group)
 {
-  return cr_multikeybulkcommand(rhnd, "MGET", keyc, keyv, valv);
+  if (group == NULL)
+    return;
+  free(group->cmds.data);
+  free(group);
 }
 
-int credis_setnx(REDIS rhnd, const char *key, const char *val)
+/*
+ * Cache-aside with early recomputation
+ */
+
+/* Returns milliseconds since `start' */
+static long long cr_elapsed(const struct timeval *start)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "SETNX %s %zu\r\n%s\r\n", 
-                              key, strlen(val), val);
+  struct timeval now;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+int credis_cache_set(REDIS rhnd, const char *key, const char *val, long long ttl, int delta)
+{
+  char *str;
+  int rc, len = strlen(val);
+
+  /* value is stored prefixed with the time it took to compute, which is 
+   * needed to decide when to recompute it */
+  if ((str = malloc(len + 16)) == NULL)
+    return CREDIS_ERR_NOMEM;
+  sprintf(str, "%d:", delta);
+  strcat(str, val);
+  rc = ttl > 0 ? credis_psetex(rhnd, key, ttl, str) : credis_set(rhnd, key, str);
+  free(str);
 
   return rc;
 }
 
-static int cr_incr(REDIS rhnd, int incr, int decr, const char *key, int *new_val)
+int credis_cache_get(REDIS rhnd, const char *key, const REDIS_CACHE_OPTIONS *options, 
+                     REDIS_CACHE_COMPUTE compute, void *arg, char **val)
 {
-  int rc = 0;
+  REDIS_CACHE_OPTIONS opts;
+  struct timeval start;
+  long long left;
+  char *value = NULL, *end;
+  int rc, delta = 0, ms = rhnd->caps & CREDIS_CAP_MILLISECONDS;
+
+  memset(&opts, 0, sizeof(opts));
+  if (options != NULL)
+    opts = *options;
+  if (opts.beta <= 0)
+    opts.beta = 1.0;
+
+  /* time to live is read first, since reading the next reply moves the 
+   * value of the previous */
+  if ((rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s\r\nGET %s\r\n", 
+                               ms ? "PTTL" : "TTL", key, key)) != 0)
+    return rc;
+  left = strtoll(rhnd->reply.line, NULL, 10);
+  if (!ms && left > 0)
+    left *= 1000;
+  if ((rc = cr_pipelinereply(rhnd, CR_BULK)) != 0)
+    return rc;
 
-  if (incr == 1 || decr == 1)
-    rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s\r\n", 
-                            incr>0?"INCR":"DECR", key);
-  else if (incr > 1 || decr > 1)
-    rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s %d\r\n", 
-                            incr>0?"INCRBY":"DECRBY", key, incr>0?incr:decr);
+  if ((value = rhnd->reply.bulk) != NULL) {
+    delta = strtol(value, &end, 10);
+    if (*end == ':' && end != value)
+      value = end + 1;
+    else
+      delta = 0;
+    /* XFetch: recompute early, with a probability that grows as expiry 
+     * nears, faster for values that take long to compute. A value without
+     * expiry is never recomputed. */
+    if (left > 0 && delta > 0 && compute != NULL &&
+        -delta * opts.beta * log((rand() + 1.0) / ((double) RAND_MAX + 1.0)) >= left)
+      value = NULL;
+  }
 
-  if (rc == 0 && new_val != NULL)
-    *new_val = rhnd->reply.integer;
+  if (value == NULL) {
+    if (compute == NULL)
+      return -1;
+    gettimeofday(&start, NULL);
+    if ((rc = compute(key, &value, arg)) != 0)
+      return rc;
+    delta = (int) cr_elapsed(&start);
+    if ((rc = credis_cache_set(rhnd, key, value, opts.ttl, delta > 0 ? delta : 1)) != 0)
+      return rc;
+  }
 
-  return rc;
+  *val = value;
+
+  return 0;
 }
 
-int credis_incr(REDIS rhnd, const char *key, int *new_val)
+/*
+ * Chunked values
+ */
+
+#define CR_CHUNKED_SIZE (1024 * 1024)
+#define CR_CHUNKED_BATCH 4 /* chunks per MSET, MGET or DEL */
+#define CR_CHUNKED_MAGIC "credis-chunked"
+
+typedef struct _cr_manifest {
+  long long len;
+  int chunk;
+  unsigned int crc;
+  char gen[17];
+  int n;       /* number of chunks */
+  int home;    /* handle of manifest and first chunk */
+} cr_manifest;
+
+/* CRC-32 of each byte value, reflected polynomial 0xedb88320 */
+static const unsigned int cr_crc32table[256] = {
+  0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+  0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+  0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+  0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+  0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+  0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+  0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+  0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+  0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+  0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+  0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+  0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+  0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+  0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+  0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+  0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+  0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+  0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+  0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+  0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+  0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+  0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+  0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+  0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+  0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+  0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+  0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+  0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+  0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+  0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+  0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+  0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+  0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+  0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+  0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+  0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+  0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+  0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+  0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+  0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+  0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+  0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+  0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+/* Returns CRC-32 (IEEE 802.3) of `len' bytes of `data', continuing `crc' */
+static unsigned int cr_crc32(unsigned int crc, const char *data, long long len)
 {
-  return cr_incr(rhnd, 1, 0, key, new_val);
+  crc = ~crc;
+  while (len-- > 0)
+    crc = cr_crc32table[(crc ^ (unsigned char) *data++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
 }
 
-int credis_decr(REDIS rhnd, const char *key, int *new_val)
+/* Returns 0 if `str' is a manifest, which is parsed into `m' */
+static int cr_parsemanifest(const char *str, int rhndc, const char *key, cr_manifest *m)
 {
-  return cr_incr(rhnd, 0, 1, key, new_val);
+  if (str == NULL || 
+      sscanf(str, CR_CHUNKED_MAGIC " %lld %d %u %16s", &(m->len), &(m->chunk), 
+             &(m->crc), m->gen) != 4 || m->len < 0 || m->chunk <= 0)
+    return CREDIS_ERR_PROTOCOL;
+  m->n = (int) ((m->len + m->chunk - 1) / m->chunk);
+  m->home = (int) (cr_hash(key, strlen(key)) % rhndc);
+
+  return 0;
 }
 
-int credis_incrby(REDIS rhnd, const char *key, int incr_val, int *new_val)
+/* Appends command `cmd' for the chunks of handle `h' in round `r' and 
+ * returns number of chunks, chunk `i' is on handle (home + i) % rhndc */
+static int cr_appendchunks(cr_buffer *buf, const char *cmd, int h, int r, int rhndc, 
+                           const char *key, const cr_manifest *m, const char *val)
 {
-  return cr_incr(rhnd, incr_val, 0, key, new_val);
+  char names[CR_CHUNKED_BATCH][CR_SUBKEY_SIZE];
+  const char *argv[1 + 2 * CR_CHUNKED_BATCH];
+  int argl[1 + 2 * CR_CHUNKED_BATCH];
+  int i, k, rc, argc = 0;
+  long long off;
+
+  argv[argc] = cmd;
+  argl[argc++] = strlen(cmd);
+  for (k = 0; k < CR_CHUNKED_BATCH; k++) {
+    i = (h - m->home + rhndc) % rhndc + (r * CR_CHUNKED_BATCH + k) * rhndc;
+    if (i >= m->n)
+      break;
+    snprintf(names[k], CR_SUBKEY_SIZE, "%s:%s:%d", key, m->gen, i);
+    argv[argc] = names[k];
+    argl[argc++] = strlen(names[k]);
+    if (val != NULL) {
+      off = (long long) i * m->chunk;
+      argv[argc] = val + off;
+      argl[argc++] = (int) (m->len - off < m->chunk ? m->len - off : m->chunk);
+    }
+  }
+
+  if (k > 0 && (rc = cr_appendcmdv(buf, argc, argv, argl)) != 0)
+    return rc;
+
+  return k;
 }
 
-int credis_decrby(REDIS rhnd, const char *key, int decr_val, int *new_val)
+/* Sets (MSET), gets (MGET) or deletes (DEL) chunks of manifest `m' in 
+ * rounds, where each handle gets one command for at most CR_CHUNKED_BATCH 
+ * chunks per round, so that no connection or server is busy for long. 
+ * Returns -1 if a chunk is missing, which happens if value is replaced 
+ * while it is read. */
+static int cr_chunks(REDIS *rhndv, int rhndc, const char *cmd, const char *key, 
+                     const cr_manifest *m, const char *val, char *out)
 {
-  return cr_incr(rhnd, 0, decr_val, key, new_val);
+  cr_multibulk *mb;
+  long long off;
+  int h, r, k, i, rc, active, result = 0;
+
+  for (r = 0, active = 1; active; r++) {
+    cr_pipelinereset(rhndv, rhndc);
+    for (h = 0, active = 0; h < rhndc; h++) {
+      if ((rc = cr_appendchunks(&(rhndv[h]->buf), cmd, h, r, rhndc, key, m, val)) < 0)
+        return rc;
+      active += rc > 0;
+    }
+    if ((rc = cr_pipelinesend(rhndv, rhndc)) != 0)
+      return rc;
+
+    for (h = 0; h < rhndc; h++) {
+      i = (h - m->home + rhndc) % rhndc + r * CR_CHUNKED_BATCH * rhndc;
+      if (i >= m->n)
+        continue;
+      if ((rc = cr_pipelinereply(rhndv[h], CR_ANY)) != 0)
+        return rc;
+      if (out == NULL)
+        continue;
+
+      mb = &(rhndv[h]->reply.multibulk);
+      if (rhndv[h]->reply.type != CR_MULTIBULK)
+        return CREDIS_ERR_PROTOCOL;
+      for (k = 0; k < mb->len; k++, i += rhndc) {
+        off = (long long) i * m->chunk;
+        if (mb->lens[k] < 0)
+          result = -1;
+        else if (mb->lens[k] != (m->len - off < m->chunk ? m->len - off : m->chunk))
+          return CREDIS_ERR_PROTOCOL;
+        else
+          memcpy(out + off, mb->bulks[k], mb->lens[k]);
+      }
+    }
+  }
+
+  return result;
 }
 
-int credis_append(REDIS rhnd, const char *key, const char *val)
+int credis_chunked_set(REDIS *rhndv, int rhndc, const char *key, const char *val, 
+                       long long len, int chunk)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "APPEND %s %zu\r\n%s\r\n", 
-                              key, strlen(val), val);
-                            
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  REDIS rhnd;
+  cr_manifest m, old;
+  struct timeval tv;
+  char manifest[128];
+  const char *argv[3];
+  static unsigned int seq;
+  int rc;
 
-  return rc;                            
+  if (rhndc <= 0 || len < 0 || strlen(key) + 32 > CR_SUBKEY_SIZE)
+    return -EINVAL;
+
+  /* chunks of a new value get a generation of their own, so readers never 
+   * mix chunks of an old and a new value */
+  gettimeofday(&tv, NULL);
+  snprintf(manifest, sizeof(manifest), "%ld.%ld.%d.%u.%s", (long) tv.tv_sec, 
+           (long) tv.tv_usec, (int) getpid(), CR_ATOMIC_INC(&seq), key);
+  snprintf(m.gen, sizeof(m.gen), "%016llx", cr_hash(manifest, strlen(manifest)));
+  m.len = len;
+  m.chunk = chunk > 0 ? chunk : CR_CHUNKED_SIZE;
+  m.crc = cr_crc32(0, val, len);
+  m.n = (int) ((len + m.chunk - 1) / m.chunk);
+  m.home = (int) (cr_hash(key, strlen(key)) % rhndc);
+  rhnd = rhndv[m.home];
+
+  if ((rc = cr_chunks(rhndv, rhndc, "MSET", key, &m, val, NULL)) != 0)
+    return rc;
+
+  /* chunks are in place, publish manifest and remove chunks of old value */
+  snprintf(manifest, sizeof(manifest), CR_CHUNKED_MAGIC " %lld %d %u %s", 
+           m.len, m.chunk, m.crc, m.gen);
+  argv[0] = "GETSET";
+  argv[1] = key;
+  argv[2] = manifest;
+  cr_filteradd(rhnd, key);
+  cr_l2invalidate(rhnd, key);
+  if ((rc = cr_sendcmd(rhnd, CR_BULK, 3, argv)) != 0)
+    return rc;
+  if (cr_parsemanifest(rhnd->reply.bulk, rhndc, key, &old) == 0)
+    return cr_chunks(rhndv, rhndc, "DEL", key, &old, NULL, NULL);
+
+  return 0;
 }
 
-int credis_substr(REDIS rhnd, const char *key, int start, int end, char **substr)
+int credis_chunked_get(REDIS *rhndv, int rhndc, const char *key, char **val, long long *len)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "SUBSTR %s %d %d\r\n", 
-                              key, start, end);
+  REDIS rhnd;
+  cr_manifest m;
+  char *out;
+  int rc, tries;
 
-  if (rc == 0 && substr) 
-    *substr = rhnd->reply.bulk;
+  if (rhndc <= 0)
+    return -EINVAL;
+  rhnd = rhndv[cr_hash(key, strlen(key)) % rhndc];
 
-  return rc;                            
+  /* a value replaced while read is read again */
+  for (tries = 0; tries < 2; tries++) {
+    if ((rc = cr_sendfandreceive(rhnd, CR_BULK, "GET %s\r\n", key)) != 0)
+      return rc;
+    if (rhnd->reply.bulk == NULL)
+      return -1;
+    if ((rc = cr_parsemanifest(rhnd->reply.bulk, rhndc, key, &m)) != 0)
+      return rc;
+
+    if ((out = malloc(m.len + 1)) == NULL)
+      return CREDIS_ERR_NOMEM;
+    rc = cr_chunks(rhndv, rhndc, "MGET", key, &m, NULL, out);
+    if (rc == 0 && cr_crc32(0, out, m.len) != m.crc)
+      rc = CREDIS_ERR_PROTOCOL;
+    if (rc == 0) {
+      out[m.len] = '\0';
+      *val = out;
+      *len = m.len;
+      return 0;
+    }
+    free(out);
+    if (rc != -1 && rc != CREDIS_ERR_PROTOCOL)
+      return rc;
+  }
+
+  return rc;
 }
 
-int credis_exists(REDIS rhnd, const char *key)
+int credis_chunked_del(REDIS *rhndv, int rhndc, const char *key)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "EXISTS %s\r\n", key);
+  REDIS rhnd;
+  cr_manifest m;
+  int rc;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  if (rhndc <= 0)
+    return -EINVAL;
+  rhnd = rhndv[cr_hash(key, strlen(key)) % rhndc];
 
-  return rc;
+  if ((rc = cr_sendfandreceive(rhnd, CR_BULK, "GET %s\r\n", key)) != 0)
+    return rc;
+  if (rhnd->reply.bulk == NULL)
+    return -1;
+  if ((rc = cr_parsemanifest(rhnd->reply.bulk, rhndc, key, &m)) != 0)
+    return rc;
+  if ((rc = credis_del(rhnd, key)) != 0)
+    return rc;
+
+  return cr_chunks(rhndv, rhndc, "DEL", key, &m, NULL, NULL);
 }
 
-int credis_del(REDIS rhnd, const char *key)
+/*
+ * Client-side set operations
+ */
+
+#define CR_SETOP_INTER 0
+#define CR_SETOP_UNION 1
+#define CR_SETOP_DIFF 2
+
+#define CR_SETOP_COUNT "1000" /* members per SSCAN */
+
+typedef struct _cr_set {
+  int h;             /* handle of set */
+  char cursor[32];   /* of SSCAN, empty when all members are read */
+  int *offs;         /* offsets of members in values while they are read */
+  char **members;    /* sorted members when all are read */
+  int len;
+  int size;
+} cr_set;
+
+static int cr_setcmp(const void *a, const void *b)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "DEL %s\r\n", key);
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int cr_setlencmp(const void *a, const void *b)
+{
+  return (*(cr_set * const *) a)->len - (*(cr_set * const *) b)->len;
+}
+
+/* Returns index of first of `n' sorted members of `v' from `i' that is not
+ * less than `member'. Members are looked up in increasing order, so the 
+ * range is doubled from `i' before it is searched. */
+static int cr_setsearch(char **v, int i, int n, const char *member)
+{
+  int lo = i, hi = i, step = 1, mid;
+
+  while (hi < n && strcmp(v[hi], member) < 0) {
+    lo = hi + 1;
+    hi += step;
+    step *= 2;
+  }
+  if (hi > n)
+    hi = n;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (strcmp(v[mid], member) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Appends `len' bytes of `member' to `values' and its offset to `set' */
+static int cr_setadd(cr_set *set, cr_buffer *values, const char *member, int len)
+{
+  int *ptr;
+
+  if (set->len == set->size) {
+    if ((ptr = realloc(set->offs, (set->size + CR_MULTIBULK_SIZE) * sizeof(int))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    set->offs = ptr;
+    set->size += CR_MULTIBULK_SIZE;
+  }
+  if (values->size - values->len < len + 1)
+    if (cr_moremem(values, len + 1))
+      return CREDIS_ERR_NOMEM;
+
+  set->offs[set->len++] = values->len;
+  memcpy(values->data + values->len, member, len);
+  values->data[values->len + len] = '\0';
+  values->len += len + 1;
+
+  return 0;
+}
+
+/* Reads members of the `keyc' sets of `keyv' into `setv', set of key on 
+ * handle chosen by hash of key. All sets are read in parallel in rounds, 
+ * each with one SSCAN per set that is not yet read, or SMEMBERS on servers
+ * without SSCAN, pipelined so that all handles work at the same time. 
+ * Returns the first error replied by a server after all replies are read. */
+static int cr_setfetch(REDIS *rhndv, int rhndc, int keyc, const char **keyv, 
+                       cr_set *setv, cr_buffer *values)
+{
+  REDIS rhnd;
+  cr_multibulk *mb;
+  const char *argv[5];
+  int i, j, first, rc, active = keyc, err = 0;
+
+  for (i = 0; i < keyc; i++) {
+    setv[i].h = (int) (cr_hash(keyv[i], strlen(keyv[i])) % rhndc);
+    strcpy(setv[i].cursor, "0");
+  }
+
+  while (active > 0) {
+    cr_pipelinereset(rhndv, rhndc);
+    for (i = 0; i < keyc; i++) {
+      if (setv[i].cursor[0] == '\0')
+        continue;
+      rhnd = rhndv[setv[i].h];
+      if (rhnd->caps & CREDIS_CAP_SCAN) {
+        argv[0] = "SSCAN";
+        argv[1] = keyv[i];
+        argv[2] = setv[i].cursor;
+        argv[3] = "COUNT";
+        argv[4] = CR_SETOP_COUNT;
+        rc = cr_appendcmdv(&(rhnd->buf), 5, argv, NULL);
+      }
+      else {
+        argv[0] = "SMEMBERS";
+        argv[1] = keyv[i];
+        rc = cr_appendcmdv(&(rhnd->buf), 2, argv, NULL);
+      }
+      if (rc != 0)
+        return rc;
+    }
+    if ((rc = cr_pipelinesend(rhndv, rhndc)) != 0)
+      return rc;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+    /* replies of a handle come in the order its sets were appended */
+    for (i = 0; i < keyc; i++) {
+      if (setv[i].cursor[0] == '\0')
+        continue;
+      rhnd = rhndv[setv[i].h];
+      mb = &(rhnd->reply.multibulk);
+      if ((rc = cr_pipelinereply(rhnd, CR_MULTIBULK)) != 0) {
+        if (rhnd->reply.type != CR_ERROR)
+          return rc;
+        err = err ? err : rc;
+        setv[i].cursor[0] = '\0';
+        active--;
+        continue;
+      }
+
+      if (rhnd->caps & CREDIS_CAP_SCAN) {
+        if (mb->len < 2 || mb->types[1] != CR_MULTIBULK || 
+            mb->lens[0] >= (int) sizeof(setv[i].cursor))
+          return CREDIS_ERR_PROTOCOL;
+        memcpy(setv[i].cursor, mb->bulks[0], mb->lens[0] + 1);
+        first = 2;
+      }
+      else {
+        strcpy(setv[i].cursor, "0");
+        first = 0;
+      }
+      for (j = first; j < mb->len; j++)
+        if (mb->lens[j] >= 0 && (rc = cr_setadd(&setv[i], values, mb->bulks[j], mb->lens[j])) != 0)
+          return rc;
+      if (!strcmp(setv[i].cursor, "0")) {
+        setv[i].cursor[0] = '\0';
+        active--;
+      }
+    }
+  }
 
-  return rc;
+  return err;
 }
 
-int credis_type(REDIS rhnd, const char *key)
+/* Makes room for `n' members in result of handle */
+static int cr_setresult(REDIS rhnd, int n)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "TYPE %s\r\n", key);
+  char **ptr;
 
-  if (rc == 0) {
-    char *t = rhnd->reply.line;
-    if (!strcmp("string", t))
-      rc = CREDIS_TYPE_STRING;
-    else if (!strcmp("list", t))
-      rc = CREDIS_TYPE_LIST;
-    else if (!strcmp("set", t))
-      rc = CREDIS_TYPE_SET;
-    else
-      rc = CREDIS_TYPE_NONE;
+  if (n > rhnd->memberssize) {
+    if ((ptr = realloc(rhnd->members, n * sizeof(char *))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    rhnd->members = ptr;
+    rhnd->memberssize = n;
   }
 
-  return rc;
+  return 0;
 }
 
-int credis_keys(REDIS rhnd, const char *pattern, char ***keyv)
+/* Computes intersection, union or difference `op' of the `keyc' sets of 
+ * `keyv' into members of first handle, sorted. Each set is sorted, after 
+ * which an intersection is merged starting from the smallest set, and a
+ * difference from the first set, by looking up each of its members in the
+ * other sets from where the previous member was found. */
+static int cr_setop(REDIS *rhndv, int rhndc, int op, int keyc, const char **keyv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "KEYS %s\r\n", pattern);
+  REDIS rhnd;
+  cr_set *setv, **order = NULL;
+  int *pos = NULL;
+  char **v, *member;
+  int i, j, k, n, total, rc;
 
-  if (rc == 0) {
-    /* server returns keys as space-separated strings, use multi-bulk 
-     * storage to store keys */
-    if ((rc = cr_splitstrtromultibulk(rhnd, rhnd->reply.bulk, ' ')) == 0) {
-      *keyv = rhnd->reply.multibulk.bulks;
-      rc = rhnd->reply.multibulk.len;
+  if (rhndc <= 0 || keyc <= 0)
+    return -EINVAL;
+  rhnd = rhndv[0];
+  rhnd->values.len = 0;
+
+  if ((setv = calloc(keyc, sizeof(cr_set))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  if ((rc = cr_setfetch(rhndv, rhndc, keyc, keyv, setv, &(rhnd->values))) != 0)
+    goto out;
+
+  /* members do not move anymore once all are read */
+  for (i = 0, total = 0; i < keyc; i++) {
+    if (setv[i].len > 0 && (setv[i].members = malloc(setv[i].len * sizeof(char *))) == NULL) {
+      rc = CREDIS_ERR_NOMEM;
+      goto out;
     }
+    for (j = 0; j < setv[i].len; j++)
+      setv[i].members[j] = rhnd->values.data + setv[i].offs[j];
+    qsort(setv[i].members, setv[i].len, sizeof(char *), cr_setcmp);
+    /* SSCAN may return a member more than once */
+    for (j = 1, n = setv[i].len > 0; j < setv[i].len; j++)
+      if (strcmp(setv[i].members[j], setv[i].members[n - 1]))
+        setv[i].members[n++] = setv[i].members[j];
+    setv[i].len = n;
+    total += n;
   }
 
-  return rc;
-}
+  order = malloc(keyc * sizeof(cr_set *));
+  pos = calloc(keyc, sizeof(int));
+  if (order == NULL || pos == NULL || (rc = cr_setresult(rhnd, total)) != 0) {
+    rc = CREDIS_ERR_NOMEM;
+    goto out;
+  }
+  for (i = 0; i < keyc; i++)
+    order[i] = &setv[i];
+  v = rhnd->members;
+  n = 0;
+
+  switch (op) {
+  case CR_SETOP_UNION:
+    for (i = 0; i < keyc; i++) {
+      memcpy(v + n, setv[i].members, setv[i].len * sizeof(char *));
+      n += setv[i].len;
+    }
+    qsort(v, n, sizeof(char *), cr_setcmp);
+    for (i = 1, j = n > 0; i < n; i++)
+      if (strcmp(v[i], v[j - 1]))
+        v[j++] = v[i];
+    n = j;
+    break;
 
-int credis_randomkey(REDIS rhnd, char **key)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_INLINE, "RANDOMKEY\r\n");
+  case CR_SETOP_INTER:
+    qsort(order, keyc, sizeof(cr_set *), cr_setlencmp);
+    /* fall through */
+  case CR_SETOP_DIFF:
+    for (i = 0; i < order[0]->len; i++) {
+      member = order[0]->members[i];
+      for (k = 1; k < keyc; k++) {
+        pos[k] = cr_setsearch(order[k]->members, pos[k], order[k]->len, member);
+        if ((pos[k] < order[k]->len && !strcmp(order[k]->members[pos[k]], member)) != 
+            (op == CR_SETOP_INTER))
+          break;
+      }
+      if (k == keyc)
+        v[n++] = member;
+    }
+    break;
+  }
+  rc = n;
 
-  if (rc == 0 && key) 
-    *key = rhnd->reply.line;
+out:
+  for (i = 0; i < keyc; i++) {
+    free(setv[i].offs);
+    free(setv[i].members);
+  }
+  free(setv);
+  free(order);
+  free(pos);
 
   return rc;
 }
 
-int credis_rename(REDIS rhnd, const char *key, const char *new_key_name)
+/* Computes set operation `op' and stores result in `destkey', replacing 
+ * it, with pipelined SADD commands */
+static int cr_setopstore(REDIS *rhndv, int rhndc, int op, const char *destkey, 
+                         int keyc, const char **keyv)
 {
-  return cr_sendfandreceive(rhnd, CR_INLINE, "RENAME %s %s\r\n", 
-                            key, new_key_name);
-}
+  REDIS rhnd;
+  int n, rc;
 
-int credis_renamenx(REDIS rhnd, const char *key, const char *new_key_name)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "RENAMENX %s %s\r\n", 
-                              key, new_key_name);
+  if ((n = cr_setop(rhndv, rhndc, op, keyc, keyv)) < 0)
+    return n;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  rhnd = rhndv[cr_hash(destkey, strlen(destkey)) % rhndc];
+  if ((rc = credis_del(rhnd, destkey)) != 0 && rc != -1)
+    return rc;
+  if (n > 0 && (rc = credis_saddv(rhnd, destkey, n, (const char **) rhndv[0]->members)) < 0)
+    return rc;
 
-  return rc;
+  return n;
 }
 
-int credis_dbsize(REDIS rhnd)
+int credis_sinter_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "DBSIZE\r\n");
+  int rc = cr_setop(rhndv, rhndc, CR_SETOP_INTER, keyc, keyv);
 
-  if (rc == 0) 
-    rc = rhnd->reply.integer;
+  if (rc >= 0)
+    *members = rhndv[0]->members;
 
   return rc;
 }
 
-int credis_expire(REDIS rhnd, const char *key, int secs)
-{ 
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "EXPIRE %s %d\r\n", key, secs);
+int credis_sunion_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members)
+{
+  int rc = cr_setop(rhndv, rhndc, CR_SETOP_UNION, keyc, keyv);
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  if (rc >= 0)
+    *members = rhndv[0]->members;
 
   return rc;
 }
 
-int credis_ttl(REDIS rhnd, const char *key)
+int credis_sdiff_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "TTL %s\r\n", key);
+  int rc = cr_setop(rhndv, rhndc, CR_SETOP_DIFF, keyc, keyv);
 
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  if (rc >= 0)
+    *members = rhndv[0]->members;
 
   return rc;
 }
 
-static int cr_push(REDIS rhnd, int left, const char *key, const char *val)
+int credis_sinterstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                             int keyc, const char **keyv)
 {
-  return cr_sendfandreceive(rhnd, CR_INLINE, "%s %s %zu\r\n%s\r\n", 
-                            left==1?"LPUSH":"RPUSH", key, strlen(val), val);
+  return cr_setopstore(rhndv, rhndc, CR_SETOP_INTER, destkey, keyc, keyv);
 }
 
-int credis_rpush(REDIS rhnd, const char *key, const char *val)
+int credis_sunionstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                             int keyc, const char **keyv)
 {
-  return cr_push(rhnd, 0, key, val);
+  return cr_setopstore(rhndv, rhndc, CR_SETOP_UNION, destkey, keyc, keyv);
 }
 
-int credis_lpush(REDIS rhnd, const char *key, const char *val)
+int credis_sdiffstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                            int keyc, const char **keyv)
 {
-  return cr_push(rhnd, 1, key, val);
+  return cr_setopstore(rhndv, rhndc, CR_SETOP_DIFF, destkey, keyc, keyv);
 }
 
-int credis_llen(REDIS rhnd, const char *key)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "LLEN %s\r\n", key);
-
-  if (rc == 0) 
-    rc = rhnd->reply.integer;
-
-  return rc;
-}
+/*
+ * Parallel MGET
+ */
 
-int credis_lrange(REDIS rhnd, const char *key, int start, int end, char ***valv)
+#define CR_MGET_MIN 16       /* least keys per chunk */
+#define CR_MGET_MAX 16384    /* most keys per chunk */
+#define CR_MGET_FIRST 1024   /* keys per chunk until reply sizes are known */
+#define CR_MGET_REPLY (64 * 1024)        /* least reply bytes per chunk */
+#define CR_MGET_REPLY_MAX (1024 * 1024)  /* most reply bytes per chunk */
+
+/* Returns keys per chunk for `keyc' keys over `rhndc' handles. A chunk
+ * should reply about a bandwidth-delay product, so that commands are few 
+ * while replies of one chunk are parsed as those of the next arrive. Each 
+ * handle gets a chunk of its own if there are few keys. */
+static int cr_mgetchunk(REDIS rhnd, int keyc, int rhndc)
 {
-  int rc;
+  double target = rhnd->mget.rate * rhnd->mget.rtt;
+  int chunk, share = (keyc + rhndc - 1) / rhndc;
 
-  if ((rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "LRANGE %s %d %d\r\n", 
-                               key, start, end)) == 0) {
-    *valv = rhnd->reply.multibulk.bulks;
-    rc = rhnd->reply.multibulk.len;
-  }
+  if (target < CR_MGET_REPLY)
+    target = CR_MGET_REPLY;
+  if (target > CR_MGET_REPLY_MAX)
+    target = CR_MGET_REPLY_MAX;
 
-  return rc;
-}
+  chunk = rhnd->mget.bytes > 0 ? (int) (target / rhnd->mget.bytes) : CR_MGET_FIRST;
+  if (chunk < CR_MGET_MIN)
+    chunk = CR_MGET_MIN;
+  if (chunk > CR_MGET_MAX)
+    chunk = CR_MGET_MAX;
 
-int credis_ltrim(REDIS rhnd, const char *key, int start, int end)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "LTRIM %s %d %d\r\n", 
-                            key, start, end);
+  return chunk < share ? chunk : (share > 0 ? share : 1);
 }
 
-int credis_lindex(REDIS rhnd, const char *key, int index, char **val)
+/* Updates averages of reply bytes per key, round-trip time and transfer 
+ * rate from a round of `keys' keys that replied `bytes' bytes, its first 
+ * reply `first' microseconds and all `all' microseconds after it was sent.
+ * Averages weigh the last round by 1/8, like TCP does for RTT. */
+static void cr_mgettune(REDIS rhnd, int keys, long long bytes, long long first, long long all)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "LINDEX %s %d\r\n", key, index);
-
-  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL)
-    return -1;
-
-  return rc;
-}
+  double rate = all > 0 ? (double) bytes / all : 0;
 
-int credis_lset(REDIS rhnd, const char *key, int index, const char *val)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "LSET %s %d %zu\r\n%s\r\n", 
-                            key, index, strlen(val), val);
-}
+  if (keys == 0)
+    return;
 
-int credis_lrem(REDIS rhnd, const char *key, int count, const char *val)
-{
-  return cr_sendfandreceive(rhnd, CR_INT, "LREM %s %d %zu\r\n%s\r\n", 
-                            key, count, strlen(val), val);
+  if (rhnd->mget.bytes == 0) {
+    rhnd->mget.bytes = (double) bytes / keys;
+    rhnd->mget.rtt = first;
+    rhnd->mget.rate = rate;
+    return;
+  }
+  rhnd->mget.bytes += ((double) bytes / keys - rhnd->mget.bytes) / 8;
+  rhnd->mget.rtt += (first - rhnd->mget.rtt) / 8;
+  rhnd->mget.rate += (rate - rhnd->mget.rate) / 8;
 }
 
-static int cr_pop(REDIS rhnd, int left, const char *key, char **val)
+int credis_mget_parallel(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***valv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "%s %s\r\n", 
-                              left==1?"LPOP":"RPOP", key);
+  REDIS rhnd;
+  cr_multibulk *mb;
+  cr_buffer *values;
+  struct timeval start;
+  const char **argv;
+  long long bytes, first;
+  int *offs;
+  int i, j, k, m, h, c, n, chunk, end, rc, err = 0;
+
+  if (rhndc <= 0 || keyc < 0)
+    return -EINVAL;
+  for (h = 0; h < rhndc; h++)
+    if (!(rhndv[h]->caps & CREDIS_CAP_MULTIBULK))
+      return CREDIS_ERR;
+  rhnd = rhndv[0];
+  values = &(rhnd->values);
+  values->len = 0;
+
+  /* values are kept as offsets until they do not move anymore, -1 for 
+   * keys that do not exist */
+  chunk = cr_mgetchunk(rhnd, keyc, rhndc);
+  if ((offs = malloc((keyc > 0 ? keyc : 1) * sizeof(int))) == NULL)
+    return CREDIS_ERR_NOMEM;
+  if ((argv = malloc((1 + chunk) * sizeof(char *))) == NULL) {
+    free(offs);
+    return CREDIS_ERR_NOMEM;
+  }
+  argv[0] = "MGET";
+
+  /* in each round chunk `c' goes to handle c % rhndc, until every handle 
+   * has been given about CR_CHUNK_SIZE bytes of commands */
+  for (i = 0; i < keyc; i = end) {
+    cr_pipelinereset(rhndv, rhndc);
+    for (c = 0, end = i; end < keyc; ) {
+      n = keyc - end < chunk ? keyc - end : chunk;
+      memcpy(argv + 1, keyv + end, n * sizeof(char *));
+      if ((rc = cr_appendcmdv(&(rhndv[c % rhndc]->buf), 1 + n, argv, NULL)) != 0)
+        goto out;
+      end += n;
+      if (++c % rhndc == 0 && rhndv[rhndc - 1]->buf.len >= CR_CHUNK_SIZE)
+        break;
+    }
+    gettimeofday(&start, NULL);
+    if ((rc = cr_pipelinesend(rhndv, rhndc)) != 0)
+      goto out;
+
+    for (j = 0, k = i, bytes = 0, first = 0; j < c; j++, k += n) {
+      n = end - k < chunk ? end - k : chunk;
+      h = j % rhndc;
+      mb = &(rhndv[h]->reply.multibulk);
+      if ((rc = cr_pipelinereply(rhndv[h], CR_MULTIBULK)) != 0 && 
+          rhndv[h]->reply.type != CR_ERROR)
+        goto out;
+      if (j == 0)
+        first = cr_usecs(&start);
+
+      /* keys of a chunk that failed are reported as missing */
+      if (rc != 0 || mb->len != n) {
+        err = err ? err : (rc ? rc : CREDIS_ERR_PROTOCOL);
+        for (m = 0; m < n; m++)
+          offs[k + m] = -1;
+        continue;
+      }
+      for (m = 0; m < n; m++) {
+        if (mb->lens[m] < 0) {
+          offs[k + m] = -1;
+          continue;
+        }
+        if (values->size - values->len < mb->lens[m] + 1 && 
+            cr_moremem(values, mb->lens[m] + 1)) {
+          rc = CREDIS_ERR_NOMEM;
+          goto out;
+        }
+        offs[k + m] = values->len;
+        memcpy(values->data + values->len, mb->bulks[m], mb->lens[m] + 1);
+        values->len += mb->lens[m] + 1;
+        bytes += mb->lens[m] + 1;
+      }
+    }
+    cr_mgettune(rhnd, end - i, bytes, first, cr_usecs(&start));
+  }
 
-  if (rc == 0 && (*val = rhnd->reply.bulk) == NULL)
-    return -1;
+  if ((rc = cr_setresult(rhnd, keyc)) != 0)
+    goto out;
+  for (i = 0; i < keyc; i++)
+    rhnd->members[i] = offs[i] >= 0 ? values->data + offs[i] : NULL;
+  *valv = rhnd->members;
+  rc = err ? err : keyc;
 
+out:
+  free(argv);
+  free(offs);
   return rc;
 }
 
-int credis_lpop(REDIS rhnd, const char *key, char **val)
-{
-  return cr_pop(rhnd, 1, key, val);
-}
+/*
+ * Keyspace notifications
+ */
 
-int credis_rpop(REDIS rhnd, const char *key, char **val)
+/* Adds the classes of `flags' that are missing to notify-keyspace-events 
+ * of server, keeping the ones already configured by others */
+static int cr_notifyconfig(REDIS rhnd, const char *flags)
 {
-  return cr_pop(rhnd, 0, key, val);
-}
+  cr_multibulk *mb = &(rhnd->reply.multibulk);
+  char events[64];
+  const char *argv[4];
+  int n, len, rc;
+
+  argv[0] = "CONFIG";
+  argv[1] = "GET";
+  argv[2] = "notify-keyspace-events";
+  if ((rc = cr_sendcmd(rhnd, CR_MULTIBULK, 3, argv)) != 0)
+    return rc;
+  if (mb->len != 2 || mb->lens[1] < 0 || mb->lens[1] >= (int) sizeof(events) / 2)
+    return CREDIS_ERR_PROTOCOL;
+  memcpy(events, mb->bulks[1], mb->lens[1] + 1);
+
+  /* "A" is an alias for all classes of keys but not for K and E */
+  for (n = len = strlen(events); *flags != '\0'; flags++) {
+    if (strchr(events, *flags) == NULL && 
+        (strchr(events, 'A') == NULL || *flags == 'K' || *flags == 'E')) {
+      if (n == (int) sizeof(events) - 1)
+        return -EINVAL;
+      events[n++] = *flags;
+      events[n] = '\0';
+    }
+  }
+  if (n == len)
+    return 0;
 
-int credis_select(REDIS rhnd, int index)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "SELECT %d\r\n", index);
+  argv[1] = "SET";
+  argv[3] = events;
+  return cr_sendcmd(rhnd, CR_INLINE, 4, argv);
 }
 
-int credis_move(REDIS rhnd, const char *key, int index)
+/* Opens a connection to the server of `rhnd' on which `cmd' (SUBSCRIBE or
+ * PSUBSCRIBE) is sent for the `channelc' channels of `channelv' */
+static REDIS cr_subscribe(REDIS rhnd, const char *cmd, int channelc, const char **channelv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "MOVE %s %d\r\n", key, index);
+  REDIS sub;
+  const char *argv[1 + CR_BATCH_CHUNK];
+  int i;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  if (channelc <= 0 || channelc > CR_BATCH_CHUNK || 
+      (sub = cr_connectlike(rhnd)) == NULL)
+    return NULL;
 
-  return rc;
-}
+  argv[0] = cmd;
+  for (i = 0; i < channelc; i++)
+    argv[1 + i] = channelv[i];
+  cr_pipelinereset(&sub, 1);
+  if (cr_appendcmdv(&(sub->buf), 1 + channelc, argv, NULL) != 0 || 
+      cr_sendandreceive(sub, CR_MULTIBULK) != 0)
+    goto error;
 
-int credis_flushdb(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "FLUSHDB\r\n");
-}
+  /* each channel is confirmed by a reply of its own */
+  for (i = 1; i < channelc; i++)
+    if (cr_readreply(sub, CR_MULTIBULK) != 0)
+      goto error;
 
-int credis_flushall(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "FLUSHALL\r\n");
+  return sub;
+
+error:
+  credis_close(sub);
+  return NULL;
 }
 
-int credis_sort(REDIS rhnd, const char *query, char ***elementv)
+/* Reads next message of subscribed handle into its reply, waiting at most 
+ * `timeout' milliseconds for it unless already received.
+ * Returns:
+ *   1  a message was read
+ *   0  no message arrived within timeout
+ *  <0  on error */
+static int cr_message(REDIS sub, int timeout)
 {
   int rc;
 
-  if ((rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "SORT %s\r\n", query)) == 0) {
-    *elementv = rhnd->reply.multibulk.bulks;
-    rc = rhnd->reply.multibulk.len;
-  }
+  if (sub->buf.idx == sub->buf.len && (rc = cr_readable(sub, timeout)) <= 0)
+    return rc == 0 ? 0 : CREDIS_ERR_RECV;
+  if ((rc = cr_pipelinereply(sub, CR_MULTIBULK)) != 0)
+    return rc;
 
-  return rc;
+  return 1;
 }
 
-int credis_save(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "SAVE\r\n");
-}
+#define CR_NOTIFY_BATCH 256 /* events per callback unless less is asked for */
 
-int credis_bgsave(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "BGSAVE\r\n");
-}
+typedef struct _cr_notify {
+  REDIS sub;
+  char *match;        /* pattern of keys delivered, NULL for all */
+  char *events;       /* " "-separated event types delivered, NULL for all */
+  struct {
+    int key;
+    int event;
+  } *offs;            /* of events in receive buffer while batch is read */
+  REDIS_EVENT *eventv;
+  int size;
+} cr_notify;
 
-int credis_lastsave(REDIS rhnd)
+/* Parses message or pmessage in reply of subscribed handle into event, 
+ * with key and event as offsets into receive buffer since it may move 
+ * before batch is complete.
+ * Returns 0 if event is to be delivered, -1 if filtered */
+static int cr_notifyparse(cr_notify *n, REDIS_EVENT *event, int *key, int *type)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "LASTSAVE\r\n");
+  cr_multibulk *mb = &(n->sub->reply.multibulk);
+  char *channel, *payload, *name;
+  int c, space;
+
+  if (mb->len == 3 && mb->lens[0] == 7 && !strcmp(mb->bulks[0], "message"))
+    c = 1;
+  else if (mb->len == 4 && mb->lens[0] == 8 && !strcmp(mb->bulks[0], "pmessage"))
+    c = 2;
+  else
+    return -1;
+  channel = mb->bulks[c];
+  payload = mb->bulks[c + 1];
 
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  /* channel is "__keyspace@<db>__:<key>" or "__keyevent@<db>__:<event>" */
+  if (channel == NULL || payload == NULL || (name = strstr(channel, "__:")) == NULL)
+    return -1;
+  if (!strncmp(channel, "__keyspace@", 11))
+    space = 1;
+  else if (!strncmp(channel, "__keyevent@", 11))
+    space = 0;
+  else
+    return -1;
+  event->db = atoi(channel + 11);
+  name += 3;
 
-  return rc;
-}
+  event->key = space ? name : payload;
+  event->keylen = space ? mb->lens[c] - (name - channel) : mb->lens[c + 1];
+  event->event = space ? payload : name;
+  event->eventlen = space ? mb->lens[c + 1] : mb->lens[c] - (name - channel);
 
-int credis_shutdown(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "SHUTDOWN\r\n");
-}
+  if (n->match != NULL && fnmatch(n->match, event->key, 0) != 0)
+    return -1;
+  if (n->events != NULL) {
+    for (name = n->events; (name = strstr(name, event->event)) != NULL; name++)
+      if (name[-1] == ' ' && name[event->eventlen] == ' ')
+        break;
+    if (name == NULL)
+      return -1;
+  }
 
-int credis_bgrewriteaof(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "BGREWRITEAOF\r\n");
-}
+  *key = event->key - n->sub->buf.data;
+  *type = event->event - n->sub->buf.data;
 
-/* Parse Redis `info' string for a particular `field', storing its value to 
- * `storage' according to `format'.
- */
-void cr_parseinfo(const char *info, const char *field, const char *format, void *storage)
-{
-  char *str = strstr(info, field);
-  if (str) {
-    str += strlen(field) + 1; /* also skip the ':' */
-    sscanf(str, format, storage); 
-  }
+  return 0;
 }
 
-int credis_info(REDIS rhnd, REDIS_INFO *info)
+REDIS_NOTIFY credis_notify_open(REDIS rhnd, const char *flags, 
+                                int patternc, const char **patternv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "INFO\r\n");
+  cr_notify *n;
+  char pattern[32];
+  const char *all = pattern;
 
-  if (rc == 0) {
-    char role;
-    memset(info, 0, sizeof(REDIS_INFO));
-    cr_parseinfo(rhnd->reply.bulk, "redis_version", "%"CR_VERSION_STRING_SIZE_STR"s\r\n", &(info->redis_version));
-    cr_parseinfo(rhnd->reply.bulk, "arch_bits", "%d", &(info->arch_bits));
-    cr_parseinfo(rhnd->reply.bulk, "multiplexing_api", "%"CR_MULTIPLEXING_API_SIZE_STR"s\r\n", &(info->multiplexing_api));
-    cr_parseinfo(rhnd->reply.bulk, "process_id", "%ld", &(info->process_id));
-    cr_parseinfo(rhnd->reply.bulk, "uptime_in_seconds", "%ld", &(info->uptime_in_seconds));
-    cr_parseinfo(rhnd->reply.bulk, "uptime_in_days", "%ld", &(info->uptime_in_days));
-    cr_parseinfo(rhnd->reply.bulk, "connected_clients", "%d", &(info->connected_clients));
-    cr_parseinfo(rhnd->reply.bulk, "connected_slaves", "%d", &(info->connected_slaves));
-    cr_parseinfo(rhnd->reply.bulk, "blocked_clients", "%d", &(info->blocked_clients));
-    cr_parseinfo(rhnd->reply.bulk, "used_memory", "%zu", &(info->used_memory));
-    cr_parseinfo(rhnd->reply.bulk, "used_memory_human", "%"CR_USED_MEMORY_HUMAN_SIZE_STR"s", &(info->used_memory_human));
-    cr_parseinfo(rhnd->reply.bulk, "changes_since_last_save", "%lld", &(info->changes_since_last_save));
-    cr_parseinfo(rhnd->reply.bulk, "bgsave_in_progress", "%d", &(info->bgsave_in_progress));
-    cr_parseinfo(rhnd->reply.bulk, "last_save_time", "%ld", &(info->last_save_time));
-    cr_parseinfo(rhnd->reply.bulk, "bgrewriteaof_in_progress", "%d", &(info->bgrewriteaof_in_progress));
-    cr_parseinfo(rhnd->reply.bulk, "total_connections_received", "%lld", &(info->total_connections_received));
-    cr_parseinfo(rhnd->reply.bulk, "total_commands_processed", "%lld", &(info->total_commands_processed));
-    cr_parseinfo(rhnd->reply.bulk, "expired_keys", "%lld", &(info->expired_keys));
-    cr_parseinfo(rhnd->reply.bulk, "hash_max_zipmap_entries", "%zu", &(info->hash_max_zipmap_entries));
-    cr_parseinfo(rhnd->reply.bulk, "hash_max_zipmap_value", "%zu", &(info->hash_max_zipmap_value));
-    cr_parseinfo(rhnd->reply.bulk, "pubsub_channels", "%ld", &(info->pubsub_channels));
-    cr_parseinfo(rhnd->reply.bulk, "pubsub_patterns", "%u", &(info->pubsub_patterns));
-    cr_parseinfo(rhnd->reply.bulk, "vm_enabled", "%d", &(info->vm_enabled));
-    cr_parseinfo(rhnd->reply.bulk, "role", "%c", &role);
+  if ((n = calloc(1, sizeof(cr_notify))) == NULL)
+    return NULL;
 
-    info->role = ((role=='m')?CREDIS_SERVER_MASTER:CREDIS_SERVER_SLAVE);
+  /* servers where CONFIG is not allowed may have notifications enabled */
+  if (flags != NULL)
+    cr_notifyconfig(rhnd, flags);
+
+  /* events of all keys of the selected database by default */
+  if (patternc == 0) {
+    snprintf(pattern, sizeof(pattern), "__keyevent@%d__:*", rhnd->db);
+    patternc = 1;
+    patternv = &all;
   }
-  
-  return rc;
-}
 
-int credis_monitor(REDIS rhnd)
-{
-  return cr_sendfandreceive(rhnd, CR_INLINE, "MONITOR\r\n");
+  if ((n->sub = cr_subscribe(rhnd, "PSUBSCRIBE", patternc, patternv)) == NULL) {
+    free(n);
+    return NULL;
+  }
+
+  return n;
 }
 
-int credis_slaveof(REDIS rhnd, const char *host, int port)
+int credis_notify_filter(REDIS_NOTIFY n, const char *match, const char *events)
 {
-  if (host == NULL || port == 0)
-    return cr_sendfandreceive(rhnd, CR_INLINE, "SLAVEOF no one\r\n");
-  else
-    return cr_sendfandreceive(rhnd, CR_INLINE, "SLAVEOF %s %d\r\n", host, port);
+  free(n->match);
+  free(n->events);
+  n->match = n->events = NULL;
+
+  if (match != NULL && (n->match = strdup(match)) == NULL)
+    return CREDIS_ERR_NOMEM;
+
+  /* padded with spaces so that each type is looked up as " <type> " */
+  if (events != NULL) {
+    if ((n->events = malloc(strlen(events) + 3)) == NULL)
+      return CREDIS_ERR_NOMEM;
+    sprintf(n->events, " %s ", events);
+  }
+
+  return 0;
 }
 
-static int cr_setaddrem(REDIS rhnd, const char *cmd, const char *key, const char *member)
+int credis_notify_poll(REDIS_NOTIFY n, int timeout, int max, 
+                       REDIS_EVENT_CALLBACK callback, void *arg)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "%s %s %zu\r\n%s\r\n", 
-                              cmd, key, strlen(member), member);
+  cr_buffer *buf = &(n->sub->buf);
+  void *ptr;
+  int i, len = 0, rc;
+
+  if (max <= 0)
+    max = CR_NOTIFY_BATCH;
+  if (max > n->size) {
+    if ((ptr = realloc(n->offs, max * sizeof(*n->offs))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    n->offs = ptr;
+    if ((ptr = realloc(n->eventv, max * sizeof(REDIS_EVENT))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    n->eventv = ptr;
+    n->size = max;
+  }
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  /* batch ends when no more messages are at hand, messages are read 
+   * without compacting buffer so that events can point into it */
+  cr_compactbuffer(buf);
+  while (len < max) {
+    if (buf->idx == buf->len && (rc = cr_readable(n->sub, len ? 0 : timeout)) <= 0) {
+      if (rc == 0)
+        break;
+      return CREDIS_ERR_RECV;
+    }
+    if ((rc = cr_readreply(n->sub, CR_MULTIBULK)) != 0)
+      return rc;
+    if (cr_notifyparse(n, &n->eventv[len], &n->offs[len].key, &n->offs[len].event) == 0)
+      len++;
+  }
 
-  return rc;
+  if (len == 0)
+    return 0;
+  for (i = 0; i < len; i++) {
+    n->eventv[i].key = buf->data + n->offs[i].key;
+    n->eventv[i].event = buf->data + n->offs[i].event;
+  }
+  if ((rc = callback(n->eventv, len, arg)) != 0)
+    return rc;
+
+  return len;
 }
 
-int credis_sadd(REDIS rhnd, const char *key, const char *member)
+void credis_notify_close(REDIS_NOTIFY n)
 {
-  return cr_setaddrem(rhnd, "SADD", key, member);
+  if (n == NULL)
+    return;
+  credis_close(n->sub);
+  free(n->match);
+  free(n->events);
+  free(n->offs);
+  free(n->eventv);
+  free(n);
 }
 
-int credis_srem(REDIS rhnd, const char *key, const char *member)
+/*
+ * Sorted set views
+ */
+
+typedef struct _cr_zview {
+  REDIS rhnd;         /* of which sorted set is read */
+  REDIS sub;          /* subscribed to notifications of key */
+  char channel[CR_SUBKEY_SIZE];
+  char *key;
+  int stale;          /* set has changed since it was read */
+  cr_buffer values;   /* members of set */
+  char **members;     /* by rank */
+  char **reverse;     /* by reverse rank */
+  double *scores;
+  int len;
+  int *index;         /* rank + 1 of member by hash, 0 for empty slot */
+  int indexsize;
+} cr_zview;
+
+/* Returns slot of `member' in index of view, which is either the slot 
+ * holding its rank or the empty slot where it would be */
+static int *cr_zviewslot(cr_zview *view, const char *member)
 {
-  return cr_setaddrem(rhnd, "SREM", key, member);
+  unsigned int mask = view->indexsize - 1;
+  unsigned int i = (unsigned int) cr_hash(member, strlen(member)) & mask;
+
+  while (view->index[i] != 0 && strcmp(view->members[view->index[i] - 1], member))
+    i = (i + 1) & mask;
+
+  return &view->index[i];
 }
 
-int credis_spop(REDIS rhnd, const char *key, char **member)
+/* Reads whole sorted set with ZRANGE WITHSCORES and indexes its members */
+static int cr_zviewload(cr_zview *view)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "SPOP %s\r\n", key);
+  REDIS rhnd = view->rhnd;
+  cr_multibulk *mb = &(rhnd->reply.multibulk);
+  const char *argv[] = {"ZRANGE", view->key, "0", "-1", "WITHSCORES"};
+  void *ptr;
+  int i, n, size, total, rc;
+
+  cr_pipelinereset(&rhnd, 1);
+  if ((rc = cr_appendcmdv(&(rhnd->buf), 5, argv, NULL)) != 0 ||
+      (rc = cr_sendandreceive(rhnd, CR_MULTIBULK)) != 0)
+    return rc;
+  if (mb->len % 2 != 0)
+    return CREDIS_ERR_PROTOCOL;
+  n = mb->len / 2;
 
-  if (rc == 0 && (*member = rhnd->reply.bulk) == NULL)
-    rc = -1;
+  /* values are sized before they are copied so members do not move */
+  for (i = 0, total = 0; i < n; i++)
+    total += mb->lens[2 * i] + 1;
+  if (total > view->values.size && cr_moremem(&(view->values), total - view->values.size))
+    return CREDIS_ERR_NOMEM;
+  for (size = 1; size < 2 * n; size *= 2)
+    ;
+  if (n > view->len) {
+    if ((ptr = realloc(view->members, n * sizeof(char *))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    view->members = ptr;
+    if ((ptr = realloc(view->reverse, n * sizeof(char *))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    view->reverse = ptr;
+    if ((ptr = realloc(view->scores, n * sizeof(double))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    view->scores = ptr;
+  }
+  if (size != view->indexsize) {
+    if ((ptr = realloc(view->index, size * sizeof(int))) == NULL)
+      return CREDIS_ERR_NOMEM;
+    view->index = ptr;
+    view->indexsize = size;
+  }
 
-  return rc;
+  memset(view->index, 0, size * sizeof(int));
+  view->values.len = 0;
+  for (i = 0; i < n; i++) {
+    view->members[i] = view->values.data + view->values.len;
+    view->reverse[n - 1 - i] = view->members[i];
+    memcpy(view->members[i], mb->bulks[2 * i], mb->lens[2 * i] + 1);
+    view->values.len += mb->lens[2 * i] + 1;
+    view->scores[i] = strtod(mb->bulks[2 * i + 1], NULL);
+    *cr_zviewslot(view, view->members[i]) = i + 1;
+  }
+  view->len = n;
+  view->stale = 0;
+
+  return 0;
 }
 
-int credis_smove(REDIS rhnd, const char *sourcekey, const char *destkey, 
-                 const char *member)
+/* Brings view up to date. Notifications received since last time mark it 
+ * as stale, after which it is read again, so that a burst of changes costs
+ * one read. A lost subscription is made again, set may have changed while 
+ * it was lost. */
+static int cr_zviewsync(cr_zview *view)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "SMOVE %s %s %s\r\n", 
-                              sourcekey, destkey, member);
-
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+  const char *channel = view->channel;
+  int rc = CREDIS_ERR_RECV;
+
+  if (view->sub != NULL)
+    while ((rc = cr_message(view->sub, 0)) == 1)
+      view->stale = 1;
+
+  if (rc < 0) {
+    if (view->sub != NULL)
+      credis_close(view->sub);
+    view->sub = cr_subscribe(view->rhnd, "SUBSCRIBE", 1, &channel);
+    if (view->sub == NULL)
+      return rc;
+    view->stale = 1;
+  }
 
-  return rc;
+  return view->stale ? cr_zviewload(view) : 0;
 }
 
-int credis_scard(REDIS rhnd, const char *key) 
+REDIS_ZVIEW credis_zview_open(REDIS rhnd, const char *key)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "SCARD %s\r\n", key);
+  cr_zview *view;
+  const char *channel;
 
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  if ((view = calloc(1, sizeof(cr_zview))) == NULL)
+    return NULL;
+  view->rhnd = rhnd;
+  snprintf(view->channel, sizeof(view->channel), "__keyspace@%d__:%s", rhnd->db, key);
+  channel = view->channel;
+
+  /* servers where CONFIG is not allowed may have notifications enabled */
+  cr_notifyconfig(rhnd, "Kgzxe");
+
+  /* subscription is made before set is read so that no change is missed */
+  if ((view->key = strdup(key)) == NULL || 
+      (view->sub = cr_subscribe(rhnd, "SUBSCRIBE", 1, &channel)) == NULL ||
+      cr_zviewload(view) != 0) {
+    credis_zview_close(view);
+    return NULL;
+  }
 
-  return rc;
+  return view;
 }
 
-int credis_sinter(REDIS rhnd, int keyc, const char **keyv, char ***members)
+void credis_zview_close(REDIS_ZVIEW view)
 {
-  return cr_multikeybulkcommand(rhnd, "SINTER", keyc, keyv, members);
+  if (view == NULL)
+    return;
+  if (view->sub != NULL)
+    credis_close(view->sub);
+  free(view->key);
+  free(view->values.data);
+  free(view->members);
+  free(view->reverse);
+  free(view->scores);
+  free(view->index);
+  free(view);
 }
 
-int credis_sunion(REDIS rhnd, int keyc, const char **keyv, char ***members)
+int credis_zview_zcard(REDIS_ZVIEW view)
 {
-  return cr_multikeybulkcommand(rhnd, "SUNION", keyc, keyv, members);
+  int rc;
+
+  if ((rc = cr_zviewsync(view)) != 0)
+    return rc;
+
+  return view->len > 0 ? view->len : -1;
 }
 
-int credis_sdiff(REDIS rhnd, int keyc, const char **keyv, char ***members)
+int credis_zview_zscore(REDIS_ZVIEW view, const char *member, double *score)
 {
-  return cr_multikeybulkcommand(rhnd, "SDIFF", keyc, keyv, members);
+  int rc, *slot;
+
+  if ((rc = cr_zviewsync(view)) != 0)
+    return rc;
+  if (view->len == 0 || *(slot = cr_zviewslot(view, member)) == 0)
+    return -1;
+  *score = view->scores[*slot - 1];
+
+  return 0;
 }
 
-int credis_sinterstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+static int cr_zviewrank(cr_zview *view, int reverse, const char *member)
 {
-  return cr_multikeystorecommand(rhnd, "SINTERSTORE", destkey, keyc, keyv);
+  int rc, *slot;
+
+  if ((rc = cr_zviewsync(view)) != 0)
+    return rc;
+  if (view->len == 0 || *(slot = cr_zviewslot(view, member)) == 0)
+    return -1;
+
+  return reverse ? view->len - *slot : *slot - 1;
 }
 
-int credis_sunionstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+int credis_zview_zrank(REDIS_ZVIEW view, const char *member)
 {
-  return cr_multikeystorecommand(rhnd, "SUNIONSTORE", destkey, keyc, keyv);
+  return cr_zviewrank(view, 0, member);
 }
 
-int credis_sdiffstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv)
+int credis_zview_zrevrank(REDIS_ZVIEW view, const char *member)
 {
-  return cr_multikeystorecommand(rhnd, "SDIFFSTORE", destkey, keyc, keyv);
+  return cr_zviewrank(view, 1, member);
 }
 
-int credis_sismember(REDIS rhnd, const char *key, const char *member)
+static int cr_zviewrange(cr_zview *view, int reverse, int start, int end, char ***elementv)
 {
-  return cr_setaddrem(rhnd, "SISMEMBER", key, member);
+  int rc;
+
+  if ((rc = cr_zviewsync(view)) != 0)
+    return rc;
+
+  /* like Redis, negative indexes count from the end of the set */
+  if (start < 0)
+    start += view->len;
+  if (end < 0)
+    end += view->len;
+  if (start < 0)
+    start = 0;
+  if (end >= view->len)
+    end = view->len - 1;
+  if (start > end)
+    return 0;
+
+  *elementv = (reverse ? view->reverse : view->members) + start;
+
+  return end - start + 1;
 }
 
-int credis_smembers(REDIS rhnd, const char *key, char ***members)
+int credis_zview_zrange(REDIS_ZVIEW view, int start, int end, char ***elementv)
 {
-  return cr_multikeybulkcommand(rhnd, "SMEMBERS", 1, &key, members);
+  return cr_zviewrange(view, 0, start, end, elementv);
 }
 
-int credis_zadd(REDIS rhnd, const char *key, double score, const char *member)
+int credis_zview_zrevrange(REDIS_ZVIEW view, int start, int end, char ***elementv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZADD %s %f %zu\r\n%s\r\n", 
-                              key, score, strlen(member), member);
+  return cr_zviewrange(view, 1, start, end, elementv);
+}
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+/*
+ * Streams
+ */
 
-  return rc;
-}
+#define CR_STREAM_ID_SIZE 48 /* "<milliseconds>-<sequence>" */
 
-int credis_zrem(REDIS rhnd, const char *key, const char *member)
+typedef struct _cr_stream {
+  REDIS rhnd;
+  char *key;
+  char *group;
+  char *consumer;
+  cr_buffer acks;                 /* IDs to acknowledge, as bulk arguments */
+  int ackc;
+  int history;                    /* set while own pending entries are read */
+  char start[CR_STREAM_ID_SIZE];  /* of last history entry handled */
+  char cursor[CR_STREAM_ID_SIZE]; /* where next claim starts */
+} cr_stream;
+
+int credis_xaddv(REDIS rhnd, const char *key, int maxlen, int entryc,
+                 const int *fieldcv, const char **fieldv, char **idv)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZREM %s %zu\r\n%s\r\n", 
-                              key, strlen(member), member);
+  cr_buffer *buf = &(rhnd->buf), *values = &(rhnd->values);
+  const char **pair = fieldv;
+  char trim[16], *id;
+  int i, j, k, end, rc, len, ok = 0;
+
+  if (!(rhnd->caps & CREDIS_CAP_STREAMS))
+    return CREDIS_ERR;
+
+  values->len = 0;
+  snprintf(trim, sizeof(trim), "%d", maxlen);
+  if (entryc > 0)
+    cr_filteradd(rhnd, key);
+
+  for (i = 0; i < entryc; i = end) {
+    end = i + CR_BATCH_CHUNK < entryc ? i + CR_BATCH_CHUNK : entryc;
+    cr_pipelinereset(&rhnd, 1);
+    for (j = i; j < end; j++) {
+      /* stream is trimmed approximately, i.e. only whole nodes are removed */
+      if ((rc = cr_appendstrf(buf, "*%d\r\n$4\r\nXADD\r\n$%zu\r\n%s\r\n",
+                              3 + (maxlen > 0 ? 3 : 0) + 2 * fieldcv[j], strlen(key), key)) != 0 ||
+          (maxlen > 0 && (rc = cr_appendstrf(buf, "$6\r\nMAXLEN\r\n$1\r\n~\r\n$%zu\r\n%s\r\n",
+                                             strlen(trim), trim)) != 0) ||
+          (rc = cr_appendstr(buf, "$1\r\n*\r\n", 0)) != 0)
+        goto error;
+      for (k = 0; k < 2 * fieldcv[j]; k++, pair++)
+        if ((rc = cr_appendstrf(buf, "$%zu\r\n%s\r\n", strlen(*pair), *pair)) != 0)
+          goto error;
+      if (buf->len >= CR_CHUNK_SIZE)
+        end = j + 1;
+    }
+    if ((rc = cr_pipelinesend(&rhnd, 1)) != 0)
+      goto error;
 
-  if (rc == 0 && rhnd->reply.integer == 0)
-    rc = -1;
+    for (j = i; j < end; j++) {
+      if ((rc = cr_pipelinereply(rhnd, CR_BULK)) != 0) {
+        if (rhnd->reply.type != CR_ERROR)
+          goto error;
+        if (idv != NULL)
+          idv[j] = NULL;
+        continue;
+      }
+      ok++;
+      if (idv == NULL)
+        continue;
+      len = strlen(rhnd->reply.bulk) + 1;
+      if (values->size - values->len < len && cr_moremem(values, len)) {
+        rc = CREDIS_ERR_NOMEM;
+        goto error;
+      }
+      memcpy(values->data + values->len, rhnd->reply.bulk, len);
+      values->len += len;
+      idv[j] = values->data;
+    }
+  }
 
-  return rc;
-}
+  /* IDs are stored one after another, point them out when they do not
+   * move anymore */
+  if (idv != NULL) {
+    for (i = 0, id = values->data; i < entryc; i++) {
+      if (idv[i] != NULL) {
+        idv[i] = id;
+        id += strlen(id) + 1;
+      }
+    }
+  }
 
-/* TODO what does Redis return if member is not member of set? */
-int credis_zincrby(REDIS rhnd, const char *key, double incr_score, const char *member, double *new_score)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "ZINCRBY %s %f %zu\r\n%s\r\n", 
-                              key, incr_score, strlen(member), member);
+  return ok;
 
-  if (rc == 0 && new_score)
-    *new_score = strtod(rhnd->reply.bulk, NULL);
+error:
+  if (idv != NULL)
+    memset(idv, 0, entryc * sizeof(char *));
 
   return rc;
 }
 
-/* TODO what does Redis return if member is not member of set? */
-static int cr_zrank(REDIS rhnd, int reverse, const char *key, const char *member)
+int credis_xgroup_create(REDIS rhnd, const char *key, const char *group,
+                         const char *id, int mkstream)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "%s %s %zu\r\n%s\r\n", 
-                              reverse==1?"ZREVRANK":"ZRANK", key, strlen(member), member);
+  const char *argv[] = {"XGROUP", "CREATE", key, group, id ? id : "$", "MKSTREAM"};
+  int rc;
 
-  if (rc == 0)
-    rc = atoi(rhnd->reply.bulk);
+  if (!(rhnd->caps & CREDIS_CAP_STREAMS))
+    return CREDIS_ERR;
 
-  return rc;
-}
+  if (mkstream)
+    cr_filteradd(rhnd, key);
+  rc = cr_sendcmd(rhnd, CR_INLINE, mkstream ? 6 : 5, argv);
+  if (rc != 0 && rhnd->reply.type == CR_ERROR && !strncmp(rhnd->reply.line, "BUSYGROUP", 9))
+    return 1;
 
-int credis_zrank(REDIS rhnd, const char *key, const char *member)
-{
-  return cr_zrank(rhnd, 0, key, member);
+  return rc;
 }
 
-int credis_zrevrank(REDIS rhnd, const char *key, const char *member)
+REDIS_STREAM credis_stream_open(REDIS rhnd, const char *key, const char *group,
+                                const char *consumer)
 {
-  return cr_zrank(rhnd, 1, key, member);
-}
+  cr_stream *s;
 
-int cr_zrange(REDIS rhnd, int reverse, const char *key, int start, int end, char ***elementv)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_MULTIBULK, "%s %s %d %d\r\n",
-                              reverse==1?"ZREVRANGE":"ZRANGE", key, start, end);
+  if (!(rhnd->caps & CREDIS_CAP_STREAMS) || (s = calloc(1, sizeof(cr_stream))) == NULL)
+    return NULL;
 
-  if (rc == 0) {
-    *elementv = rhnd->reply.multibulk.bulks;
-    rc = rhnd->reply.multibulk.len;
+  s->rhnd = rhnd;
+  if ((s->key = strdup(key)) == NULL || (s->group = strdup(group)) == NULL ||
+      (s->consumer = strdup(consumer)) == NULL) {
+    credis_stream_close(s);
+    return NULL;
   }
 
-  return rc;
-}
+  /* entries delivered to an earlier incarnation of consumer but never
+   * acknowledged, e.g. since it crashed, are read before new ones */
+  s->history = 1;
+  strcpy(s->start, "0");
+  strcpy(s->cursor, "0-0");
 
-int credis_zrange(REDIS rhnd, const char *key, int start, int end, char ***elementv)
-{
-  return cr_zrange(rhnd, 0, key, start, end, elementv);
+  return s;
 }
 
-int credis_zrevrange(REDIS rhnd, const char *key, int start, int end, char ***elementv)
+/* Sends command of `argc' arguments in `argv' preceded by XACK of entries
+ * acknowledged since last command, and receives reply of command waiting
+ * `wait' milliseconds longer than timeout of handle */
+static int cr_streamcmd(cr_stream *s, int argc, const char **argv, int wait)
 {
-  return cr_zrange(rhnd, 1, key, start, end, elementv);
-}
+  REDIS rhnd = s->rhnd;
+  cr_buffer *buf = &(rhnd->buf);
+  int rc, saved;
 
-int credis_zcard(REDIS rhnd, const char *key)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZCARD %s\r\n", key);
+  cr_pipelinereset(&rhnd, 1);
+  if (s->ackc > 0) {
+    if ((rc = cr_appendstrf(buf, "*%d\r\n$4\r\nXACK\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+                            3 + s->ackc, strlen(s->key), s->key, strlen(s->group), s->group)) != 0)
+      return rc;
+    if (buf->size - buf->len < s->acks.len && cr_moremem(buf, s->acks.len))
+      return CREDIS_ERR_NOMEM;
+    memcpy(buf->data + buf->len, s->acks.data, s->acks.len);
+    buf->len += s->acks.len;
+  }
+  if (argc > 0 && (rc = cr_appendcmdv(buf, argc, argv, NULL)) != 0)
+    return rc;
+  if ((rc = cr_pipelinesend(&rhnd, 1)) != 0)
+    return rc;
 
-  if (rc == 0) {
-    if (rhnd->reply.integer == 0)
-      rc = -1;
-    else
-      rc = rhnd->reply.integer;
+  if (s->ackc > 0) {
+    s->ackc = 0;
+    s->acks.len = 0;
+    if ((rc = cr_pipelinereply(rhnd, CR_INT)) != 0 && rhnd->reply.type != CR_ERROR)
+      return rc;
   }
+  if (argc == 0)
+    return 0;
+
+  saved = rhnd->timeout;
+  rhnd->timeout += wait;
+  rc = cr_pipelinereply(rhnd, CR_MULTIBULK);
+  rhnd->timeout = saved;
 
   return rc;
 }
 
-int credis_zscore(REDIS rhnd, const char *key, const char *member, double *score)
+/* Delivers `n' entries of reply from item `*i' and on to `callback', until
+ * it returns non-zero which is stored in `stop', leaving `*i' at the entry 
+ * it was returned for. Entries delivered are acknowledged with next command
+ * and ID of the last one is copied to `last' unless NULL.
+ * Returns:
+ *  >=0  number of entries acknowledged
+ *  <0   on error */
+static int cr_streamentries(cr_stream *s, int *i, int n, char *last, int *stop,
+                            REDIS_STREAM_CALLBACK callback, void *arg)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_BULK, "ZSCORE %s %zu\r\n%s\r\n", 
-                              key, strlen(member), member);
+  cr_multibulk *mb = &(s->rhnd->reply.multibulk);
+  REDIS_STREAM_ENTRY entry;
+  int next, acked = 0;
+
+  for (; n > 0; n--, *i = next) {
+    /* entry is an ID followed by its fields and values, claimed entries 
+     * that have been deleted are nil */
+    if (*i < mb->len && mb->types[*i] == CR_MULTIBULK && mb->lens[*i] == -1) {
+      next = *i + 1;
+      continue;
+    }
+    if (*i + 2 >= mb->len || mb->types[*i] != CR_MULTIBULK || mb->types[*i + 1] != CR_BULK ||
+        mb->types[*i + 2] != CR_MULTIBULK || mb->lens[*i + 1] >= CR_STREAM_ID_SIZE)
+      return CREDIS_ERR_PROTOCOL;
+    entry.id = mb->bulks[*i + 1];
+    entry.idlen = mb->lens[*i + 1];
+    entry.fieldc = mb->lens[*i + 2] > 0 ? mb->lens[*i + 2] / 2 : 0;
+    entry.fieldv = (const char * const *) mb->bulks + *i + 3;
+    entry.lenv = mb->lens + *i + 3;
+    if ((next = *i + 3 + 2 * entry.fieldc) > mb->len)
+      return CREDIS_ERR_PROTOCOL;
 
-  if (rc == 0) {
-    if (!rhnd->reply.bulk)
-      rc = -1;
-    else if (score)
-      *score = strtod(rhnd->reply.bulk, NULL);
+    if ((*stop = callback(&entry, arg)) != 0)
+      break;
+
+    if (cr_appendstrf(&(s->acks), "$%d\r\n%s\r\n", entry.idlen, entry.id) != 0)
+      return CREDIS_ERR_NOMEM;
+    s->ackc++;
+    acked++;
+    if (last != NULL)
+      memcpy(last, entry.id, entry.idlen + 1);
   }
 
-  return rc;
+  return acked;
 }
 
-int credis_zremrangebyscore(REDIS rhnd, const char *key, double min, double max)
+int credis_stream_read(REDIS_STREAM s, int count, int block,
+                       REDIS_STREAM_CALLBACK callback, void *arg)
 {
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZREMRANGEBYSCORE %s %f %f\r\n", 
-                              key, min, max);
-
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  cr_multibulk *mb = &(s->rhnd->reply.multibulk);
+  char num[16], msecs[16];
+  const char *argv[] = {"XREADGROUP", "GROUP", s->group, s->consumer, "COUNT", num,
+                        "BLOCK", msecs, "STREAMS", s->key, ">"};
+  int i, n, rc, stop = 0;
+
+  if (count <= 0)
+    count = 256;
+  snprintf(num, sizeof(num), "%d", count);
+  snprintf(msecs, sizeof(msecs), "%d", block);
+
+  for (;;) {
+    /* history is read without blocking from last entry handled on */
+    if (s->history || block <= 0) {
+      argv[6] = "STREAMS";
+      argv[7] = s->key;
+      argv[8] = s->history ? s->start : ">";
+      rc = cr_streamcmd(s, 9, argv, 0);
+    }
+    else {
+      argv[6] = "BLOCK";
+      argv[7] = msecs;
+      argv[8] = "STREAMS";
+      rc = cr_streamcmd(s, 11, argv, block);
+    }
+    if (rc != 0)
+      return rc;
 
-  return rc;
-}
+    /* reply holds one stream: its key followed by its entries, or is nil 
+     * if none arrived in time */
+    if (mb->len == 0)
+      return 0;
+    if (mb->len < 3 || mb->types[2] != CR_MULTIBULK)
+      return CREDIS_ERR_PROTOCOL;
+    n = mb->lens[2];
+    if (!s->history || n > 0)
+      break;
+    s->history = 0;
+  }
 
-int credis_zremrangebyrank(REDIS rhnd, const char *key, int start, int end)
-{
-  int rc = cr_sendfandreceive(rhnd, CR_INT, "ZREMRANGEBYRANK %s %d %d\r\n", 
-                              key, start, end);
+  i = 3;
+  if ((rc = cr_streamentries(s, &i, n, s->history ? s->start : NULL, &stop, callback, arg)) < 0)
+    return rc;
 
-  if (rc == 0)
-    rc = rhnd->reply.integer;
+  /* entries not delivered since callback stopped remain pending, history
+   * is read again to deliver them */
+  if (stop != 0) {
+    if (!s->history) {
+      s->history = 1;
+      strcpy(s->start, "0");
+    }
+    return stop;
+  }
+  if (s->history && n < count)
+    s->history = 0;
 
   return rc;
 }
 
-/* TODO add writev() support instead and push strings to send onto a vector of
- * strings to send instead... */
-static int cr_zstore(REDIS rhnd, int inter, const char *destkey, int keyc, const char **keyv, 
-                     const int *weightv, REDIS_AGGREGATE aggregate)
+int credis_stream_claim(REDIS_STREAM s, int minidle, int count,
+                        REDIS_STREAM_CALLBACK callback, void *arg)
 {
-  cr_buffer *buf = &(rhnd->buf);
-  int rc, i;
+  cr_multibulk *mb = &(s->rhnd->reply.multibulk);
+  char idle[16], num[16], next[CR_STREAM_ID_SIZE];
+  const char *argv[] = {"XAUTOCLAIM", s->key, s->group, s->consumer, idle, s->cursor,
+                        "COUNT", num};
+  int i, rc, stop = 0;
 
-  buf->len = 0;
-  
-  if ((rc = cr_appendstrf(buf, "%s %s %d ", inter?"ZINTERSTORE":"ZUNIONSTORE", destkey, keyc)) != 0)
-    return rc;
-  if ((rc = cr_appendstrarray(buf, keyc, keyv, 0)) != 0)
-    return rc;
-  if (weightv != NULL)
-    for (i = 0; i < keyc; i++)
-      if ((rc = cr_appendstrf(buf, " %d", weightv[i])) != 0)
-        return rc;
+  snprintf(idle, sizeof(idle), "%d", minidle);
+  snprintf(num, sizeof(num), "%d", count > 0 ? count : 256);
 
-  switch (aggregate) {
-  case SUM: 
-    rc = cr_appendstr(buf, "AGGREGATE SUM", 0);
-    break;
-  case MIN:
-    rc = cr_appendstr(buf, "AGGREGATE MIN", 0);
-    break;
-  case MAX:
-    rc = cr_appendstr(buf, "AGGREGATE MAX", 0);
-    break;
-  case NONE:
-    ; /* avoiding compiler warning */
-  }
-  if (rc != 0)
+  if ((rc = cr_streamcmd(s, 8, argv, 0)) != 0)
     return rc;
 
-  if ((rc = cr_appendstr(buf, "\r\n", 0)) != 0)
+  /* reply is the cursor to continue from, the entries claimed and, by
+   * Redis >= 7.0, IDs of deleted entries */
+  if (mb->len < 2 || mb->types[0] != CR_BULK || mb->lens[0] >= CR_STREAM_ID_SIZE ||
+      mb->types[1] != CR_MULTIBULK)
+    return CREDIS_ERR_PROTOCOL;
+  memcpy(next, mb->bulks[0], mb->lens[0] + 1);
+  i = 2;
+  if ((rc = cr_streamentries(s, &i, mb->lens[1], NULL, &stop, callback, arg)) < 0)
     return rc;
 
-  if ((rc = cr_sendandreceive(rhnd, CR_INT)) == 0) 
-    rc = rhnd->reply.integer;
+  /* claimed entries not delivered are claimed again from where callback
+   * stopped */
+  if (stop != 0) {
+    memcpy(s->cursor, mb->bulks[i + 1], mb->lens[i + 1] + 1);
+    return stop;
+  }
+  strcpy(s->cursor, next);
 
   return rc;
 }
 
-int credis_zinterstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv, 
-                       const int *weightv, REDIS_AGGREGATE aggregate)
+int credis_stream_ack(REDIS_STREAM s)
 {
-  return cr_zstore(rhnd, 1, destkey, keyc, keyv, weightv, aggregate);
+  if (s->ackc == 0)
+    return 0;
+
+  return cr_streamcmd(s, 0, NULL, 0);
 }
 
-int credis_zunionstore(REDIS rhnd, const char *destkey, int keyc, const char **keyv, 
-                       const int *weightv, REDIS_AGGREGATE aggregate)
+void credis_stream_close(REDIS_STREAM s)
 {
-  return cr_zstore(rhnd, 0, destkey, keyc, keyv, weightv, aggregate);
+  if (s == NULL)
+    return;
+  if (s->ackc > 0)
+    credis_stream_ack(s);
+  free(s->key);
+  free(s->group);
+  free(s->consumer);
+  free(s->acks.data);
+  free(s);
 }
 
 /*
@@ -92,6 +92,49 @@ typedef struct _cr_redis* REDIS;
 #define CREDIS_TYPE_STRING 2
 #define CREDIS_TYPE_LIST 3
 #define CREDIS_TYPE_SET 4
+#define CREDIS_TYPE_ZSET 5
+#define CREDIS_TYPE_HASH 6
+#define CREDIS_TYPE_STREAM 7
+#define CREDIS_TYPE_MODULE 8
+
+/* server capabilities, used to pick the cheapest form of a command */
+#define CREDIS_CAP_MULTIBULK 0x0001     /* unified request protocol, Redis >= 1.2 */
+#define CREDIS_CAP_KEYSMULTIBULK 0x0002 /* KEYS replies multi-bulk, Redis >= 2.0 */
+#define CREDIS_CAP_VARIADIC 0x0004      /* variadic RPUSH, SADD etc, Redis >= 2.4 */
+#define CREDIS_CAP_MILLISECONDS 0x0008  /* PSETEX, PEXPIRE etc, Redis >= 2.6 */
+#define CREDIS_CAP_SCAN 0x0010          /* SCAN family, Redis >= 2.8 */
+#define CREDIS_CAP_PSYNC 0x0020         /* PSYNC, Redis >= 2.8 */
+#define CREDIS_CAP_COMMAND 0x0040       /* COMMAND, Redis >= 2.8.13 */
+#define CREDIS_CAP_UNLINK 0x0080        /* UNLINK, Redis >= 4.0 */
+#define CREDIS_CAP_MEMORY 0x0100        /* MEMORY USAGE and OBJECT FREQ, Redis >= 4.0 */
+#define CREDIS_CAP_STREAMS 0x0200       /* XADD family, Redis >= 5.0 */
+
+/* class of error replied by server, by the prefix of its message */
+#define CREDIS_ERRTYPE_NONE 0            /* last reply was not an error */
+#define CREDIS_ERRTYPE_OTHER 1           /* "ERR" or other prefix */
+#define CREDIS_ERRTYPE_UNKNOWNCOMMAND 2  /* command renamed, disabled or too new */
+#define CREDIS_ERRTYPE_WRONGTYPE 3
+#define CREDIS_ERRTYPE_OOM 4
+#define CREDIS_ERRTYPE_NOSCRIPT 5
+#define CREDIS_ERRTYPE_NOAUTH 6
+#define CREDIS_ERRTYPE_NOPERM 7
+#define CREDIS_ERRTYPE_EXECABORT 8
+#define CREDIS_ERRTYPE_NOREPLICAS 9
+#define CREDIS_ERRTYPE_LOADING 10        /* dataset is being loaded */
+#define CREDIS_ERRTYPE_BUSY 11           /* a script or module command runs */
+#define CREDIS_ERRTYPE_TRYAGAIN 12       /* keys of slot are being migrated */
+#define CREDIS_ERRTYPE_MASTERDOWN 13     /* replica lost its master */
+#define CREDIS_ERRTYPE_CLUSTERDOWN 14
+#define CREDIS_ERRTYPE_READONLY 15       /* replica, e.g. of a failed over master */
+#define CREDIS_ERRTYPE_MOVED 16          /* slot is served by another node */
+#define CREDIS_ERRTYPE_ASK 17
+
+/* error is transient, same command to same server can be retried later */
+#define CREDIS_ERRTYPE_RETRY(type) \
+  ((type) >= CREDIS_ERRTYPE_LOADING && (type) <= CREDIS_ERRTYPE_CLUSTERDOWN)
+/* command should be sent to another server */
+#define CREDIS_ERRTYPE_REROUTE(type) \
+  ((type) >= CREDIS_ERRTYPE_READONLY && (type) <= CREDIS_ERRTYPE_ASK)
 
 #define CREDIS_SERVER_MASTER 1
 #define CREDIS_SERVER_SLAVE 2
@@ -135,6 +178,47 @@ typedef struct _cr_info {
 } REDIS_INFO;
 
 
+/* Socket options of a connection, zero for defaults. A handle keeps them 
+ * for connections made like it, e.g. for notifications, so that handles of
+ * bulk transfers can get large buffers and interactive ones fast detection
+ * of dead peers. An option set to CREDIS_SOCKOPT_OFF is set to 0, e.g. to 
+ * turn quickack, cork or tos off again. */
+#define CREDIS_SOCKOPT_OFF -1
+
+typedef struct _cr_socket_options {
+  int sndbuf;        /* bytes of send buffer (SO_SNDBUF) and */
+  int rcvbuf;        /* of receive buffer (SO_RCVBUF) */
+  int user_timeout;  /* milliseconds sent data may remain unacknowledged 
+                      * before connection is dropped (TCP_USER_TIMEOUT) */
+  int keepidle;      /* seconds idle before keepalive probes are sent, */
+  int keepintvl;     /* seconds between probes and */
+  int keepcnt;       /* probes unanswered before connection is dropped */
+  int quickack;      /* positive to acknowledge replies without delay */
+  int cork;          /* positive to send pipelined chunks in full segments */
+  int tos;           /* IP type of service, e.g. 0x10 for low delay */
+} REDIS_SOCKET_OPTIONS;
+
+/* TLS settings of credis_connect_tls(), zero for defaults */
+typedef struct _cr_tls_options {
+  const char *ca_file;     /* CA certificates (PEM) to verify server with, */
+  const char *ca_path;     /* NULL for those of system */
+  const char *cert_file;   /* certificate chain (PEM) of client, NULL for none */
+  const char *key_file;    /* private key (PEM), NULL if in `cert_file' */
+  const char *server_name; /* to verify certificate and for SNI, NULL for host */
+  int insecure;            /* non-zero to not verify certificate of server */
+  int ktls;                /* non-zero to let kernel encrypt where available */
+  const REDIS_SOCKET_OPTIONS *socket; /* NULL for defaults */
+} REDIS_TLS_OPTIONS;
+
+typedef struct _cr_tls_info {
+  const char *version;     /* e.g. "TLSv1.3" */
+  const char *cipher;
+  int resumed;             /* non-zero if session was resumed */
+  int ktls_send;           /* non-zero if kernel encrypts */
+  int ktls_receive;        /* non-zero if kernel decrypts */
+} REDIS_TLS_INFO;
+
+
 /*
  * Connection handling
  */
@@ -147,9 +231,39 @@ typedef struct _cr_info {
  * connection has been made using credis_settimeout() */
 REDIS credis_connect(const char *host, int port, int timeout);
 
+/* Same as credis_connect() with socket options `options' applied before 
+ * connecting, which buffer sizes need to affect window scaling. Options
+ * not available or not permitted are skipped. */
+REDIS credis_connect_options(const char *host, int port, int timeout, 
+                             const REDIS_SOCKET_OPTIONS *options);
+
+/* Same as credis_connect() for a server that requires TLS, NULL if built 
+ * without OpenSSL (configure --with-openssl). The last session with each
+ * server is kept by the library and resumed by next connection, which then
+ * skips most of the handshake. Connections made by credis on behalf of a 
+ * TLS handle, e.g. for notifications, use TLS the same way. */
+REDIS credis_connect_tls(const char *host, int port, int timeout, 
+                         const REDIS_TLS_OPTIONS *options);
+
+/* returns -1 if connection is not encrypted */
+int credis_tls_info(REDIS rhnd, REDIS_TLS_INFO *info);
+
 /* set Redis server reply `timeout' in millisecs */ 
 void credis_settimeout(REDIS rhnd, int timeout);
 
+/* Applies socket options `options' to connection, those that are 0 are 
+ * left as they are, those that are CREDIS_SOCKOPT_OFF are turned off. 
+ * Returns 0 on success, 1 if some option is not available or not 
+ * permitted, in which case the others are still applied. */
+int credis_setsocketoptions(REDIS rhnd, const REDIS_SOCKET_OPTIONS *options);
+
+/* Makes receive spin on the socket for up to `usecs' microseconds before it
+ * sleeps waiting for a reply, 0 to not spin. Lowers latency to a server on 
+ * the same host at the cost of a busy core. Socket busy polling 
+ * (SO_BUSY_POLL) of the same time is also requested. Returns 0 on success,
+ * 1 if socket busy polling is not available or not permitted. */
+int credis_setbusypoll(REDIS rhnd, int usecs);
+
 void credis_close(REDIS rhnd);
 
 void credis_quit(REDIS rhnd);
@@ -158,10 +272,31 @@ int credis_auth(REDIS rhnd, const char *password);
 
 int credis_ping(REDIS rhnd);
 
+/* returns capabilities of server, refer to CREDIS_CAP_* defines. They are 
+ * derived from server version when connecting, or authenticating if INFO
+ * is refused before that. If version is unknown a server that supports 
+ * variadic commands is assumed. Commands fall back to older forms when
+ * capabilities are missing. */
+int credis_capabilities(REDIS rhnd);
+
+/* sets capabilities, e.g. for a proxy that does not support all commands of 
+ * the server version it reports */
+void credis_setcapabilities(REDIS rhnd, int caps);
+
+/* derives capabilities from COMMAND INFO (Redis >= 2.8.13), which also 
+ * detects commands that are renamed or disabled. Does nothing on older 
+ * servers. Returns capabilities on success */
+int credis_probe_capabilities(REDIS rhnd);
+
 /* if a function call returns error it is _possible_ that the Redis server
  * replied with an error message. It is returned by this function. */
 char* credis_errorreply(REDIS rhnd);
 
+/* returns class of error replied by server in last reply, refer to 
+ * CREDIS_ERRTYPE_* defines, classified when reply is parsed so that it 
+ * can be acted on without looking at the message */
+int credis_errortype(REDIS rhnd);
+
 /* 
  * Commands operating on all the kind of values
  */
@@ -228,8 +363,15 @@ int credis_mget(REDIS rhnd, int keyc, const char **keyv, char ***valv);
 /* returns -1 if the key already exists and hence not set */
 int credis_setnx(REDIS rhnd, const char *key, const char *val);
 
+/* sets `key' to `val' that expires after `secs' seconds, in one atomic 
+ * command (Redis >= 2.0) */
+int credis_setex(REDIS rhnd, const char *key, int secs, const char *val);
+
+/* as credis_setex() but expires after `msecs' milliseconds (Redis >= 2.6), 
+ * rounded up to whole seconds for older servers */
+int credis_psetex(REDIS rhnd, const char *key, long long msecs, const char *val);
+
 /* TODO
- * SETEX key time value Set+Expire combo command
  * MSET key1 value1 key2 value2 ... keyN valueN set a multiple keys to multiple values in a single atomic operation
  * MSETNX key1 value1 key2 value2 ... keyN valueN set a multiple keys to multiple values in a single atomic operation if none of
  */
@@ -260,12 +402,31 @@ int credis_rpush(REDIS rhnd, const char *key, const char *element);
 
 int credis_lpush(REDIS rhnd, const char *key, const char *element);
 
+/* Pushes the `elemc' elements of `elemv' with as few commands as possible,
+ * in order. Commands are variadic on Redis >= 2.4 and split in chunks of 
+ * about 64 KB, otherwise one command per element is pipelined. Returns 
+ * length of list after the push. */
+int credis_rpushv(REDIS rhnd, const char *key, int elemc, const char **elemv);
+
+int credis_lpushv(REDIS rhnd, const char *key, int elemc, const char **elemv);
+
 /* returns length of list */
 int credis_llen(REDIS rhnd, const char *key);
 
 /* returns number of elements returned in vector `elementv' */
 int credis_lrange(REDIS rhnd, const char *key, int start, int range, char ***elementv);
 
+/* Same as credis_lrange() for lists of numbers, which are parsed straight 
+ * from the reply into `valv', which holds `size' numbers. No strings are 
+ * stored. Returns number of elements of list range, which is more than 
+ * what is stored if `size' is too small, or CREDIS_ERR if an element is 
+ * not a number (integers of at most 18 digits for the int64 variant). */
+int credis_lrange_int64(REDIS rhnd, const char *key, int start, int range, 
+                        long long *valv, int size);
+
+int credis_lrange_double(REDIS rhnd, const char *key, int start, int range, 
+                         double *valv, int size);
+
 int credis_ltrim(REDIS rhnd, const char *key, int start, int end);
 
 /* returns -1 if the key doesn't exists */
@@ -296,6 +457,10 @@ int credis_rpop(REDIS rhnd, const char *key, char **val);
 /* returns -1 if the given member was already a member of the set */
 int credis_sadd(REDIS rhnd, const char *key, const char *member);
 
+/* Adds the `membc' members of `membv', refer to credis_rpushv(). Returns 
+ * number of members that were not already members of the set. */
+int credis_saddv(REDIS rhnd, const char *key, int membc, const char **membv);
+
 /* returns -1 if the given member is not a member of the set */
 int credis_srem(REDIS rhnd, const char *key, const char *member);
 
@@ -336,6 +501,12 @@ int credis_sdiffstore(REDIS rhnd, const char *destkey, int keyc, const char **ke
 /* returns number of members returned in vector `members' */
 int credis_smembers(REDIS rhnd, const char *key, char ***members);
 
+/* same as credis_smembers() for sets of numbers, refer to 
+ * credis_lrange_int64() */
+int credis_smembers_int64(REDIS rhnd, const char *key, long long *membv, int size);
+
+int credis_smembers_double(REDIS rhnd, const char *key, double *membv, int size);
+
 /* TODO Redis >= 1.1
  * SRANDMEMBER key Return a random member of the Set value at key
  */
@@ -349,6 +520,12 @@ int credis_smembers(REDIS rhnd, const char *key, char ***members);
  * 0 is returned if the new element was added */
 int credis_zadd(REDIS rhnd, const char *key, double score, const char *member);
 
+/* Adds the `membc' members of `membv' with respective score of `scorev', 
+ * refer to credis_rpushv(). Returns number of members that were added, 
+ * not counting members whose score was updated. */
+int credis_zaddv(REDIS rhnd, const char *key, int membc, const double *scorev, 
+                 const char **membv);
+
 /* returns -1 if the member was not a member of the sorted set */
 int credis_zrem(REDIS rhnd, const char *key, const char *member);
 
@@ -479,6 +656,669 @@ int credis_slaveof(REDIS rhnd, const char *host, int port);
  */
 
 
+/*
+ * Replication
+ */
+
+/* called with the next `len' bytes of the snapshot (RDB) that is initially 
+ * transferred by master, return non-zero to stop replication */
+typedef int (*REDIS_RDB_CALLBACK)(const char *data, int len, void *arg);
+
+/* called for every command master propagates, `argc' is the number of 
+ * arguments in `argv' and `argl' their respective length, return non-zero 
+ * to stop replication */
+typedef int (*REDIS_COMMAND_CALLBACK)(int argc, char **argv, int *argl, void *arg);
+
+/* Connects to server as a replica (slave) using SYNC, or PSYNC for Redis 
+ * >= 2.8, and feeds the initial snapshot to `rdbcb' and then every 
+ * following write command to `cmdcb', until one of them returns non-zero, 
+ * in which case 0 is returned. Either callback can be NULL. Commands are 
+ * received in the order master executed them, SELECT included, and the 
+ * buffers they refer to are only valid during the callback. Master's 
+ * periodic PINGs are acknowledged and not passed on. While master is 
+ * silent the offset is acknowledged every timeout of handle, a command 
+ * that is not received completely within it is an error. After this call
+ * the handle can only be closed. */
+int credis_sync(REDIS rhnd, REDIS_RDB_CALLBACK rdbcb, REDIS_COMMAND_CALLBACK cmdcb, void *arg);
+
+
+/*
+ * Snapshot (RDB) parsing
+ */
+
+typedef struct _cr_rdb_record {
+  int db;
+  int type;            /* refer to CREDIS_TYPE_* defines */
+  int encoding;        /* object type as stored in the snapshot */
+  const char *key;
+  int keylen;
+  long long expire;    /* UNIX time in milliseconds or -1 if not set */
+  long long size;      /* number of bytes value occupies in the snapshot */
+  long long elements;
+} REDIS_RDB_RECORD;
+
+/* called for each key-value pair, return non-zero to stop parsing */
+typedef int (*REDIS_RDB_RECORD_CALLBACK)(const REDIS_RDB_RECORD *rec, void *arg);
+
+/* called for each element of a value, before its record callback, with 
+ * `size' and `elements' of the record not yet set. Hash fields and values 
+ * as well as sorted set members and scores are passed as pairs. Integer 
+ * encoded elements are passed as decimal strings. Return non-zero to stop 
+ * parsing */
+typedef int (*REDIS_RDB_ELEMENT_CALLBACK)(const REDIS_RDB_RECORD *rec, 
+                                          const char *elem, int len, void *arg);
+
+/* Parses the snapshot of `size' bytes in `data', decoding all value 
+ * encodings (ziplists, listpacks, intsets, zipmaps and LZF compressed 
+ * strings). Keys and elements refer directly into `data' where possible, 
+ * otherwise to buffers that are reused, and are only valid during the 
+ * callback. Either callback can be NULL, streams and module values are 
+ * skipped without passing on their elements. Returns the number of bytes 
+ * parsed, up to and including the trailing checksum, or where a callback 
+ * stopped parsing, or a negative value on error. CREDIS_ERR is returned for 
+ * values that can not be decoded, such as module values of old formats. */
+long long credis_rdb_parse(const char *data, long long size, 
+                           REDIS_RDB_RECORD_CALLBACK reccb, 
+                           REDIS_RDB_ELEMENT_CALLBACK elemcb, void *arg);
+
+/* same as credis_rdb_parse() but for snapshot file `path', which is mapped 
+ * to memory */
+long long credis_rdb_file(const char *path, REDIS_RDB_RECORD_CALLBACK reccb, 
+                          REDIS_RDB_ELEMENT_CALLBACK elemcb, void *arg);
+
+
+/*
+ * Append-only file (AOF) reading and replay
+ */
+
+typedef struct _cr_aof_stats {
+  long long commands;   /* commands read from file */
+  long long sent;       /* commands sent to server */
+  long long filtered;   /* commands not sent due to `pattern' or `db' */
+  long long errors;     /* commands server replied with an error to */
+  long long skipped;    /* snapshot records that could not be replayed */
+  long long bytes;      /* bytes read from file */
+  double elapsed;       /* seconds since start */
+  int truncated;        /* file ended with an incomplete command */
+} REDIS_AOF_STATS;
+
+/* called to report progress, return non-zero to stop replay */
+typedef int (*REDIS_AOF_PROGRESS_CALLBACK)(const REDIS_AOF_STATS *stats, void *arg);
+
+typedef struct _cr_aof_options {
+  int window;           /* maximum number of commands in flight, 0 for default (1024) */
+  const char *pattern;  /* only replay commands whose first argument after the
+                         * command name matches glob-style pattern, or NULL */
+  int dbfilter;         /* set to only replay commands of database `db', 
+                         * 0 to replay all databases */
+  int db;
+  long long interval;   /* number of commands between calls to `progress', 
+                         * 0 for default (100000) */
+  REDIS_AOF_PROGRESS_CALLBACK progress;
+  void *arg;
+} REDIS_AOF_OPTIONS;
+
+/* Reads append-only file `path', which is memory-mapped, and passes each 
+ * command on to `cmdcb' as described for credis_sync(), except that 
+ * arguments are not zero-terminated. They refer directly into the file. If
+ * the file starts with a snapshot (RDB) preamble its keys are passed on as 
+ * SET, RPUSH, SADD, ZADD, HSET and PEXPIREAT commands. If `path' is a 
+ * directory, as written by Redis >= 7.0, the files its manifest lists are
+ * read. Returns number of commands read or a negative value on error. */
+long long credis_aof_file(const char *path, REDIS_COMMAND_CALLBACK cmdcb, void *arg);
+
+/* Replays append-only file `path' (refer to credis_aof_file()) to server,
+ * pipelining up to `window' commands. Commands are sent straight from the 
+ * file without being copied. `options' and `stats' can be NULL. Replies are
+ * only checked for errors, which are counted in `stats'. */
+int credis_aof_replay(REDIS rhnd, const char *path, const REDIS_AOF_OPTIONS *options, 
+                      REDIS_AOF_STATS *stats);
+
+
+/*
+ * Keyspace analysis
+ */
+
+typedef struct _cr_analyze_options {
+  const char *pattern;     /* only analyze keys matching glob-style pattern, or NULL */
+  int count;               /* keys per SCAN, 0 for default (100) */
+  int sample;              /* inspect one in `sample' keys, 0 or 1 to inspect all */
+  int budget;              /* maximum commands per second to each server, 0 for 
+                            * no limit */
+  const char *delimiters;  /* characters that end a key prefix, NULL for ":" */
+  int memory;              /* get bytes used with MEMORY USAGE (Redis >= 4.0) */
+  int frequency;           /* get access frequency with OBJECT FREQ (Redis >= 4.0 
+                            * with an LFU maxmemory-policy) */
+  int top;                 /* number of biggest and hottest keys, 0 for default (20) */
+} REDIS_ANALYZE_OPTIONS;
+
+typedef struct _cr_analyze_stat {
+  char *name;              /* prefix, or NULL */
+  long long keys;          /* keys scanned, estimated for prefixes */
+  long long sampled;       /* keys inspected */
+  long long elements;      /* elements, or string length, of keys inspected */
+  long long bytes;         /* memory used by keys inspected, string length unless 
+                            * `memory' is set */
+  long long freq;          /* sum of access frequency of keys inspected */
+} REDIS_ANALYZE_STAT;
+
+typedef struct _cr_analyze_key {
+  char *name;
+  int type;                /* refer to CREDIS_TYPE_* defines */
+  int server;              /* index of handle key was found on */
+  long long elements;
+  long long bytes;
+  long long freq;          /* logarithmic access frequency, or -1 if not known */
+} REDIS_ANALYZE_KEY;
+
+typedef struct _cr_analyze_report {
+  REDIS_ANALYZE_STAT total;
+  REDIS_ANALYZE_STAT other;  /* keys whose prefix is not in `prefixes' */
+  REDIS_ANALYZE_STAT types[CREDIS_TYPE_MODULE + 1]; /* keys inspected per type */
+  REDIS_ANALYZE_STAT *prefixes; /* sorted on bytes, then keys */
+  int prefixc;
+  REDIS_ANALYZE_KEY *biggest;   /* sorted on bytes, or elements if not known */
+  int biggestc;
+  REDIS_ANALYZE_KEY *hottest;   /* sorted on access frequency */
+  int hottestc;
+  long long commands;      /* commands sent to all servers */
+  double elapsed;          /* seconds */
+} REDIS_ANALYZE_REPORT;
+
+/* Analyzes the keyspace of the `rhndc' servers in `rhndv' (Redis >= 2.8), 
+ * e.g. the shards of a cluster, without blocking them. Servers are scanned 
+ * in parallel with SCAN and type, length and optionally memory usage and 
+ * access frequency of each key sampled is fetched with pipelined commands.
+ * Keys are aggregated on prefix. Up to 4096 of the prefixes most keys share
+ * are kept, as estimated with a count-min sketch, the rest are accounted 
+ * for in `other'. Figures of keys inspected have to be scaled with `keys' 
+ * and `sampled' to estimate figures of all keys. The report has to be freed
+ * with credis_analyze_free(). On error handles may have replies pending 
+ * and should be closed. */
+int credis_analyze(REDIS *rhndv, int rhndc, const REDIS_ANALYZE_OPTIONS *options,
+                   REDIS_ANALYZE_REPORT *report);
+
+void credis_analyze_free(REDIS_ANALYZE_REPORT *report);
+
+
+/*
+ * Incremental deletion
+ */
+
+typedef struct _cr_delete_options {
+  int batch;    /* elements or keys deleted per command, 0 for default (100) */
+  int rate;     /* maximum elements or keys deleted per second, 0 for no limit */
+} REDIS_DELETE_OPTIONS;
+
+/* Deletes `key' without blocking server for long, as DEL of a large value 
+ * would. Sets and hashes are emptied with SSCAN and SREM or HSCAN and HDEL, 
+ * sorted sets with ZREMRANGEBYRANK and lists with LTRIM, in batches of 
+ * `batch' elements, before the key is deleted, with UNLINK if supported.
+ * Calling thread is blocked until done, so it is typically called from a 
+ * thread of its own with a handle of its own. `options' can be NULL. 
+ * Number of elements and keys deleted is returned in `deleted' unless 
+ * NULL. Returns -1 if key does not exist. */
+int credis_del_incremental(REDIS rhnd, const char *key, const REDIS_DELETE_OPTIONS *options,
+                           long long *deleted);
+
+/* Deletes keys matching glob-style `pattern' found with SCAN (Redis >= 
+ * 2.8), or KEYS on older servers, in batches of `batch' keys with UNLINK, 
+ * or DEL for Redis < 4.0. Deletion of a batch and scanning for the next 
+ * are pipelined. Refer to credis_del_incremental(). */
+int credis_del_pattern(REDIS rhnd, const char *pattern, const REDIS_DELETE_OPTIONS *options,
+                       long long *deleted);
+
+
+/*
+ * Hot key tracking
+ */
+
+#define CREDIS_HOTKEY_SIZE 64
+#define CREDIS_HOTKEYS_MAX 64
+
+typedef struct _cr_hotkey_info {
+  char key[CREDIS_HOTKEY_SIZE]; /* zero-terminated, truncated if longer */
+  int keylen;                   /* length of key */
+  long long count;              /* estimated number of recent commands on key */
+  double share;                 /* estimated share of recent commands with a key */
+} REDIS_HOTKEY;
+
+/* called when a key becomes one of the hot keys, by the thread sending the
+ * command, so it has to return quickly */
+typedef void (*REDIS_HOTKEY_CALLBACK)(const REDIS_HOTKEY *key, void *arg);
+
+/* Enables tracking of the `k' (at most CREDIS_HOTKEYS_MAX) most frequent 
+ * keys of commands sent by this process, on all handles. One in `sample' 
+ * commands is sampled into a count-min sketch, which is updated without 
+ * locking. Counts are halved regularly so that keys that cool down are 
+ * forgotten. Every command sent is counted, also those of pipelines and 
+ * batches. If built with <sys/sdt.h> every sampled key fires USDT probe 
+ * credis:sample and every new hot key credis:hotkey, both with arguments
+ * key, key length and estimated count, where credis:hotkey gets the key 
+ * as stored, truncated to CREDIS_HOTKEY_SIZE-1 bytes. Calling again resets 
+ * tracking. */
+int credis_hotkeys_enable(int sample, int k, REDIS_HOTKEY_CALLBACK cb, void *arg);
+
+void credis_hotkeys_disable(void);
+
+/* Stores up to `size' current hot keys in `keyv', most frequent first. 
+ * Returns number of keys stored */
+int credis_hotkeys(REDIS_HOTKEY *keyv, int size);
+
+
+/*
+ * Striped counters and replicated keys
+ *
+ * A key that is spread is stored as sub-keys "<key>:0" to "<key>:<n-1>", 
+ * sub-key `i' on handle `i' modulo `rhndc' of the `rhndc' handles in 
+ * `rhndv', which can be one handle or e.g. one per shard. Keys can be at 
+ * most 244 bytes.
+ */
+
+/* Increments counter `key' spread over `stripes' sub-keys by `incr'. Each
+ * thread increments its own stripe, which spreads the load of a counter 
+ * incremented by many threads or processes. */
+int credis_counter_incr(REDIS *rhndv, int rhndc, const char *key, int stripes, long long incr);
+
+/* Sums stripes of counter `key' with one pipelined MGET per handle, 
+ * returned in `value' */
+int credis_counter_get(REDIS *rhndv, int rhndc, const char *key, int stripes, long long *value);
+
+int credis_counter_del(REDIS *rhndv, int rhndc, const char *key, int stripes);
+
+/* Sets all `copies' of `key' to `val', with pipelined commands, which 
+ * spreads the load of a key that is read often */
+int credis_replicated_set(REDIS *rhndv, int rhndc, const char *key, int copies, 
+                          const char *val);
+
+/* Gets a randomly chosen copy of `key'. Returns -1 if the copy does not 
+ * exist. */
+int credis_replicated_get(REDIS *rhndv, int rhndc, const char *key, int copies, char **val);
+
+int credis_replicated_del(REDIS *rhndv, int rhndc, const char *key, int copies);
+
+
+/*
+ * Batch commands
+ *
+ * A batch sends a command for each of the `n' keys in `keyv', pipelined in 
+ * chunks, and stores the status of each in `statusv': 0 on success, -1 if 
+ * key does not exist, or <0 if it failed, e.g. CREDIS_ERR if server replied
+ * with an error. Returns number of commands that succeeded, or <0 if the 
+ * connection failed, in which case status of the remaining keys is set to 
+ * the error. Requires Redis >= 1.2.
+ */
+
+/* Sets keys to values of `valv', each expiring after its time to live in 
+ * seconds in `ttlv' (SETEX), or not at all if its time to live is 0 or 
+ * `ttlv' is NULL (SET) */
+int credis_batch_set_ex(REDIS rhnd, int n, const char **keyv, const char **valv, 
+                        const int *ttlv, int *statusv);
+
+/* Gets values of keys into `valv', NULL for keys that do not exist. Values 
+ * are valid until next batch command on handle. */
+int credis_batch_get(REDIS rhnd, int n, const char **keyv, char **valv, int *statusv);
+
+int credis_batch_exists(REDIS rhnd, int n, const char **keyv, int *statusv);
+
+int credis_batch_del(REDIS rhnd, int n, const char **keyv, int *statusv);
+
+
+/*
+ * Durable writes
+ *
+ * A group of writes is pipelined followed by a single WAIT, so that the 
+ * round trip to wait for replicas to acknowledge them is paid once for the
+ * group rather than once per write. Requires Redis >= 3.0.
+ */
+
+typedef struct _cr_durable *REDIS_DURABLE;
+
+/* returns NULL if server does not support the unified request protocol */
+REDIS_DURABLE credis_durable_open(REDIS rhnd);
+
+/* Appends write command of `argc' arguments in `argv' to group, first 
+ * argument after command taken as key. Returns index of write in group. */
+int credis_durable_write(REDIS_DURABLE group, int argc, const char **argv);
+
+/* Sends writes of group followed by WAIT for `numreplicas' replicas at 
+ * most `timeout' milliseconds (>0), and empties group. Status of each 
+ * write is stored in `statusv': 0 if it succeeded and is acknowledged by 
+ * `numreplicas' replicas, 1 if it succeeded but is not, or CREDIS_ERR if 
+ * server replied with an error, or the error code of a failed connection
+ * for writes whose reply was not received. Returns number of replicas 
+ * that acknowledged, or <0 if connection failed. */
+int credis_durable_commit(REDIS_DURABLE group, int numreplicas, int timeout, int *statusv);
+
+void credis_durable_close(REDIS_DURABLE group);
+
+
+/*
+ * Cache-aside with early recomputation
+ *
+ * Cached values are stored prefixed with the time in milliseconds it took 
+ * to compute them, "<delta>:<value>". A reader that finds a value close to
+ * expiry recomputes it early, with a probability that grows as expiry 
+ * nears (XFetch), so that one reader refreshes a popular value before it 
+ * expires instead of all readers missing it at the same time.
+ */
+
+typedef struct _cr_cache_options {
+  long long ttl; /* time to live of values in milliseconds, 0 for no expiry */
+  double beta;   /* >1 favors earlier recomputation, 0 for default (1.0) */
+} REDIS_CACHE_OPTIONS;
+
+/* computes value of `key' into `val', which has to remain valid until the 
+ * value is no longer used by caller of credis_cache_get(). Returns 0 on 
+ * success. */
+typedef int (*REDIS_CACHE_COMPUTE)(const char *key, char **val, void *arg);
+
+/* Stores `val' of `key', which took `delta' milliseconds to compute, for 
+ * `ttl' milliseconds, with PSETEX */
+int credis_cache_set(REDIS rhnd, const char *key, const char *val, long long ttl, int delta);
+
+/* Gets value of `key' into `val', with its TTL in the same round trip. If 
+ * missing, or chosen for early recomputation, the value is computed with 
+ * `compute' and stored. `val' is valid until next call on handle, or as 
+ * long as the computed value. Returns -1 if missing and `compute' is NULL. */
+int credis_cache_get(REDIS rhnd, const char *key, const REDIS_CACHE_OPTIONS *options, 
+                     REDIS_CACHE_COMPUTE compute, void *arg, char **val);
+
+
+/*
+ * Negative lookup filter
+ *
+ * A Bloom filter per handle of the keys that exist, which answers lookups 
+ * of keys that definitely do not exist (credis_get(), credis_exists() and 
+ * batch GET and EXISTS) without asking server. It is built from a SCAN of 
+ * the keyspace and updated by writes on the handle. Writes by others are 
+ * not seen, so it should be rebuilt regularly unless this process is the
+ * only writer. Filter is not used until built, nor after another database
+ * is selected until rebuilt.
+ */
+
+typedef struct _cr_filter_stats {
+  long long lookups;          /* lookups checked against filter */
+  long long negatives;        /* lookups answered without asking server */
+  long long false_positives;  /* lookups passed to server for missing keys */
+  long long added;            /* keys added by writes and rebuilds */
+  long long rebuilds;
+  long long rebuild_keys;     /* keys found by last rebuild */
+  long long rebuild_commands; /* commands sent by last rebuild */
+  long long rebuild_usecs;    /* duration of last rebuild in microseconds */
+  unsigned long long bits;    /* size of filter */
+  int hashes;                 /* number of hash functions */
+  int valid;                  /* 1 if filter is used */
+  double fill;                /* share of bits set */
+  double fpr;                 /* estimated false positive rate */
+} REDIS_FILTER_STATS;
+
+/* Enables filter sized for `capacity' keys with false positive rate `fpr', 
+ * e.g. 0.01. Replaces filter of handle if any. */
+int credis_filter_enable(REDIS rhnd, long long capacity, double fpr);
+
+void credis_filter_disable(REDIS rhnd);
+
+/* Builds filter from a SCAN of the keyspace, KEYS for Redis < 2.8, which 
+ * replaces the current filter when done */
+int credis_filter_rebuild(REDIS rhnd);
+
+/* Returns CREDIS_ERR if filter is not enabled */
+int credis_filter_stats(REDIS rhnd, REDIS_FILTER_STATS *stats);
+
+
+/*
+ * Memory-mapped L2 cache
+ *
+ * A file-backed cache of string values, consulted by credis_get() before 
+ * asking server and filled with its replies. It survives restarts, so a
+ * restarted process starts warm, and it can be shared by processes of a 
+ * host, with one or more processes writing and others attached read-only. 
+ * Readers do not lock, writers take a spinlock in the file, which holds 
+ * their pid so that the lock of a writer that died is taken over. It is a
+ * hash table of records in an append log, which is emptied when full. 
+ * Writes on the handle update or invalidate their keys, a read-only handle
+ * instead stops looking up keys it wrote, but writes by others are only 
+ * seen once entries expire, so `ttl' bounds how stale values can be. If a
+ * write can not be reflected, because lock is held for long by another 
+ * writer, cache is emptied by next writer and handle stops using it until 
+ * it is attached again. Writers sharing a file must share a pid namespace.
+ * A file caches one server, it is emptied if attached by a writer 
+ * connected to another host or port. Used for database 0 only.
+ */
+
+typedef struct _cr_l2_stats {
+  long long hits;     /* lookups answered from cache, by this handle */
+  long long misses;   /* lookups passed to server, by this handle */
+  long long expired;  /* misses of expired entries, by this handle */
+  long long stores;   /* values stored, by this handle */
+  long long entries;  /* keys in cache */
+  long long resets;   /* times cache was emptied since it was created */
+  long long used;     /* bytes of log in use */
+  long long size;     /* bytes of log */
+} REDIS_L2_STATS;
+
+/* Attaches cache file `path' to handle, entries live at most `ttl' (>0)
+ * milliseconds. An existing file is reused, otherwise one of `size' bytes
+ * (at least 64 kB) is created, unless `readonly'. Returns CREDIS_ERR if 
+ * `readonly' and file caches another server. */
+int credis_l2_attach(REDIS rhnd, const char *path, long long size, long long ttl, int readonly);
+
+void credis_l2_detach(REDIS rhnd);
+
+/* Returns CREDIS_ERR if no cache is attached */
+int credis_l2_stats(REDIS rhnd, REDIS_L2_STATS *stats);
+
+
+/*
+ * Chunked values
+ *
+ * A large value is stored as chunks "<key>:<generation>:<i>", chunk `i' 
+ * on handle (h + i) % `rhndc' of the `rhndc' handles in `rhndv', where 
+ * handle `h' is chosen by hash of `key' and holds manifest `key' with 
+ * length, chunk size, CRC-32 and generation of value. Chunks are written 
+ * with MSET and read with MGET, a few chunks per command and all handles 
+ * in parallel, so that no connection or server is busy with one value for
+ * long. Keys can be at most 224 bytes.
+ */
+
+/* Stores `len' bytes of `val' in chunks of `chunk' bytes, 0 for default 
+ * (1 MB). Chunks of a new generation are written before the manifest is 
+ * replaced, after which chunks of the old value are deleted. */
+int credis_chunked_set(REDIS *rhndv, int rhndc, const char *key, const char *val, 
+                       long long len, int chunk);
+
+/* Reads value into `val', allocated with malloc() and zero-terminated, to
+ * be freed by caller, and its length into `len'. The CRC-32 is verified, 
+ * a value replaced while read is read again. Returns -1 if key does not 
+ * exist and CREDIS_ERR_PROTOCOL if value is corrupt. */
+int credis_chunked_get(REDIS *rhndv, int rhndc, const char *key, char **val, long long *len);
+
+int credis_chunked_del(REDIS *rhndv, int rhndc, const char *key);
+
+
+/*
+ * Client-side set operations
+ *
+ * Intersection, union and difference computed by client instead of server,
+ * which is otherwise busy with all other clients waiting while it works on
+ * many large sets. Set of a key is on handle chosen by hash of key among 
+ * the `rhndc' handles in `rhndv', like chunked values. All sets are read 
+ * in parallel with pipelined SSCAN (SMEMBERS on servers before 2.8), a 
+ * thousand members per command. Members returned are sorted, and are 
+ * valid until next set operation or batch command on first handle.
+ */
+
+/* returns number of members returned in vector `members' */
+int credis_sinter_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members);
+int credis_sunion_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members);
+int credis_sdiff_local(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***members);
+
+/* `destkey' is replaced by result, written with pipelined SADD commands.
+ * Returns number of members of result. */
+int credis_sinterstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                             int keyc, const char **keyv);
+int credis_sunionstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                             int keyc, const char **keyv);
+int credis_sdiffstore_local(REDIS *rhndv, int rhndc, const char *destkey, 
+                            int keyc, const char **keyv);
+
+
+/*
+ * Parallel MGET
+ */
+
+/* Same as credis_mget() for many keys, which are split in chunks of one 
+ * MGET each, spread over the `rhndc' handles in `rhndv', connected to the 
+ * same server or to servers holding the same keys. Chunks are pipelined to
+ * all handles at once and are sized from the reply bytes per key, round-
+ * trip time and transfer rate seen by previous calls. Values are valid 
+ * until next parallel MGET, set operation or batch command on first 
+ * handle. Returns number of values, or the first error replied if a chunk
+ * failed, in which case its keys are returned as missing. */
+int credis_mget_parallel(REDIS *rhndv, int rhndc, int keyc, const char **keyv, char ***valv);
+
+
+/*
+ * Keyspace notifications
+ *
+ * Events of keys, such as writes or expirations, are received on a 
+ * connection of its own subscribed to keyspace notification channels with
+ * PSUBSCRIBE, and are delivered in batches to a callback. Key and event 
+ * type of an event point into the receive buffer of the connection, they 
+ * are valid until the callback returns.
+ */
+
+typedef struct _cr_notify *REDIS_NOTIFY;
+
+typedef struct _REDIS_EVENT {
+  int db;
+  const char *key;
+  int keylen;
+  const char *event;  /* e.g. "set", "del" or "expired" */
+  int eventlen;
+} REDIS_EVENT;
+
+/* returns non-zero to stop polling, which is then returned by poll */
+typedef int (*REDIS_EVENT_CALLBACK)(const REDIS_EVENT *eventv, int eventc, void *arg);
+
+/* Adds classes of `flags' (e.g. "Ex", refer to notify-keyspace-events of 
+ * redis.conf) to configuration of server unless NULL or CONFIG is not 
+ * allowed, and subscribes to the `patternc' channel patterns of 
+ * `patternv', for instance "__keyevent@0__:expired". Events of all keys of
+ * selected database are subscribed to if `patternc' is 0. */
+REDIS_NOTIFY credis_notify_open(REDIS rhnd, const char *flags, 
+                                int patternc, const char **patternv);
+
+/* Delivers only events of keys matching glob-style pattern `match' and of 
+ * the space-separated event types of `events' (e.g. "expired evicted"), 
+ * NULL for all */
+int credis_notify_filter(REDIS_NOTIFY n, const char *match, const char *events);
+
+/* Waits at most `timeout' milliseconds for events and delivers those at 
+ * hand to `callback', at most `max' (0 for default, 256) of them. Returns 
+ * number of events delivered, 0 if none arrived in time. */
+int credis_notify_poll(REDIS_NOTIFY n, int timeout, int max, 
+                       REDIS_EVENT_CALLBACK callback, void *arg);
+
+void credis_notify_close(REDIS_NOTIFY n);
+
+
+/*
+ * Sorted set views
+ *
+ * A local copy of a sorted set that answers rank, range and score queries
+ * without asking the server. The set is read with ZRANGE WITHSCORES and a
+ * connection of its own subscribes to keyspace notifications of the key,
+ * which are enabled if CONFIG is allowed. A query that finds notifications
+ * received since the last one reads the set again before it is answered. 
+ * Set is of database selected on handle when view is opened. Members 
+ * returned are valid until next query of view.
+ */
+
+typedef struct _cr_zview *REDIS_ZVIEW;
+
+/* returns NULL if set could not be read or notifications not subscribed */
+REDIS_ZVIEW credis_zview_open(REDIS rhnd, const char *key);
+
+void credis_zview_close(REDIS_ZVIEW view);
+
+/* same as credis_zrange() etc. but answered by view */
+int credis_zview_zrange(REDIS_ZVIEW view, int start, int end, char ***elementv);
+int credis_zview_zrevrange(REDIS_ZVIEW view, int start, int end, char ***elementv);
+int credis_zview_zrank(REDIS_ZVIEW view, const char *member);
+int credis_zview_zrevrank(REDIS_ZVIEW view, const char *member);
+int credis_zview_zcard(REDIS_ZVIEW view);
+int credis_zview_zscore(REDIS_ZVIEW view, const char *member, double *score);
+
+
+/*
+ * Streams
+ *
+ * Entries are added in pipelined batches of XADD. A consumer of a consumer 
+ * group reads entries with XREADGROUP and gets them delivered to a 
+ * callback, with fields and values pointing into the receive buffer of the
+ * handle, which are valid until the callback returns and which the 
+ * callback must not use the handle for. Entries delivered are acknowledged
+ * with a single XACK sent together with the next command of consumer. 
+ * Requires Redis >= 5.0, claiming entries of other consumers Redis >= 6.2.
+ */
+
+typedef struct _cr_stream *REDIS_STREAM;
+
+typedef struct _REDIS_STREAM_ENTRY {
+  const char *id;
+  int idlen;
+  int fieldc;                  /* number of field-value pairs */
+  const char * const *fieldv;  /* field i at 2*i followed by its value */
+  const int *lenv;             /* length of each field and value */
+} REDIS_STREAM_ENTRY;
+
+/* returns 0 to acknowledge entry, or non-zero to stop delivery, which is 
+ * then returned by read or claim. Entry stopped at and those after it 
+ * remain pending and are delivered again. */
+typedef int (*REDIS_STREAM_CALLBACK)(const REDIS_STREAM_ENTRY *entry, void *arg);
+
+/* Adds `entryc' entries to stream `key' with IDs assigned by server, entry
+ * i with `fieldcv[i]' field-value pairs, taken one after another from 
+ * `fieldv'. Stream is trimmed to about `maxlen' entries unless 0. IDs of 
+ * entries are stored in `idv' unless NULL, NULL for entries not added, and
+ * are valid until next batch command. Returns number of entries added. */
+int credis_xaddv(REDIS rhnd, const char *key, int maxlen, int entryc,
+                 const int *fieldcv, const char **fieldv, char **idv);
+
+/* Creates consumer group `group' of stream `key' that delivers entries 
+ * after `id', NULL for new entries only ("$"). Stream is created if 
+ * `mkstream' is set. Returns 0 on success, 1 if group already exists. */
+int credis_xgroup_create(REDIS rhnd, const char *key, const char *group,
+                         const char *id, int mkstream);
+
+/* Returns consumer `consumer' of group `group' of stream `key', which 
+ * first delivers entries it has been delivered before but not acknowledged
+ * of, e.g. since an earlier process crashed, before any new entries */
+REDIS_STREAM credis_stream_open(REDIS rhnd, const char *key, const char *group,
+                                const char *consumer);
+
+/* Reads at most `count' (0 for default, 256) entries, waiting at most 
+ * `block' milliseconds (0 to not wait) for new entries, and delivers them 
+ * to `callback'. Returns number of entries acknowledged. */
+int credis_stream_read(REDIS_STREAM s, int count, int block,
+                       REDIS_STREAM_CALLBACK callback, void *arg);
+
+/* Claims at most `count' (0 for default, 256) entries that have been 
+ * pending for other consumers for at least `minidle' milliseconds, e.g. 
+ * since they crashed, with XAUTOCLAIM and delivers them to `callback'. 
+ * Successive calls scan through all pending entries of group. Returns 
+ * number of entries acknowledged. */
+int credis_stream_claim(REDIS_STREAM s, int minidle, int count,
+                        REDIS_STREAM_CALLBACK callback, void *arg);
+
+/* Sends acknowledgements not yet sent, also done by close */
+int credis_stream_ack(REDIS_STREAM s);
+
+void credis_stream_close(REDIS_STREAM s);
+
+
 #ifdef __cplusplus
 }
 #endif